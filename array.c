@@ -1,7 +1,16 @@
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* The implementation needs the layout of arrays, but no inline wrappers */
+#define ARRAY_IMPLEMENTATION
 #include "array.h"
+#include "array_sort.h"
 
-/* Optionally, use the memory module */
+/*
+ * Optionally, use the memory module for the default allocator.
+ * Arrays can also be given their own allocator at runtime.
+ */
 #ifdef USE_MEMORY
 	#include "memory.h"
 #else
@@ -10,48 +19,579 @@
 	#define memory_free free
 #endif
 
-/* Defines how many elements the array can store initially */
+/* Initial capacity of arrays whose elements don't fit in the small buffer */
 #define ARRAY_INITIAL_CAPACITY 16
 
-/* Capacity is increased by this factor when the array gets full */
+/*
+ * Capacity is increased by this factor when the array gets full, unless
+ * the array has a different growth policy. Shrinking always leaves room
+ * to grow by this factor.
+ */
 #define ARRAY_GROWTH_FACTOR 2
 
-struct Array {
-	int length;
-	int capacity;
-	void **elements;
+/* Address of the element at the given index */
+#define ARRAY_SLOT(array, index) \
+	((array)->elements + (size_t) (index) * (array)->element_size)
+
+/* Size in bytes of the given number of elements */
+#define ARRAY_BYTES(array, count) ((size_t) (count) * (array)->element_size)
+
+/* Start of the allocated block, which may be in front of the elements */
+#define ARRAY_BLOCK(array) \
+	((array)->elements - ARRAY_BYTES(array, (array)->head))
+
+/* Whether the elements are in the small buffer inside the array */
+#define ARRAY_IS_SMALL(array) \
+	((array)->elements != NULL && ARRAY_BLOCK(array) == (array)->small.bytes)
+
+/* Number of elements the small buffer can hold, if the array may use it */
+#define ARRAY_SMALL_CAPACITY(array) \
+	((array)->allocator == &array_default_allocator ? \
+		ARRAY_SMALL_SIZE / (array)->element_size : 0)
+
+/*
+ * Number of unused slots after the last element, which are the gap when
+ * the array is a gap buffer
+ */
+#define ARRAY_ROOM(array) \
+	((array)->capacity - (array)->head - (array)->length)
+
+/* Address of the element at the given index, skipping over any gap */
+#define ARRAY_ELEMENT(array, index) \
+	ARRAY_SLOT(array, (index) < (array)->length - (array)->gap_tail ? \
+		(index) : (index) + ARRAY_ROOM(array))
+
+/* Whether the array stores pointers, so the pointer functions may use it */
+#define ARRAY_HOLDS_POINTERS(array) \
+	((array) != NULL && (array)->element_size == sizeof(void*))
+
+/* Hint that the given address will be read soon */
+#if defined(__GNUC__)
+	#define ARRAY_PREFETCH(address) __builtin_prefetch(address)
+#else
+	#define ARRAY_PREFETCH(address) ((void) 0)
+#endif
+
+/* Passes the comparison function of array_sort to the introsort below */
+struct ArraySortContext {
+	int (*cmp)(const void*, const void*);
+};
+
+#define array_pointer_less(a, b) \
+	(((struct ArraySortContext*) context)->cmp((a), (b)) < 0)
+
+ARRAY_DEFINE_SORT(array_sort_pointers, void*, array_pointer_less)
+
+/* The sorting key of an element, along with the element's index */
+struct ArraySortKey {
+	uint64_t key;
+	size_t index;
+};
+
+/* Natural runs shorter than this are extended with insertion sort */
+#define ARRAY_MIN_RUN 32
+
+/* Enough pending runs for any array, given the merge invariants */
+#define ARRAY_MAX_RUNS 85
+
+/* State of a stable sort in progress */
+struct ArrayStableSort {
+	Array *array;
+	int (*cmp)(const void*, const void*);
+	char *temp;
+	int run_count;
+	size_t run_start[ARRAY_MAX_RUNS];
+	size_t run_length[ARRAY_MAX_RUNS];
+};
+
+static void *array_default_allocate(void *context, size_t size) {
+	(void) context;
+	return memory_malloc(size);
+}
+
+static void *array_default_reallocate(void *context, void *pointer,
+	size_t old_size, size_t new_size) {
+	(void) context;
+	(void) old_size;
+	return memory_realloc(pointer, new_size);
+}
+
+static void array_default_deallocate(void *context, void *pointer,
+	size_t size) {
+	(void) context;
+	(void) size;
+	memory_free(pointer);
+}
+
+/* Used by arrays that are not given an allocator of their own */
+static const ArrayAllocator array_default_allocator = {
+	array_default_allocate,
+	array_default_reallocate,
+	array_default_deallocate,
+	NULL,
+	NULL
+};
+
+#ifdef ARRAY_STATS
+
+/* Counters of all arrays, updated along with those of each array */
+static ArrayStats array_total_stats;
+
+#if defined(__GNUC__)
+	#define ARRAY_THREAD_LOCAL __thread
+	#define ARRAY_STATS_ADD(total, amount) \
+		__atomic_fetch_add(&(total), (amount), __ATOMIC_RELAXED)
+	#define ARRAY_STATS_LOAD(total) __atomic_load_n(&(total), __ATOMIC_RELAXED)
+#else
+	#define ARRAY_THREAD_LOCAL
+	#define ARRAY_STATS_ADD(total, amount) ((total) += (amount))
+	#define ARRAY_STATS_LOAD(total) (total)
+#endif
+
+/* Add to one of the counters of the array and to the total */
+#define ARRAY_STAT(array, field, amount) \
+	((array)->stats.field += (amount), \
+		ARRAY_STATS_ADD(array_total_stats.field, (uint64_t) (amount)))
+
+/*
+ * A sort in progress on the current thread. Its comparison function is
+ * replaced by one that counts the calls, which works for qsort as well.
+ */
+struct ArrayStatsSort {
+	int (*cmp)(const void*, const void*);
+	uint64_t comparisons;
+	struct ArrayStatsSort *previous;
 };
 
+static ARRAY_THREAD_LOCAL struct ArrayStatsSort *array_stats_sort;
+
+static int array_stats_compare(const void *a, const void *b) {
+	array_stats_sort->comparisons++;
+	return array_stats_sort->cmp(a, b);
+}
+
+/*
+ * Start counting the comparisons of a sort using cmp. The sort must
+ * use the returned function instead. Comparison functions may sort
+ * other arrays themselves, so sorts in progress form a stack.
+ */
+static int (*array_stats_sort_begin(struct ArrayStatsSort *sort,
+	int (*cmp)(const void*, const void*)))(const void*, const void*) {
+	sort->cmp = cmp;
+	sort->comparisons = 0;
+	sort->previous = array_stats_sort;
+	array_stats_sort = sort;
+	return array_stats_compare;
+}
+
+static void array_stats_sort_end(Array *array, struct ArrayStatsSort *sort) {
+	array_stats_sort = sort->previous;
+	ARRAY_STAT(array, sorts, 1);
+	ARRAY_STAT(array, comparisons, sort->comparisons);
+}
+
+/* Record the current capacity if it is the largest one so far */
+static void array_stats_peak(Array *array) {
+	const uint64_t capacity = (uint64_t) array->capacity;
+
+	if (capacity > array->stats.peak_capacity) {
+		array->stats.peak_capacity = capacity;
+	}
+
+#if defined(__GNUC__)
+	{
+		uint64_t peak = ARRAY_STATS_LOAD(array_total_stats.peak_capacity);
+		while (capacity > peak && !__atomic_compare_exchange_n(
+			&array_total_stats.peak_capacity, &peak, capacity, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		}
+	}
+#else
+	if (capacity > array_total_stats.peak_capacity) {
+		array_total_stats.peak_capacity = capacity;
+	}
+#endif
+}
+
+#else
+	#define ARRAY_STAT(array, field, amount) ((void) 0)
+	#define array_stats_peak(array) ((void) 0)
+#endif
+
+/*
+ * The number of arrays sharing a block is updated by whichever thread
+ * frees or copies one of them, so it is atomic where possible. Whoever
+ * drops it to zero, or finds it at one, must see all the reads of the
+ * others done, hence the acquire and release ordering.
+ */
+#if defined(__GNUC__)
+	#define ARRAY_SHARED_LOAD(count) __atomic_load_n(&(count), __ATOMIC_ACQUIRE)
+	#define ARRAY_SHARED_ACQUIRE(count) \
+		__atomic_add_fetch(&(count), 1, __ATOMIC_RELAXED)
+	#define ARRAY_SHARED_RELEASE(count) \
+		__atomic_sub_fetch(&(count), 1, __ATOMIC_ACQ_REL)
+#else
+	#define ARRAY_SHARED_LOAD(count) (count)
+	#define ARRAY_SHARED_ACQUIRE(count) (++(count))
+	#define ARRAY_SHARED_RELEASE(count) (--(count))
+#endif
+
+/* Largest capacity whose size in bytes fits in a size_t */
+#define ARRAY_MAX_CAPACITY(array) ((size_t) -1 / (array)->element_size)
+
+/*
+ * Get the capacity to grow to from the given one, according to the
+ * growth policy of the array. Every step is checked for overflow, and
+ * the result is clamped to the largest capacity possible. Returns 0 if
+ * the array can't grow any further.
+ */
+static size_t array_next_capacity(Array *array, size_t capacity) {
+	const size_t max = ARRAY_MAX_CAPACITY(array);
+	size_t next;
+
+	if (capacity == 0) {
+		next = ARRAY_SMALL_CAPACITY(array) > 0 ?
+			ARRAY_SMALL_CAPACITY(array) : ARRAY_INITIAL_CAPACITY;
+	} else if (array->growth_policy == ARRAY_GROWTH_HALF) {
+		const size_t increment = (capacity + 1) / 2;
+		next = capacity <= max - increment ? capacity + increment : max;
+	} else if (array->growth_policy == ARRAY_GROWTH_LINEAR) {
+		next = capacity <= max - array->growth_step ?
+			capacity + array->growth_step : max;
+	} else {
+		next = capacity <= max / ARRAY_GROWTH_FACTOR ?
+			capacity * ARRAY_GROWTH_FACTOR : max;
+	}
+
+	if (array->growth_policy == ARRAY_GROWTH_PAGES && next < max) {
+		const size_t step = array->growth_step;
+		const size_t size = ARRAY_BYTES(array, next);
+
+		next = size <= (size_t) -1 - (step - 1) ?
+			(size + step - 1) / step * step / array->element_size : max;
+	}
+
+	if (next > max) {
+		next = max;
+	}
+
+	return next > capacity ? next : 0;
+}
+
+/* Lengths and positions returned as an int stop at INT_MAX */
+static int array_clamp(size_t size) {
+	return size < (size_t) INT_MAX ? (int) size : INT_MAX;
+}
+
+/*
+ * Move the gap of a gap buffer so that it starts at the given index, by
+ * shifting the elements between its old and new positions across it
+ */
+static void array_move_gap(Array *array, size_t index) {
+	const size_t gap = array->length - array->gap_tail;
+	const size_t room = ARRAY_ROOM(array);
+
+	if (index < gap) {
+		memmove(ARRAY_SLOT(array, index + room), ARRAY_SLOT(array, index),
+			ARRAY_BYTES(array, gap - index));
+		ARRAY_STAT(array, elements_shifted, gap - index);
+		array->gap_tail += gap - index;
+	} else if (index > gap) {
+		memmove(ARRAY_SLOT(array, gap), ARRAY_SLOT(array, gap + room),
+			ARRAY_BYTES(array, index - gap));
+		ARRAY_STAT(array, elements_shifted, index - gap);
+		array->gap_tail -= index - gap;
+	}
+}
+
+/* Make the elements contiguous again by moving the gap to the end */
+static void array_close_gap(Array *array) {
+	if (array->gap_tail > 0) {
+		array_move_gap(array, array->length);
+	}
+}
+
+/* Move the elements to the start of the block, leaving no head room */
+static void array_compact(Array *array) {
+	array_close_gap(array);
+	if (array->head > 0) {
+		char *block = ARRAY_BLOCK(array);
+		memmove(block, array->elements, ARRAY_BYTES(array, array->length));
+		ARRAY_STAT(array, elements_shifted, array->length);
+		array->elements = block;
+		array->head = 0;
+	}
+}
+
 /*
- * Increase the capacity of the given array.
- * Returns 1 if everything went fine, 0 if reallocation fails.
+ * Reallocate the elements of the given array to hold exactly the given
+ * number of elements, which must not be less than the length. When
+ * growing, the allocator gets a chance to extend the block in place
+ * first. Allocators without a reallocate function get the elements
+ * copied into a new block. Elements that fit in the small buffer are
+ * moved there. Returns 1 if everything went fine, 0 if reallocation
+ * fails.
  */
-static int array_grow(Array *array) {
-	const int new_capacity = array->capacity * ARRAY_GROWTH_FACTOR;
-	const int new_elements_size = sizeof(array->elements) * array->capacity;
-	void *new_elements = memory_realloc(array->elements, new_elements_size);
+static int array_resize(Array *array, size_t new_capacity) {
+	const ArrayAllocator *allocator = array->allocator;
+	const size_t old_size = ARRAY_BYTES(array, array->capacity);
+	const size_t new_size = ARRAY_BYTES(array, new_capacity);
+	const int small = ARRAY_IS_SMALL(array);
+	void *new_elements;
+
+	/* Don't let the size in bytes wrap around */
+	if (new_capacity > ARRAY_MAX_CAPACITY(array)) {
+		return 0;
+	}
+
+	/* The block is resized at its end, so any head room has to go */
+	array_compact(array);
+
+	if (new_capacity == 0) {
+		/* Don't rely on the implementation-defined realloc(p, 0) */
+		if (array->elements != NULL && !small) {
+			allocator->deallocate(allocator->context, array->elements,
+				old_size);
+		}
+		array->elements = NULL;
+		array->capacity = 0;
+		return 1;
+	}
+
+	if (new_capacity <= ARRAY_SMALL_CAPACITY(array)) {
+		new_elements = array->small.bytes;
+		if (array->elements != NULL && !small) {
+			memcpy(new_elements, array->elements,
+				ARRAY_BYTES(array, array->length));
+			allocator->deallocate(allocator->context, array->elements,
+				old_size);
+		}
+	} else if (array->elements == NULL) {
+		new_elements = allocator->allocate(allocator->context, new_size);
+	} else if (small) {
+		/* Outgrown the small buffer, so the elements move to the heap */
+		new_elements = allocator->allocate(allocator->context, new_size);
+		if (new_elements != NULL) {
+			memcpy(new_elements, array->elements,
+				ARRAY_BYTES(array, array->length));
+		}
+	} else if (new_size > old_size && allocator->extend != NULL &&
+		allocator->extend(allocator->context, array->elements,
+			old_size, new_size)) {
+		new_elements = array->elements;
+	} else if (allocator->reallocate != NULL) {
+		new_elements = allocator->reallocate(allocator->context,
+			array->elements, old_size, new_size);
+	} else {
+		new_elements = allocator->allocate(allocator->context, new_size);
+		if (new_elements != NULL) {
+			memcpy(new_elements, array->elements,
+				ARRAY_BYTES(array, array->length));
+			allocator->deallocate(allocator->context, array->elements,
+				old_size);
+		}
+	}
 
 	if (new_elements == NULL) {
 		return 0;
 	}
 
+	if (array->elements != NULL) {
+		ARRAY_STAT(array, grows, new_capacity > array->capacity);
+		ARRAY_STAT(array, bytes_reallocated, new_size);
+	}
+
 	array->elements = new_elements;
 	array->capacity = new_capacity;
+	array_stats_peak(array);
+
+	return 1;
+}
+
+/*
+ * Increase the capacity of the given array so that it can hold at least
+ * min_capacity elements. The capacity is grown according to the growth
+ * policy as many times as needed, so the elements are reallocated only
+ * once. Returns 1 if everything went fine, 0 if reallocation fails or
+ * the capacity can't grow that far.
+ */
+static int array_grow(Array *array, size_t min_capacity) {
+	size_t new_capacity = array->capacity;
+
+	/*
+	 * If at least half of the elements have been removed from the front,
+	 * moving the rest back is paid for by those removals. Otherwise grow,
+	 * so that a queue doesn't end up moving its elements on every push.
+	 */
+	if (array->head > 0 && array->head >= array->length) {
+		array_compact(array);
+		if (min_capacity <= array->capacity) {
+			return 1;
+		}
+	}
+
+	/*
+	 * Grow at least once, even if moving the elements to the front would
+	 * make enough room, so that the move is paid for by the growth. At
+	 * the largest capacity, moving them is all that's left.
+	 */
+	if (new_capacity >= min_capacity) {
+		new_capacity = array_next_capacity(array, new_capacity);
+		if (new_capacity == 0) {
+			array_compact(array);
+			return 1;
+		}
+	}
+
+	while (new_capacity < min_capacity) {
+		new_capacity = array_next_capacity(array, new_capacity);
+		if (new_capacity == 0) {
+			return 0;
+		}
+	}
+
+	return array_resize(array, new_capacity);
+}
+
+/*
+ * Give memory back after removals if automatic shrinking is enabled and
+ * the load factor has dropped below the threshold. The new capacity leaves
+ * room for the array to grow by the growth factor again, so alternating
+ * pushes and pops around the threshold don't reallocate every time.
+ * A failed reallocation is harmless, as the old elements stay valid.
+ */
+static void array_shrink(Array *array) {
+	if (array->shrink_threshold > 0 &&
+		array->capacity > ARRAY_INITIAL_CAPACITY &&
+		array->length < array->capacity * array->shrink_threshold) {
+		size_t new_capacity = array->length * ARRAY_GROWTH_FACTOR;
+
+		if (new_capacity < ARRAY_INITIAL_CAPACITY) {
+			new_capacity = ARRAY_INITIAL_CAPACITY;
+		}
+
+		array_resize(array, new_capacity);
+	}
+}
+
+/*
+ * Make room for one element in front of the first one. The elements are
+ * moved to the middle of the free space, so the next pushes to the front
+ * are cheap. If less than half of the array is free, it grows first, so
+ * that the moves take amortized constant time. Returns 1 if everything
+ * went fine, 0 if reallocation fails.
+ */
+static int array_make_head_room(Array *array) {
+	size_t head, new_capacity = array->capacity;
+
+	if (array->head > 0) {
+		return 1;
+	}
+
+	while (new_capacity - array->length <= array->length) {
+		const size_t grown = array_next_capacity(array, new_capacity);
+
+		/* At the largest capacity, use whatever room is left */
+		if (grown == 0) {
+			if (new_capacity == array->length) {
+				return 0;
+			}
+			break;
+		}
+
+		new_capacity = grown;
+	}
+
+	if (new_capacity != array->capacity &&
+		!array_resize(array, new_capacity)) {
+		return 0;
+	}
+
+	array_close_gap(array);
+	head = (array->capacity - array->length + 1) / 2;
+	memmove(ARRAY_SLOT(array, head), array->elements,
+		ARRAY_BYTES(array, array->length));
+	ARRAY_STAT(array, elements_shifted, array->length);
+	array->elements += ARRAY_BYTES(array, head);
+	array->head = head;
 
 	return 1;
 }
 
+/* Forget the head room of an empty array, so pushes start at the front */
+static void array_reset_head(Array *array) {
+	if (array->length == 0) {
+		array->elements = ARRAY_BLOCK(array);
+		array->head = 0;
+	}
+}
+
+/* Set up an empty array without any elements */
+void array_setup(Array *array, const ArrayAllocator *allocator,
+	size_t element_size) {
+	array->length = 0;
+	array->capacity = 0;
+	array->head = 0;
+	array->element_size = element_size;
+	array->shrink_threshold = 0;
+	array->growth_policy = ARRAY_GROWTH_DOUBLE;
+	array->growth_step = 0;
+	array->gap_buffer = 0;
+	array->gap_tail = 0;
+	array->elements = NULL;
+	array->allocator = allocator;
+	array->references = NULL;
+#ifdef ARRAY_STATS
+	memset(&array->stats, 0, sizeof(array->stats));
+#endif
+}
+
+/*
+ * Capacity of arrays created without one: whatever fits in the small
+ * buffer, so that creating them allocates nothing but the array itself.
+ */
+static int array_default_capacity(size_t element_size) {
+	if (element_size > 0 && element_size <= ARRAY_SMALL_SIZE) {
+		return (int) (ARRAY_SMALL_SIZE / element_size);
+	}
+	return ARRAY_INITIAL_CAPACITY;
+}
+
 Array *array_create(void) {
-	Array *array = memory_malloc(sizeof(Array));
+	return array_create_ex(NULL, sizeof(void*),
+		array_default_capacity(sizeof(void*)));
+}
+
+Array *array_create_with_capacity(int capacity) {
+	return array_create_ex(NULL, sizeof(void*), capacity);
+}
+
+Array *array_create_typed(size_t element_size) {
+	return array_create_ex(NULL, element_size,
+		array_default_capacity(element_size));
+}
+
+Array *array_create_ex(const ArrayAllocator *allocator, size_t element_size,
+	int capacity) {
+	Array *array;
+
+	if (allocator == NULL) {
+		allocator = &array_default_allocator;
+	}
+
+	if (element_size == 0 || capacity < 0 || allocator->allocate == NULL ||
+		allocator->deallocate == NULL) {
+		return NULL;
+	}
+
+	array = allocator->allocate(allocator->context, sizeof(Array));
 
 	if (array != NULL) {
-		array->length = 0;
-		array->capacity = ARRAY_INITIAL_CAPACITY;
-		array->elements = memory_malloc(sizeof(array->elements) * array->capacity);
+		array_setup(array, allocator, element_size);
 
-		if (array->elements == NULL) {
+		if (!array_resize(array, (size_t) capacity)) {
 			/* Free whatever we allocated already */
-			memory_free(array);
+			allocator->deallocate(allocator->context, array, sizeof(Array));
 			array = NULL;
 		}
 	}
@@ -59,111 +599,1410 @@ Array *array_create(void) {
 	return array;
 }
 
-void array_free(Array *array) {
-	if (array != NULL) {
-		memory_free(array->elements);
-		array->elements = NULL;
+/*
+ * Let go of a block shared with snapshots, freeing it if no other array
+ * holds it anymore. The array is left pointing at it.
+ */
+static void array_release(Array *array) {
+	if (ARRAY_SHARED_RELEASE(*array->references) == 0) {
+		array->allocator->deallocate(array->allocator->context,
+			ARRAY_BLOCK(array), ARRAY_BYTES(array, array->capacity));
+		memory_free(array->references);
 	}
-	memory_free(array);
+	array->references = NULL;
 }
 
-int array_length(Array *array) {
-	if (array != NULL) {
-		return array->length;
+/*
+ * Free the elements, unless they are in the small buffer. The rest of the
+ * array is left as it is, since the allocator may still need it.
+ */
+static void array_free_elements(Array *array) {
+	const ArrayAllocator *allocator = array->allocator;
+
+	if (array->references != NULL) {
+		array_release(array);
+		array->elements = NULL;
+		return;
 	}
-	return 0;
+
+	/* Other allocators may read the elements, like array files saving them */
+	if (allocator != &array_default_allocator) {
+		array_close_gap(array);
+	}
+
+	if (array->elements != NULL && !ARRAY_IS_SMALL(array)) {
+		allocator->deallocate(allocator->context, ARRAY_BLOCK(array),
+			ARRAY_BYTES(array, array->capacity));
+	}
+	array->elements = NULL;
 }
 
-int array_capacity(Array *array) {
+void array_free(Array *array) {
 	if (array != NULL) {
-		return array->capacity;
+		const ArrayAllocator *allocator = array->allocator;
+		array_free_elements(array);
+		allocator->deallocate(allocator->context, array, sizeof(Array));
 	}
-	return 0;
 }
 
-int array_insert(Array *array, int index, void *element) {
-	int i;
+int array_init(Array *array, const ArrayAllocator *allocator,
+	size_t element_size) {
+	if (allocator == NULL) {
+		allocator = &array_default_allocator;
+	}
 
-	/*
-	 * If we are trying to insert past the bounds, do nothing,
-	 * unless the index is exactly the length of the array, in
-	 * which case we will insert to the end.
-	 */
-	if (array == NULL || index < 0 || index > array->length) {
+	if (array == NULL || element_size == 0 || allocator->allocate == NULL ||
+		allocator->deallocate == NULL) {
 		return 0;
 	}
 
-	/* Grow if needed */
-	if (array->length >= array->capacity && !array_grow(array)) {
-		return 0; /* Out of memory */
-	}
+	array_setup(array, allocator, element_size);
 
-	/* Shift elements forward, starting from the end */
-	for (i = array->length; i > index; --i) {   
-		array->elements[i] = array->elements[i - 1];
+	if (ARRAY_SMALL_CAPACITY(array) > 0) {
+		array->elements = array->small.bytes;
+		array->capacity = ARRAY_SMALL_CAPACITY(array);
 	}
 
-	/* Insert at the given index */
-	array->elements[index] = element;
-	array->length++;
-
 	return 1;
 }
 
-void *array_remove(Array *array, int index) {
-	/* Make sure we won't delete past the bounds */
-	if (array != NULL && index >= 0 && index < array->length) {
-		int i;
-		void *element = array->elements[index];
-		/* Shift elements backwards, starting at the given index */
-		for (i = index; i < array->length - 1; ++i) {
-			array->elements[i] = array->elements[i + 1];
-		}
-		array->elements[--array->length] = NULL;
-		return element;
+void array_destroy(Array *array) {
+	if (array != NULL) {
+		array_free_elements(array);
+		array->length = 0;
+		array->capacity = 0;
+		array->head = 0;
 	}
+}
 
-	return NULL;
+Array *array_clone(Array *array) {
+	return array_clone_ex(array, NULL);
 }
 
-int array_push(Array *array, void *element) {
-	if (array != NULL) {
-		return array_insert(array, array->length, element);
+Array *array_clone_ex(Array *array, const ArrayAllocator *allocator) {
+	Array *clone;
+	size_t before;
+
+	if (array == NULL) {
+		return NULL;
 	}
-	return 0;
-}
 
-void *array_pop(Array *array) {
-	if (array != NULL) {
-		return array_remove(array, array->length - 1);
+	clone = array_create_ex(allocator, array->element_size, 0);
+
+	if (clone == NULL) {
+		return NULL;
 	}
-	return NULL;
-}
 
-void *array_get(Array *array, int index) {
-	if (array != NULL && index >= 0 && index < array->length) {
-		return array->elements[index];
+	/* The only allocation of elements, sized exactly */
+	if (!array_resize(clone, array->length)) {
+		array_free(clone);
+		return NULL;
 	}
-	return NULL;
-}
 
-int array_set(Array *array, int index, void *element) {
-	if (array != NULL && index >= 0 && index < array->length) {
-		array->elements[index] = element;
-		return 1;
+	/* The elements on either side of a gap are copied separately */
+	before = array->length - array->gap_tail;
+	if (before > 0) {
+		memcpy(clone->elements, array->elements, ARRAY_BYTES(array, before));
 	}
-	return 0;
+	if (array->gap_tail > 0) {
+		memcpy(ARRAY_SLOT(clone, before), ARRAY_ELEMENT(array, before),
+			ARRAY_BYTES(array, array->gap_tail));
+	}
+
+	clone->length = array->length;
+	clone->shrink_threshold = array->shrink_threshold;
+	clone->growth_policy = array->growth_policy;
+	clone->growth_step = array->growth_step;
+	clone->gap_buffer = array->gap_buffer;
+
+	return clone;
 }
 
-void *array_last(Array *array) {
-	if (array != NULL && array->length > 0) {
-		return array_get(array, array->length - 1);
+Array *array_snapshot(Array *array) {
+	Array *snapshot;
+
+	if (array == NULL) {
+		return NULL;
 	}
-	return NULL;
-}
 
-void array_sort(Array *array, int (*cmp)(const void*, const void*)) {
-	if (array != NULL && cmp != NULL) {
-		qsort(array->elements, array_length(array), sizeof(void*), cmp);
+	/*
+	 * The last array holding a block frees it, which may happen on any
+	 * thread and after the original is gone, so only blocks from malloc
+	 * are shared. Anything in the small buffer is cheap to copy anyway.
+	 */
+	if (array->allocator != &array_default_allocator ||
+		array->elements == NULL || ARRAY_IS_SMALL(array)) {
+		return array_clone(array);
+	}
+
+	snapshot = memory_malloc(sizeof(Array));
+
+	if (snapshot == NULL) {
+		return NULL;
+	}
+
+	if (array->references == NULL) {
+		array->references = memory_malloc(sizeof(*array->references));
+		if (array->references == NULL) {
+			memory_free(snapshot);
+			return NULL;
+		}
+		*array->references = 1;
+
+		/* Nobody writes to a shared block, so it must be in one piece */
+		array_close_gap(array);
 	}
+
+	ARRAY_SHARED_ACQUIRE(*array->references);
+	*snapshot = *array;
+#ifdef ARRAY_STATS
+	memset(&snapshot->stats, 0, sizeof(snapshot->stats));
+	snapshot->stats.peak_capacity = (uint64_t) snapshot->capacity;
+#endif
+
+	return snapshot;
+}
+
+int array_unshare(Array *array) {
+	char *block;
+
+	if (array == NULL) {
+		return 0;
+	}
+
+	if (array->references == NULL) {
+		return 1;
+	}
+
+	/* The last array left holding the block keeps it */
+	if (ARRAY_SHARED_LOAD(*array->references) == 1) {
+		memory_free(array->references);
+		array->references = NULL;
+		return 1;
+	}
+
+	/* Copy with the same capacity, which the next write may need */
+	block = array->allocator->allocate(array->allocator->context,
+		ARRAY_BYTES(array, array->capacity));
+
+	if (block == NULL) {
+		return 0;
+	}
+
+	memcpy(block, array->elements, ARRAY_BYTES(array, array->length));
+	array_release(array);
+	array->elements = block;
+	array->head = 0;
+
+	return 1;
+}
+
+int array_length(Array *array) {
+	return array_clamp(array64_length(array));
+}
+
+size_t array64_length(Array *array) {
+	if (array != NULL) {
+		return array->length;
+	}
+	return 0;
+}
+
+int array_capacity(Array *array) {
+	return array_clamp(array64_capacity(array));
+}
+
+size_t array64_capacity(Array *array) {
+	if (array != NULL) {
+		return array->capacity;
+	}
+	return 0;
+}
+
+size_t array_element_size(Array *array) {
+	if (array != NULL) {
+		return array->element_size;
+	}
+	return 0;
+}
+
+int array_reserve(Array *array, int capacity) {
+	return capacity >= 0 && array64_reserve(array, (size_t) capacity);
+}
+
+int array64_reserve(Array *array, size_t capacity) {
+	/* Making room is for writing, so copy any shared elements */
+	if (array == NULL || !array_unshare(array)) {
+		return 0;
+	}
+	if (capacity <= array->capacity - array->head) {
+		return 1;
+	}
+	if (capacity <= array->capacity) {
+		array_compact(array);
+		return 1;
+	}
+	return array_resize(array, capacity);
+}
+
+int array_shrink_to_fit(Array *array) {
+	if (array == NULL) {
+		return 0;
+	}
+	if (array->capacity == array->length) {
+		return 1;
+	}
+	return array_unshare(array) && array_resize(array, array->length);
+}
+
+int array_set_shrink_threshold(Array *array, double load_factor) {
+	/*
+	 * Shrinking leaves the array at a load factor of one over the growth
+	 * factor, so the threshold must stay below that to avoid thrashing.
+	 */
+	if (array == NULL || !(load_factor >= 0) ||
+		load_factor >= 1.0 / ARRAY_GROWTH_FACTOR) {
+		return 0;
+	}
+	array->shrink_threshold = load_factor;
+	return 1;
+}
+
+int array_set_growth_policy(Array *array, int policy, size_t step) {
+	if (array == NULL || policy < ARRAY_GROWTH_DOUBLE ||
+		policy > ARRAY_GROWTH_PAGES ||
+		(step == 0 && (policy == ARRAY_GROWTH_LINEAR ||
+			policy == ARRAY_GROWTH_PAGES))) {
+		return 0;
+	}
+	array->growth_policy = policy;
+	array->growth_step = step;
+	return 1;
+}
+
+int array_set_gap_buffer(Array *array, int enabled) {
+	if (array == NULL) {
+		return 0;
+	}
+	array->gap_buffer = enabled != 0;
+	if (!array->gap_buffer) {
+		array_close_gap(array);
+	}
+	return 1;
+}
+
+int array_insert(Array *array, int index, void *element) {
+	return ARRAY_HOLDS_POINTERS(array) &&
+		array_insert_value(array, index, &element);
+}
+
+int array_insert_value(Array *array, int index, const void *value) {
+	return index >= 0 && array64_insert_value(array, (size_t) index, value);
+}
+
+/*
+ * Return a copy of the value if it lies in the elements block of the
+ * array, as making room for it may move or free the block. Small values
+ * are copied to the given buffer of ARRAY_SMALL_SIZE bytes, others to a
+ * block from the allocator of the array. Returns the value itself if it
+ * is elsewhere, or NULL if there is no memory for the copy.
+ */
+static const void *array_detach_value(Array *array, const void *value,
+	char *buffer) {
+	const char *block = ARRAY_BLOCK(array), *bytes = value;
+	void *copy;
+
+	if (array->elements == NULL || bytes + array->element_size <= block ||
+		bytes >= block + ARRAY_BYTES(array, array->capacity)) {
+		return value;
+	}
+
+	if (array->element_size <= ARRAY_SMALL_SIZE) {
+		copy = buffer;
+	} else {
+		copy = array->allocator->allocate(array->allocator->context,
+			array->element_size);
+		if (copy == NULL) {
+			return NULL;
+		}
+	}
+
+	memcpy(copy, value, array->element_size);
+	return copy;
+}
+
+/* Release a copy made by array_detach_value */
+static void array_release_value(Array *array, const void *copy,
+	const void *value, const char *buffer) {
+	if (copy != value && copy != buffer) {
+		array->allocator->deallocate(array->allocator->context,
+			(void*) copy, array->element_size);
+	}
+}
+
+/* Insert a value that doesn't lie in the elements block of the array */
+static int array_insert_detached(Array *array, size_t index,
+	const void *value) {
+	/* A gap buffer takes the first slot of its gap, moved to the index */
+	if (array->gap_buffer) {
+		if (ARRAY_ROOM(array) < 1 &&
+			!array_grow(array, array->length + 1)) {
+			return 0; /* Out of memory */
+		}
+		array_move_gap(array, index);
+		memcpy(ARRAY_SLOT(array, index), value, array->element_size);
+		array->length++;
+		return 1;
+	}
+
+	/*
+	 * In the front half, shift the preceding elements backwards by one
+	 * instead, into the room in front of the array.
+	 */
+	if (index < array->length / 2) {
+		if (!array_make_head_room(array)) {
+			return 0; /* Out of memory */
+		}
+		array->elements -= array->element_size;
+		array->head--;
+		memmove(array->elements, ARRAY_SLOT(array, 1),
+			ARRAY_BYTES(array, index));
+		ARRAY_STAT(array, elements_shifted, index);
+		memcpy(ARRAY_SLOT(array, index), value, array->element_size);
+		array->length++;
+		return 1;
+	}
+
+	/* Grow if needed */
+	if (ARRAY_ROOM(array) < 1 && !array_grow(array, array->length + 1)) {
+		return 0; /* Out of memory */
+	}
+
+	/* Shift the following elements forward by one */
+	memmove(ARRAY_SLOT(array, index + 1), ARRAY_SLOT(array, index),
+		ARRAY_BYTES(array, array->length - index));
+	ARRAY_STAT(array, elements_shifted, array->length - index);
+
+	/* Insert at the given index */
+	memcpy(ARRAY_SLOT(array, index), value, array->element_size);
+	array->length++;
+
+	return 1;
+}
+
+int array64_insert_value(Array *array, size_t index, const void *value) {
+	char buffer[ARRAY_SMALL_SIZE];
+	const void *copy;
+	int inserted;
+
+	/*
+	 * If we are trying to insert past the bounds, do nothing,
+	 * unless the index is exactly the length of the array, in
+	 * which case we will insert to the end.
+	 */
+	if (array == NULL || value == NULL || index > array->length ||
+		!array_unshare(array)) {
+		return 0;
+	}
+
+	/* The value may be one of the elements */
+	copy = array_detach_value(array, value, buffer);
+	if (copy == NULL) {
+		return 0; /* Out of memory */
+	}
+
+	inserted = array_insert_detached(array, index, copy);
+	array_release_value(array, copy, value, buffer);
+
+	return inserted;
+}
+
+void *array_remove(Array *array, int index) {
+	void *element;
+
+	if (ARRAY_HOLDS_POINTERS(array) &&
+		array_remove_value(array, index, &element)) {
+		return element;
+	}
+
+	return NULL;
+}
+
+int array_remove_value(Array *array, int index, void *out) {
+	return index >= 0 && array64_remove_value(array, (size_t) index, out);
+}
+
+int array64_remove_value(Array *array, size_t index, void *out) {
+	/* Make sure we won't delete past the bounds */
+	if (array != NULL && index < array->length && array_unshare(array)) {
+		if (out != NULL) {
+			memcpy(out, ARRAY_ELEMENT(array, index), array->element_size);
+		}
+		if (array->gap_buffer) {
+			/* Move the gap in front of the element, which then joins it */
+			array_move_gap(array, index);
+			array->gap_tail--;
+		} else if (index < array->length / 2) {
+			/* Shift the preceding elements forward by one */
+			memmove(ARRAY_SLOT(array, 1), array->elements,
+				ARRAY_BYTES(array, index));
+			ARRAY_STAT(array, elements_shifted, index);
+			array->elements += array->element_size;
+			array->head++;
+		} else {
+			/* Shift the following elements backwards by one */
+			memmove(ARRAY_SLOT(array, index), ARRAY_SLOT(array, index + 1),
+				ARRAY_BYTES(array, array->length - index - 1));
+			ARRAY_STAT(array, elements_shifted, array->length - index - 1);
+		}
+		array->length--;
+		array_reset_head(array);
+		array_shrink(array);
+		return 1;
+	}
+
+	return 0;
+}
+
+int array_insert_range(Array *array, int index, const void *elements,
+	int count) {
+	return index >= 0 && count >= 0 && array64_insert_range(array,
+		(size_t) index, elements, (size_t) count);
+}
+
+int array64_insert_range(Array *array, size_t index, const void *elements,
+	size_t count) {
+	if (array == NULL || index > array->length ||
+		(elements == NULL && count > 0) ||
+		count > ARRAY_MAX_CAPACITY(array) - array->length) {
+		return 0;
+	}
+
+	if (count == 0) {
+		return 1;
+	}
+
+	if (!array_unshare(array)) {
+		return 0;
+	}
+
+	/* Grow only once, no matter how many elements are inserted */
+	if (count > ARRAY_ROOM(array) &&
+		!array_grow(array, array->length + count)) {
+		return 0; /* Out of memory */
+	}
+
+	/*
+	 * Make room with a single block move, or by moving the gap of a gap
+	 * buffer there, then copy the new elements in
+	 */
+	if (array->gap_buffer) {
+		array_move_gap(array, index);
+	} else {
+		memmove(ARRAY_SLOT(array, index + count), ARRAY_SLOT(array, index),
+			ARRAY_BYTES(array, array->length - index));
+		ARRAY_STAT(array, elements_shifted, array->length - index);
+	}
+	memcpy(ARRAY_SLOT(array, index), elements, ARRAY_BYTES(array, count));
+	array->length += count;
+
+	return 1;
+}
+
+int array_remove_range(Array *array, int index, int count, void *out) {
+	return index >= 0 && count >= 0 && array64_remove_range(array,
+		(size_t) index, (size_t) count, out);
+}
+
+int array64_remove_range(Array *array, size_t index, size_t count,
+	void *out) {
+	if (array == NULL || index > array->length ||
+		count > array->length - index || !array_unshare(array)) {
+		return 0;
+	}
+
+	if (array->gap_buffer) {
+		/* Move the gap in front of the elements, which then join it */
+		array_move_gap(array, index);
+		if (out != NULL) {
+			memcpy(out, ARRAY_SLOT(array, index + ARRAY_ROOM(array)),
+				ARRAY_BYTES(array, count));
+		}
+		array->gap_tail -= count;
+	} else {
+		if (out != NULL) {
+			memcpy(out, ARRAY_SLOT(array, index), ARRAY_BYTES(array, count));
+		}
+
+		/* Close the hole with a single block move */
+		memmove(ARRAY_SLOT(array, index), ARRAY_SLOT(array, index + count),
+			ARRAY_BYTES(array, array->length - index - count));
+		ARRAY_STAT(array, elements_shifted, array->length - index - count);
+	}
+	array->length -= count;
+	array_reset_head(array);
+	array_shrink(array);
+
+	return 1;
+}
+
+void *array_swap_remove(Array *array, int index) {
+	void *element;
+
+	if (ARRAY_HOLDS_POINTERS(array) &&
+		array_swap_remove_value(array, index, &element)) {
+		return element;
+	}
+
+	return NULL;
+}
+
+int array_swap_remove_value(Array *array, int index, void *out) {
+	return index >= 0 &&
+		array64_swap_remove_value(array, (size_t) index, out);
+}
+
+int array64_swap_remove_value(Array *array, size_t index, void *out) {
+	if (array == NULL || index >= array->length || !array_unshare(array)) {
+		return 0;
+	}
+
+	if (out != NULL) {
+		memcpy(out, ARRAY_ELEMENT(array, index), array->element_size);
+	}
+
+	/* Fill the hole with the last element, taken off the end */
+	array_close_gap(array);
+	array->length--;
+	if (index < array->length) {
+		memcpy(ARRAY_SLOT(array, index), ARRAY_SLOT(array, array->length),
+			array->element_size);
+	}
+	array_reset_head(array);
+	array_shrink(array);
+
+	return 1;
+}
+
+/*
+ * Remove the elements for which pred returns the given result, moving
+ * the remaining ones down in a single pass. Returns the number of
+ * elements removed.
+ */
+static size_t array_filter(Array *array,
+	int (*pred)(const void*, void*), void *context, int result) {
+	size_t read, write = 0;
+
+	if (array == NULL || pred == NULL || !array_unshare(array)) {
+		return 0;
+	}
+
+	array_close_gap(array);
+	for (read = 0; read < array->length; read++) {
+		const char *element = ARRAY_SLOT(array, read);
+		if ((pred(element, context) != 0) != result) {
+			if (write != read) {
+				memcpy(ARRAY_SLOT(array, write), element,
+					array->element_size);
+			}
+			write++;
+		}
+	}
+
+	read = array->length - write;
+	array->length = write;
+	array_reset_head(array);
+	array_shrink(array);
+
+	return read;
+}
+
+int array_retain(Array *array, int (*pred)(const void*, void*),
+	void *context) {
+	return array_clamp(array_filter(array, pred, context, 0));
+}
+
+int array_remove_if(Array *array, int (*pred)(const void*, void*),
+	void *context) {
+	return array_clamp(array_filter(array, pred, context, 1));
+}
+
+int array_push(Array *array, void *element) {
+	return ARRAY_HOLDS_POINTERS(array) && array_push_value(array, &element);
+}
+
+int array_push_value(Array *array, const void *value) {
+	if (array != NULL) {
+		return array64_insert_value(array, array->length, value);
+	}
+	return 0;
+}
+
+void *array_pop(Array *array) {
+	void *element;
+
+	if (ARRAY_HOLDS_POINTERS(array) && array_pop_value(array, &element)) {
+		return element;
+	}
+
+	return NULL;
+}
+
+int array_pop_value(Array *array, void *out) {
+	if (array != NULL && array->length > 0) {
+		return array64_remove_value(array, array->length - 1, out);
+	}
+	return 0;
+}
+
+int array_push_front(Array *array, void *element) {
+	return ARRAY_HOLDS_POINTERS(array) &&
+		array_push_front_value(array, &element);
+}
+
+int array_push_front_value(Array *array, const void *value) {
+	char buffer[ARRAY_SMALL_SIZE];
+	const void *copy;
+
+	if (array == NULL || value == NULL || !array_unshare(array)) {
+		return 0;
+	}
+
+	/* The value may be one of the elements */
+	copy = array_detach_value(array, value, buffer);
+	if (copy == NULL) {
+		return 0;
+	}
+
+	if (!array_make_head_room(array)) {
+		array_release_value(array, copy, value, buffer);
+		return 0;
+	}
+
+	array->elements -= array->element_size;
+	array->head--;
+	memcpy(array->elements, copy, array->element_size);
+	array->length++;
+	array_release_value(array, copy, value, buffer);
+	return 1;
+}
+
+void *array_pop_front(Array *array) {
+	return array_remove(array, 0);
+}
+
+int array_pop_front_value(Array *array, void *out) {
+	return array_remove_value(array, 0, out);
+}
+
+void *array_get(Array *array, int index) {
+	void *element;
+
+	if (ARRAY_HOLDS_POINTERS(array) &&
+		array_get_value(array, index, &element)) {
+		return element;
+	}
+
+	return NULL;
+}
+
+int array_get_value(Array *array, int index, void *out) {
+	return index >= 0 && array64_get_value(array, (size_t) index, out);
+}
+
+int array64_get_value(Array *array, size_t index, void *out) {
+	if (array != NULL && out != NULL && index < array->length) {
+		memcpy(out, ARRAY_ELEMENT(array, index), array->element_size);
+		return 1;
+	}
+	return 0;
+}
+
+void *array_at(Array *array, int index) {
+	return index >= 0 ? array64_at(array, (size_t) index) : NULL;
+}
+
+void *array64_at(Array *array, size_t index) {
+	/* The element may be written through the pointer */
+	if (array != NULL && index < array->length && array_unshare(array)) {
+		return ARRAY_ELEMENT(array, index);
+	}
+	return NULL;
+}
+
+ArraySpan array_span(Array *array) {
+	ArraySpan span;
+
+	span.elements = NULL;
+	span.length = 0;
+	span.element_size = 0;
+
+	if (array != NULL) {
+		array_close_gap(array);
+		span.elements = array->elements;
+		span.length = array_clamp(array->length);
+		span.element_size = array->element_size;
+	}
+
+	return span;
+}
+
+int array_foreach(Array *array, int (*fn)(void*, void*), void *context) {
+	char *element, *end;
+
+	if (array == NULL || fn == NULL || array->length == 0 ||
+		!array_unshare(array)) {
+		return 0;
+	}
+
+	array_close_gap(array);
+	element = array->elements;
+	end = ARRAY_SLOT(array, array->length);
+	for (; element != end; element += array->element_size) {
+		if (fn(element, context)) {
+			return array_clamp((size_t) (element - array->elements) /
+				array->element_size);
+		}
+	}
+
+	return array_clamp(array->length);
+}
+
+int array_set(Array *array, int index, void *element) {
+	void **slot;
+
+	if (!ARRAY_HOLDS_POINTERS(array)) {
+		return 0;
+	}
+	slot = array_at(array, index);
+	if (slot != NULL) {
+		*slot = element;
+		return 1;
+	}
+	return 0;
+}
+
+int array_set_value(Array *array, int index, const void *value) {
+	return index >= 0 && array64_set_value(array, (size_t) index, value);
+}
+
+int array64_set_value(Array *array, size_t index, const void *value) {
+	if (array != NULL && value != NULL && index < array->length &&
+		array_unshare(array)) {
+		memcpy(ARRAY_ELEMENT(array, index), value, array->element_size);
+		return 1;
+	}
+	return 0;
+}
+
+void *array_last(Array *array) {
+	if (ARRAY_HOLDS_POINTERS(array) && array->length > 0) {
+		return *(void**) ARRAY_ELEMENT(array, array->length - 1);
+	}
+	return NULL;
+}
+
+void array_sort(Array *array, int (*cmp)(const void*, const void*)) {
+	if (array != NULL && cmp != NULL && array->length > 1 &&
+		array_unshare(array)) {
+#ifdef ARRAY_STATS
+		struct ArrayStatsSort stats;
+		cmp = array_stats_sort_begin(&stats, cmp);
+#endif
+		array_close_gap(array);
+		if (array->element_size == sizeof(void*)) {
+			struct ArraySortContext context;
+			context.cmp = cmp;
+			array_sort_pointers_range((void**) array->elements,
+				array->length, &context);
+		} else {
+			qsort(array->elements, array->length, array->element_size, cmp);
+		}
+#ifdef ARRAY_STATS
+		array_stats_sort_end(array, &stats);
+#endif
+	}
+}
+
+int array_sort_by_key(Array *array, uint64_t (*key)(const void*)) {
+	size_t counts[8][256];
+	struct ArraySortKey *keys, *buffer, *temp;
+	const ArrayAllocator *allocator;
+	size_t keys_size, size, i;
+	char *elements;
+	void *block;
+	int pass;
+
+	if (array == NULL || key == NULL) {
+		return 0;
+	}
+
+	if (array->length < 2) {
+		return 1;
+	}
+
+	if (!array_unshare(array)) {
+		return 0;
+	}
+
+	/* No comparisons to count, as the keys are never compared */
+	ARRAY_STAT(array, sorts, 1);
+
+	/* Two buffers of keys to scatter between, then room for the elements */
+	allocator = array->allocator;
+	keys_size = sizeof(*keys) * array->length;
+	size = 2 * keys_size + ARRAY_BYTES(array, array->length);
+
+	/* Sizes that wrap around are too big to allocate anyway */
+	if (array->length > (size_t) -1 / 2 / (sizeof(*keys) +
+		array->element_size)) {
+		return 0;
+	}
+
+	block = allocator->allocate(allocator->context, size);
+
+	if (block == NULL) {
+		return 0;
+	}
+
+	array_close_gap(array);
+	keys = block;
+	buffer = keys + array->length;
+	elements = (char*) keys + 2 * keys_size;
+
+	/* Extract the keys and count every byte of them in a single pass */
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < array->length; i++) {
+		const uint64_t k = key(ARRAY_SLOT(array, i));
+		keys[i].key = k;
+		keys[i].index = i;
+		for (pass = 0; pass < 8; pass++) {
+			counts[pass][(k >> (8 * pass)) & 0xff]++;
+		}
+	}
+
+	/* Scatter by each byte, least significant first */
+	for (pass = 0; pass < 8; pass++) {
+		const int shift = 8 * pass;
+		size_t offset = 0;
+		int byte;
+
+		/* Skip bytes that are the same in every key */
+		if (counts[pass][(keys[0].key >> shift) & 0xff] == array->length) {
+			continue;
+		}
+
+		for (byte = 0; byte < 256; byte++) {
+			const size_t count = counts[pass][byte];
+			counts[pass][byte] = offset;
+			offset += count;
+		}
+
+		for (i = 0; i < array->length; i++) {
+			buffer[counts[pass][(keys[i].key >> shift) & 0xff]++] = keys[i];
+		}
+
+		temp = keys;
+		keys = buffer;
+		buffer = temp;
+	}
+
+	/* Gather the elements in sorted order and copy them back */
+	for (i = 0; i < array->length; i++) {
+		memcpy(elements + ARRAY_BYTES(array, i),
+			ARRAY_SLOT(array, keys[i].index), array->element_size);
+	}
+	memcpy(array->elements, elements, ARRAY_BYTES(array, array->length));
+
+	allocator->deallocate(allocator->context, block, size);
+
+	return 1;
+}
+
+/*
+ * Get the minimum run length for a stable sort of n elements. Chosen so
+ * that n divided by it is a power of two or slightly less, which keeps
+ * the final merges balanced.
+ */
+static size_t array_min_run(size_t n) {
+	size_t r = 0;
+
+	while (n >= 2 * ARRAY_MIN_RUN) {
+		r |= n & 1;
+		n >>= 1;
+	}
+
+	return n + r;
+}
+
+/*
+ * Find the first element in the given range that key sorts before. When
+ * inserting key there, it goes after any elements equal to it. See
+ * array_lower_bound_in for how the search works.
+ */
+static size_t array_upper_bound_in(Array *array, size_t start,
+	size_t end, const void *key, int (*cmp)(const void*, const void*)) {
+	const size_t size = array->element_size;
+	const char *base = ARRAY_SLOT(array, start);
+	size_t n = end - start;
+
+	if (n == 0) {
+		return start;
+	}
+
+	while (n > 1) {
+		const size_t half = n / 2;
+		const char *middle = base + ARRAY_BYTES(array, half);
+		ARRAY_PREFETCH(base + ARRAY_BYTES(array, half / 2));
+		ARRAY_PREFETCH(middle + ARRAY_BYTES(array, half / 2));
+		base = cmp(key, middle) >= 0 ? middle : base;
+		n -= half;
+	}
+
+	return (size_t) (base - array->elements) / size + (cmp(key, base) >= 0);
+}
+
+/*
+ * Find the first element in the given range that does not sort before
+ * key. When inserting key there, it goes before any elements equal to it.
+ *
+ * The range is halved without a data-dependent branch, so there are no
+ * mispredictions for the compiler to pay for; the choice compiles to a
+ * conditional move. Both possible next midpoints are prefetched, which
+ * hides most of the cache misses on large arrays.
+ */
+static size_t array_lower_bound_in(Array *array, size_t start,
+	size_t end, const void *key, int (*cmp)(const void*, const void*)) {
+	const size_t size = array->element_size;
+	const char *base = ARRAY_SLOT(array, start);
+	size_t n = end - start;
+
+	if (n == 0) {
+		return start;
+	}
+
+	while (n > 1) {
+		const size_t half = n / 2;
+		const char *middle = base + ARRAY_BYTES(array, half);
+		ARRAY_PREFETCH(base + ARRAY_BYTES(array, half / 2));
+		ARRAY_PREFETCH(middle + ARRAY_BYTES(array, half / 2));
+		base = cmp(middle, key) < 0 ? middle : base;
+		n -= half;
+	}
+
+	return (size_t) (base - array->elements) / size + (cmp(base, key) < 0);
+}
+
+/* Reverse the elements in the given range, using temp for swapping */
+static void array_reverse_range(Array *array, size_t start, size_t end,
+	char *temp) {
+	const size_t size = array->element_size;
+
+	for (end--; start < end; start++, end--) {
+		memcpy(temp, ARRAY_SLOT(array, start), size);
+		memcpy(ARRAY_SLOT(array, start), ARRAY_SLOT(array, end), size);
+		memcpy(ARRAY_SLOT(array, end), temp, size);
+	}
+}
+
+/*
+ * Get the length of the run starting at the given index. Strictly
+ * descending runs are reversed, so the run is always ascending when
+ * this returns. Equal elements never form a descending run, since
+ * reversing them would break stability.
+ */
+static size_t array_count_run(struct ArrayStableSort *sort, size_t start,
+	size_t end) {
+	Array *array = sort->array;
+	size_t i = start + 1;
+
+	if (i == end) {
+		return 1;
+	}
+
+	if (sort->cmp(ARRAY_SLOT(array, i), ARRAY_SLOT(array, start)) < 0) {
+		while (i + 1 < end && sort->cmp(ARRAY_SLOT(array, i + 1),
+			ARRAY_SLOT(array, i)) < 0) {
+			i++;
+		}
+		array_reverse_range(array, start, i + 1, sort->temp);
+	} else {
+		while (i + 1 < end && sort->cmp(ARRAY_SLOT(array, i + 1),
+			ARRAY_SLOT(array, i)) >= 0) {
+			i++;
+		}
+	}
+
+	return i + 1 - start;
+}
+
+/*
+ * Binary insertion sort of the given range, the first sorted elements
+ * of which are already in order.
+ */
+static void array_insertion_sort(struct ArrayStableSort *sort,
+	size_t start, size_t sorted, size_t end) {
+	Array *array = sort->array;
+	size_t i;
+
+	for (i = start + sorted; i < end; i++) {
+		const size_t position = array_upper_bound_in(array, start, i,
+			ARRAY_SLOT(array, i), sort->cmp);
+		memcpy(sort->temp, ARRAY_SLOT(array, i), array->element_size);
+		memmove(ARRAY_SLOT(array, position + 1), ARRAY_SLOT(array, position),
+			ARRAY_BYTES(array, i - position));
+		memcpy(ARRAY_SLOT(array, position), sort->temp, array->element_size);
+	}
+}
+
+/*
+ * Merge the pending runs at the given position and the one after it.
+ * Elements at the start of the first run that are not greater than
+ * the start of the second one are already in place, and so are the
+ * elements at the end of the second run that are not less than the end
+ * of the first one. Only the rest is merged, through the temporary
+ * buffer holding the shorter side. For input that is already nearly
+ * sorted this makes most merges logarithmic instead of linear.
+ */
+static void array_merge_runs(struct ArrayStableSort *sort, int run) {
+	Array *array = sort->array;
+	const size_t size = array->element_size;
+	size_t start = sort->run_start[run];
+	size_t middle = start + sort->run_length[run];
+	size_t end = middle + sort->run_length[run + 1];
+	char *left, *right, *out, *temp;
+
+	/* Record the merged run and drop the second one from the stack */
+	sort->run_length[run] += sort->run_length[run + 1];
+	if (run + 2 < sort->run_count) {
+		sort->run_start[run + 1] = sort->run_start[run + 2];
+		sort->run_length[run + 1] = sort->run_length[run + 2];
+	}
+	sort->run_count--;
+
+	start = array_upper_bound_in(array, start, middle,
+		ARRAY_SLOT(array, middle), sort->cmp);
+	end = array_lower_bound_in(array, middle, end,
+		ARRAY_SLOT(array, middle - 1), sort->cmp);
+
+	if (start == middle || middle == end) {
+		return;
+	}
+
+	if (middle - start <= end - middle) {
+		/* Copy the left side out of the way and merge forwards */
+		char *temp_end = sort->temp + ARRAY_BYTES(array, middle - start);
+		memcpy(sort->temp, ARRAY_SLOT(array, start),
+			ARRAY_BYTES(array, middle - start));
+		temp = sort->temp;
+		right = ARRAY_SLOT(array, middle);
+		out = ARRAY_SLOT(array, start);
+		while (temp < temp_end && right < ARRAY_SLOT(array, end)) {
+			if (sort->cmp(right, temp) < 0) {
+				memcpy(out, right, size);
+				right += size;
+			} else {
+				memcpy(out, temp, size);
+				temp += size;
+			}
+			out += size;
+		}
+		memcpy(out, temp, temp_end - temp);
+	} else {
+		/* Copy the right side out of the way and merge backwards */
+		memcpy(sort->temp, ARRAY_SLOT(array, middle),
+			ARRAY_BYTES(array, end - middle));
+		temp = sort->temp + ARRAY_BYTES(array, end - middle);
+		left = ARRAY_SLOT(array, middle);
+		out = ARRAY_SLOT(array, end);
+		while (temp > sort->temp && left > ARRAY_SLOT(array, start)) {
+			out -= size;
+			if (sort->cmp(temp - size, left - size) < 0) {
+				left -= size;
+				memcpy(out, left, size);
+			} else {
+				temp -= size;
+				memcpy(out, temp, size);
+			}
+		}
+		memcpy(ARRAY_SLOT(array, start), sort->temp, temp - sort->temp);
+	}
+}
+
+/*
+ * Merge pending runs until the run lengths on the stack shrink faster
+ * than the Fibonacci sequence, which keeps merges balanced and the
+ * stack short. With force set, merge everything into a single run.
+ */
+static void array_collapse_runs(struct ArrayStableSort *sort, int force) {
+	const size_t *length = sort->run_length;
+
+	while (sort->run_count > 1) {
+		int run = sort->run_count - 2;
+
+		if (force) {
+			if (run > 0 && length[run - 1] < length[run + 1]) {
+				run--;
+			}
+		} else if ((run > 0 &&
+			length[run - 1] <= length[run] + length[run + 1]) ||
+			(run > 1 && length[run - 2] <= length[run - 1] + length[run])) {
+			if (length[run - 1] < length[run + 1]) {
+				run--;
+			}
+		} else if (length[run] > length[run + 1]) {
+			break;
+		}
+
+		array_merge_runs(sort, run);
+	}
+}
+
+int array_sort_stable(Array *array, int (*cmp)(const void*, const void*)) {
+#ifdef ARRAY_STATS
+	struct ArrayStatsSort stats;
+#endif
+	struct ArrayStableSort sort;
+	const ArrayAllocator *allocator;
+	size_t temp_size, start, min_run;
+
+	if (array == NULL || cmp == NULL) {
+		return 0;
+	}
+
+	if (array->length < 2) {
+		return 1;
+	}
+
+	if (!array_unshare(array)) {
+		return 0;
+	}
+
+	array_close_gap(array);
+
+	/* A merge never copies out more than half of the elements */
+	allocator = array->allocator;
+	temp_size = ARRAY_BYTES(array, array->length / 2 + 1);
+	sort.temp = allocator->allocate(allocator->context, temp_size);
+
+	if (sort.temp == NULL) {
+		return 0;
+	}
+
+#ifdef ARRAY_STATS
+	cmp = array_stats_sort_begin(&stats, cmp);
+#endif
+
+	sort.array = array;
+	sort.cmp = cmp;
+	sort.run_count = 0;
+	min_run = array_min_run(array->length);
+
+	for (start = 0; start < array->length; ) {
+		const size_t remaining = array->length - start;
+		size_t run = array_count_run(&sort, start, array->length);
+
+		if (run < min_run) {
+			const size_t forced = remaining < min_run ? remaining : min_run;
+			array_insertion_sort(&sort, start, run, start + forced);
+			run = forced;
+		}
+
+		sort.run_start[sort.run_count] = start;
+		sort.run_length[sort.run_count] = run;
+		sort.run_count++;
+		array_collapse_runs(&sort, 0);
+		start += run;
+	}
+
+	array_collapse_runs(&sort, 1);
+	allocator->deallocate(allocator->context, sort.temp, temp_size);
+
+#ifdef ARRAY_STATS
+	array_stats_sort_end(array, &stats);
+#endif
+
+	return 1;
+}
+
+/*
+ * Merge count sorted elements into the sorted array, which must already
+ * have room for them. Works backwards from the end so that no temporary
+ * buffer is needed, and elements of the array that are not greater
+ * than the first new element are never touched. On ties, elements
+ * already in the array go first.
+ */
+static void array_merge_into(Array *array, const char *elements,
+	size_t count, int (*cmp)(const void*, const void*)) {
+	const size_t size = array->element_size;
+	const char *left = ARRAY_SLOT(array, array->length);
+	const char *right = elements + ARRAY_BYTES(array, count);
+	char *out = ARRAY_SLOT(array, array->length + count);
+	size_t start;
+
+	if (count == 0) {
+		return;
+	}
+
+	start = array_upper_bound_in(array, 0, array->length, elements, cmp);
+
+	while (right > elements && left > ARRAY_SLOT(array, start)) {
+		out -= size;
+		if (cmp(right - size, left - size) < 0) {
+			left -= size;
+			memcpy(out, left, size);
+		} else {
+			right -= size;
+			memcpy(out, right, size);
+		}
+	}
+	memcpy(ARRAY_SLOT(array, start), elements, right - elements);
+	array->length += count;
+}
+
+int array_merge_sorted(Array *dst, Array *a, Array *b,
+	int (*cmp)(const void*, const void*)) {
+	const ArrayAllocator *allocator;
+	size_t temp_size, count;
+	char *temp = NULL;
+
+	if (dst == NULL || a == NULL || b == NULL || cmp == NULL ||
+		a->element_size != dst->element_size ||
+		b->element_size != dst->element_size ||
+		b->length > (size_t) -1 - a->length) {
+		return 0;
+	}
+
+	array_close_gap(dst);
+	array_close_gap(a);
+	array_close_gap(b);
+
+	/* Make room first, so that nothing changes if we run out of memory */
+	if (!array64_reserve(dst, a->length + b->length)) {
+		return 0;
+	}
+
+	/* The new elements can't be read from the array being merged into */
+	allocator = dst->allocator;
+	count = b->length;
+	temp_size = ARRAY_BYTES(b, count);
+	if (b == dst && count > 0) {
+		temp = allocator->allocate(allocator->context, temp_size);
+		if (temp == NULL) {
+			return 0;
+		}
+		memcpy(temp, b->elements, temp_size);
+	}
+
+	if (dst != a) {
+		/* Can't fail, as there is enough room */
+		dst->length = 0;
+		array64_insert_range(dst, 0, a->elements, a->length);
+	}
+
+	array_merge_into(dst, temp != NULL ? temp : b->elements, count, cmp);
+
+	if (temp != NULL) {
+		allocator->deallocate(allocator->context, temp, temp_size);
+	}
+
+	return 1;
+}
+
+int array_lower_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*)) {
+	return array_clamp(array64_lower_bound(array, key, cmp));
+}
+
+size_t array64_lower_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*)) {
+	if (array == NULL || key == NULL || cmp == NULL) {
+		return 0;
+	}
+	array_close_gap(array);
+	return array_lower_bound_in(array, 0, array->length, key, cmp);
+}
+
+int array_upper_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*)) {
+	return array_clamp(array64_upper_bound(array, key, cmp));
+}
+
+size_t array64_upper_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*)) {
+	if (array == NULL || key == NULL || cmp == NULL) {
+		return 0;
+	}
+	array_close_gap(array);
+	return array_upper_bound_in(array, 0, array->length, key, cmp);
+}
+
+int array_bsearch(Array *array, const void *key,
+	int (*cmp)(const void*, const void*)) {
+	size_t index;
+
+	if (array == NULL || key == NULL || cmp == NULL) {
+		return -1;
+	}
+
+	array_close_gap(array);
+	index = array_lower_bound_in(array, 0, array->length, key, cmp);
+
+	/* Matches past the reach of an int are not found */
+	if (index < array->length && index <= INT_MAX &&
+		cmp(ARRAY_SLOT(array, index), key) == 0) {
+		return (int) index;
+	}
+
+	return -1;
+}
+
+int array_insert_sorted(Array *array, const void *value,
+	int (*cmp)(const void*, const void*)) {
+	if (array == NULL || value == NULL || cmp == NULL) {
+		return 0;
+	}
+	array_close_gap(array);
+	return array64_insert_value(array,
+		array_upper_bound_in(array, 0, array->length, value, cmp), value);
+}
+
+int array_stats(Array *array, ArrayStats *out) {
+	if (out == NULL) {
+		return 0;
+	}
+
+	memset(out, 0, sizeof(*out));
+
+#ifdef ARRAY_STATS
+	if (array != NULL) {
+		*out = array->stats;
+		return 1;
+	}
+#else
+	(void) array;
+#endif
+
+	return 0;
+}
+
+int array_stats_total(ArrayStats *out) {
+	if (out == NULL) {
+		return 0;
+	}
+
+#ifdef ARRAY_STATS
+	out->grows = ARRAY_STATS_LOAD(array_total_stats.grows);
+	out->bytes_reallocated =
+		ARRAY_STATS_LOAD(array_total_stats.bytes_reallocated);
+	out->peak_capacity = ARRAY_STATS_LOAD(array_total_stats.peak_capacity);
+	out->elements_shifted =
+		ARRAY_STATS_LOAD(array_total_stats.elements_shifted);
+	out->sorts = ARRAY_STATS_LOAD(array_total_stats.sorts);
+	out->comparisons = ARRAY_STATS_LOAD(array_total_stats.comparisons);
+	return 1;
+#else
+	memset(out, 0, sizeof(*out));
+	return 0;
+#endif
 }
@@ -1,35 +1,320 @@
 /*
- * A simple, generic implementation of a dynamically sized array. It uses
- * a pointer array as the basis and maintains the order of the elements
- * when inserting or removing.
+ * A simple, generic implementation of a dynamically sized array. By
+ * default it stores pointers, but it can also store fixed-size values
+ * inline, in which case the elements are laid out contiguously. The
+ * order of the elements is maintained when inserting or removing.
  *
- * Insertion and removal at the end as well as look-up by index are
- * constant-time operations. Inserting or removing in the middle takes
- * linear time since the following elements have to be shifted. Length
- * can also retrieved in constant time. Sorting is done by the standard
- * library qsort function.
+ * Insertion and removal at either end as well as look-up by index are
+ * constant-time operations, so an array also works as a double-ended
+ * queue. Inserting or removing in the middle takes linear time since
+ * the elements on the nearer side have to be shifted. Length can also
+ * be retrieved in constant time. Arrays of pointers are sorted with
+ * introsort, other arrays with the standard library qsort function. See
+ * array_sort.h for sorts specialized for a particular element type.
  *
- * The array automatically reallocates when it gets full. By default, the
- * capacity is doubled.
+ * Small arrays keep their elements inside the array itself, so creating
+ * one takes a single allocation, or none with array_init. When they
+ * outgrow that, the elements move to the heap, and the array reallocates
+ * whenever it gets full. By default, the capacity is doubled, but each
+ * array can have its own growth policy. Capacity can also be managed
+ * explicitly, and the array can optionally give memory back when it
+ * becomes sparse.
+ *
+ * For editing that keeps inserting and removing around one position in a
+ * long array, like the text of an editor, an array can be switched to a
+ * gap buffer with array_set_gap_buffer. Its free slots then form a gap
+ * that follows the most recent edit, so that the cost of an edit depends
+ * on its distance from the previous one rather than on the length.
+ *
+ * An array can be copied with array_clone, or shared with
+ * array_snapshot: the snapshot starts out sharing the elements of the
+ * array, and whichever of the two is modified first copies them, so
+ * taking a consistent view for readers costs nothing until the writer
+ * next changes the array.
+ *
+ * Indices and lengths are ints throughout, so those functions reach only
+ * the first INT_MAX elements, and lengths and positions they return stop
+ * at INT_MAX. Arrays themselves can be as long as memory allows: the
+ * array64_ functions take and return size_t instead, and pushing,
+ * popping and sorting work at any length.
+ *
+ * Arrays are opaque by default, so the layout can change without
+ * recompiling callers. Defining ARRAY_INLINE_API before including this
+ * header exposes the layout instead, and turns array_length, array_get,
+ * array_set, array_at, array_last and array_push into inline functions
+ * that only call into the library when they have to (for example, when
+ * pushing needs to grow the array). It also allows embedding arrays in
+ * other objects or on the stack, with array_init. Code built this way
+ * must be recompiled whenever the library is updated.
+ *
+ * Building with ARRAY_STATS defined makes every array count how it is
+ * used (see array_stats), at the cost of a little overhead on
+ * reallocations, shifts and sorts. The library and any code using the
+ * inline API must agree on it, as it changes the layout.
  */
 
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 typedef struct Array Array;
 
 /*
- * Allocate memory for the new array and return it.
+ * Functions defined in this header are inlined where the compiler
+ * supports it. Otherwise they are plain static functions.
+ */
+#if defined(__GNUC__)
+	#define ARRAY_INLINE static __inline__
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+	#define ARRAY_INLINE static inline
+#else
+	#define ARRAY_INLINE static
+#endif
+
+/*
+ * An allocator that arrays draw their memory from, so that each array can
+ * use the arena or pool matching its lifetime. Every function receives the
+ * context pointer as its first argument. Sizes are always given in bytes;
+ * the old size of a block is passed along for allocators that don't track
+ * it themselves.
+ *
+ * The allocate and deallocate functions are required. If reallocate is
+ * NULL, blocks are resized by allocating a new one and copying. The
+ * optional extend function tries to grow a block in place, returning
+ * nonzero on success; it is consulted before reallocating.
+ */
+typedef struct ArrayAllocator {
+	void *(*allocate)(void *context, size_t size);
+	void *(*reallocate)(void *context, void *pointer, size_t old_size,
+		size_t new_size);
+	void (*deallocate)(void *context, void *pointer, size_t size);
+	int (*extend)(void *context, void *pointer, size_t old_size,
+		size_t new_size);
+	void *context;
+} ArrayAllocator;
+
+/* Growth policies, see array_set_growth_policy */
+#define ARRAY_GROWTH_DOUBLE 0
+#define ARRAY_GROWTH_HALF 1
+#define ARRAY_GROWTH_LINEAR 2
+#define ARRAY_GROWTH_PAGES 3
+
+/*
+ * Usage counters of an array, for finding arrays created with the wrong
+ * capacity or used in a way that keeps shifting many elements. Grows
+ * and reallocated bytes only count resizes of an existing block, so an
+ * array that never grows had a large enough initial capacity. Shifted
+ * elements are the ones moved by inserting and removing to open or
+ * close a gap. Sorts and comparisons count the sorting functions of
+ * array.c, excluding the comparisons of the standard library qsort on
+ * compilers without thread-local storage.
+ */
+typedef struct ArrayStats {
+	uint64_t grows;
+	uint64_t bytes_reallocated;
+	uint64_t peak_capacity;
+	uint64_t elements_shifted;
+	uint64_t sorts;
+	uint64_t comparisons;
+} ArrayStats;
+
+/*
+ * Size in bytes of the buffer inside every array that holds the elements
+ * while they fit, if the array uses the default allocator. Arrays with
+ * an allocator of their own get all their memory from it. The library
+ * and any code using the inline API must agree on it.
+ */
+#ifndef ARRAY_SMALL_SIZE
+	#define ARRAY_SMALL_SIZE (4 * sizeof(void*))
+#endif
+
+#if defined(ARRAY_INLINE_API) || defined(ARRAY_IMPLEMENTATION)
+
+/*
+ * The elements are stored contiguously, but they don't have to start at
+ * the beginning of the allocated block: head is the number of unused
+ * slots in front of them, which lets elements be added and removed at
+ * the front without shifting the rest. The block holds capacity slots,
+ * starting at elements minus head slots. It is either allocated or the
+ * small buffer at the end, which is aligned for any element type.
+ *
+ * In a gap buffer, the last gap_tail elements are moved to the end of
+ * the block instead, so the unused slots after the last element form a
+ * gap in front of them. The elements are contiguous when gap_tail is 0,
+ * which is always the case for other arrays.
+ *
+ * Snapshots share the block of the array they were taken of, along with
+ * references, the number of arrays holding it. None of them write to a
+ * shared block: the first one to be modified copies it, and the last one
+ * left takes it back. References is NULL if the block is not shared.
+ */
+struct Array {
+	size_t length;
+	size_t capacity;
+	size_t head;
+	size_t element_size;
+	double shrink_threshold;
+	int growth_policy;
+	size_t growth_step;
+	int gap_buffer;
+	size_t gap_tail;
+	char *elements;
+	const ArrayAllocator *allocator;
+	size_t *references;
+#ifdef ARRAY_STATS
+	ArrayStats stats;
+#endif
+	union {
+		char bytes[ARRAY_SMALL_SIZE];
+		void *pointer;
+		double real;
+		uint64_t integer;
+	} small;
+};
+
+#endif
+
+#ifdef ARRAY_IMPLEMENTATION
+
+/*
+ * Initialize every field of a new array to an empty array of the given
+ * element size using the given allocator, which must not be NULL. Other
+ * parts of the library that build arrays themselves, like array files,
+ * start from this so that they pick up new fields.
+ */
+extern void array_setup(Array *array, const ArrayAllocator *allocator,
+	size_t element_size);
+
+#endif
+
+/*
+ * A read-only view of the elements of an array: length elements of
+ * element_size bytes each, laid out contiguously from elements. The
+ * elements pointer is NULL if the array has never held anything.
+ */
+typedef struct ArraySpan {
+	const void *elements;
+	int length;
+	size_t element_size;
+} ArraySpan;
+
+/*
+ * Allocate memory for the new array of pointers and return it.
  * Returns a pointer to the newly allocated element,
  * or NULL if we ran out of memory.
  */
 extern Array *array_create(void);
 
+/*
+ * Allocate memory for a new array that stores values of the given size
+ * inline, instead of pointers to them. Such arrays are accessed with the
+ * _value functions and array_at. Returns NULL if the element size is zero
+ * or if we ran out of memory.
+ */
+extern Array *array_create_typed(size_t element_size);
+
+/*
+ * Like array_create, but with room for the given number of elements
+ * before the first reallocation. A capacity of zero delays allocating
+ * the elements until the first insertion. Returns NULL if the capacity
+ * is negative or if we ran out of memory.
+ */
+extern Array *array_create_with_capacity(int capacity);
+
+/*
+ * Create an array of elements of the given size (sizeof(void*) for an
+ * array of pointers) with the given initial capacity. Both the array and
+ * its elements are allocated with the given allocator. The allocator is
+ * not copied, so it must outlive the array. A NULL allocator uses the
+ * default one, which is based on malloc. Returns NULL if the allocator
+ * is missing a required function, the element size is zero, the
+ * capacity is negative or we ran out of memory.
+ *
+ * Copies of the array don't inherit its allocator: array_clone and
+ * array_snapshot use the default one, and array_clone_ex the one it is
+ * given, which can be the same one.
+ */
+extern Array *array_create_ex(const ArrayAllocator *allocator,
+	size_t element_size, int capacity);
+
 /*
  * Destroy the array and free any allocated memory.
  */
 extern void array_free(Array *array);
 
+/*
+ * Initialize an array that lives in memory managed by the caller, such
+ * as a local variable or a field of another object, which needs the
+ * layout of arrays from ARRAY_INLINE_API. The arguments are the same as
+ * for array_create_ex, minus the capacity: the array starts out with
+ * the elements that fit in its small buffer, so nothing is allocated
+ * until it outgrows that. Since the elements may be inside the array, it
+ * must not be copied or moved while in use. Returns 1 if successful, 0
+ * if the array is NULL or the allocator or element size are invalid.
+ */
+extern int array_init(Array *array, const ArrayAllocator *allocator,
+	size_t element_size);
+
+/*
+ * Free the elements of an array initialized with array_init, but not the
+ * array itself. The array is left empty and can still be used; it must
+ * be destroyed again after that. Arrays from array_create and friends
+ * are freed with array_free instead.
+ */
+extern void array_destroy(Array *array);
+
+/*
+ * Create a copy of the array, with the same element size and settings.
+ * The elements are copied with a single memcpy (two for a gap buffer)
+ * into a block of exactly the right size. The copy uses the default
+ * allocator, whatever the array uses. Returns NULL if the array is NULL
+ * or we ran out of memory.
+ */
+extern Array *array_clone(Array *array);
+
+/*
+ * Like array_clone, but the copy and its elements are allocated with the
+ * given allocator, or the default one if it is NULL, as for
+ * array_create_ex. Returns NULL if the array is NULL, the allocator is
+ * missing a required function or we ran out of memory.
+ */
+extern Array *array_clone_ex(Array *array, const ArrayAllocator *allocator);
+
+/*
+ * Take a snapshot of the array: a new array holding the same elements,
+ * which shares them with the array instead of copying them. Whichever of
+ * the two is modified first copies the elements then, so the other one
+ * keeps seeing them as they were. Reading an array (with array_get,
+ * the _get_value functions, array_last, array_span or the searches)
+ * never copies, but getting a pointer that can write to the elements
+ * (with array_at or array_foreach) counts as modifying it, and may fail
+ * if we run out of memory while copying.
+ *
+ * Snapshots can be passed to other threads, and read and freed there
+ * while the array keeps being modified, as long as each array is only
+ * used by one thread at a time. Taking a snapshot of a snapshot shares
+ * the elements as well, and arrays can be freed in any order.
+ *
+ * Only elements allocated by the default allocator are shared, since
+ * whichever array is freed last frees them. Other arrays, like array
+ * files, and arrays small enough for their small buffer, get a clone
+ * instead. Returns NULL if the array is NULL or we ran out of memory.
+ */
+extern Array *array_snapshot(Array *array);
+
+/*
+ * Make sure the elements of the array are its own, copying them if they
+ * are shared with a snapshot. Functions modifying the array do this
+ * themselves; it is only needed before writing to the elements through
+ * an array_span. Returns 1 if successful, 0 if the array is NULL or we
+ * ran out of memory.
+ */
+extern int array_unshare(Array *array);
+
 /*
  * Get the length of the array.
  * The length of a NULL array is zero.
@@ -42,25 +327,140 @@ extern int array_length(Array *array);
  */
 extern int array_capacity(Array *array);
 
+/*
+ * Get the size of a single element of the array in bytes.
+ * The element size of a NULL array is zero.
+ */
+extern size_t array_element_size(Array *array);
+
+/*
+ * Make sure the array can hold at least the given number of elements
+ * without reallocating. The capacity is set to exactly that amount if
+ * it needs to grow. Returns 1 if successful, 0 otherwise.
+ */
+extern int array_reserve(Array *array, int capacity);
+
+/*
+ * Reduce the capacity of the array to its length, giving back any
+ * unused memory. Returns 1 if successful, 0 otherwise.
+ */
+extern int array_shrink_to_fit(Array *array);
+
+/*
+ * Enable automatic shrinking: whenever a removal leaves fewer elements
+ * than load_factor times the capacity, the capacity is reduced so that
+ * the array is half full. The load factor must be less than 0.5 so that
+ * growing and shrinking don't alternate; zero (the default) disables
+ * automatic shrinking. Returns 1 if successful, 0 otherwise.
+ */
+extern int array_set_shrink_threshold(Array *array, double load_factor);
+
+/*
+ * Choose how the capacity grows when the array gets full:
+ *
+ * ARRAY_GROWTH_DOUBLE doubles it, which is the default.
+ * ARRAY_GROWTH_HALF grows it by half, which wastes less memory and lets
+ * the allocator reuse blocks the array has freed before.
+ * ARRAY_GROWTH_LINEAR adds step elements, for arrays whose final size is
+ * known roughly. Growing takes linear time, so pushes no longer take
+ * amortized constant time.
+ * ARRAY_GROWTH_PAGES doubles it and then rounds the size of the elements
+ * block up to a multiple of step bytes, such as the huge page size.
+ *
+ * The step is ignored by the other policies. Every policy stops at the
+ * largest capacity whose elements fit in a size_t worth of bytes, and
+ * growing beyond that fails like running out of memory. Returns 1 if
+ * successful, 0 if the array is NULL, the policy is unknown or it needs
+ * a step and the step is zero.
+ */
+extern int array_set_growth_policy(Array *array, int policy, size_t step);
+
+/*
+ * Turn the array into a gap buffer, or back into a plain array. Inserting
+ * or removing in a gap buffer first moves the gap to that index, shifting
+ * only the elements in between, and then takes a slot from it or gives
+ * one back. A run of edits at or near the same index takes constant time
+ * per edit, wherever it is in the array, while jumping to another index
+ * costs as much as a plain insertion would. Elements are no longer
+ * contiguous across the gap, so pointers from array_at only reach the
+ * following elements up to the gap. Functions that need all of them in
+ * one piece, such as array_span, the sorts and the searches, close the
+ * gap first by moving the elements after it, and the next edit opens it
+ * again. Turning the mode off closes the gap. Returns 1 if successful, 0
+ * if the array is NULL.
+ */
+extern int array_set_gap_buffer(Array *array, int enabled);
+
+/*
+ * The functions below that take or return a void* element store the
+ * pointer itself, so they only work on arrays whose element size is
+ * sizeof(void*), such as those from array_create. On any other array
+ * they do nothing and return 0 or NULL; use the _value functions (or
+ * ARRAY_DEFINE) for those.
+ */
+
 /*
  * Insert the given element into the array at the given index.
  * Returns 1 if the insertion was successful, 0 otherwise. If the
  * array does not have enough capacity, it will be resized. When
- * adding elements to the middle of the array, the remaining
- * elements will be shifted. Therefore insertion is a linear-time
- * operation.
+ * adding elements to the middle of the array, the elements on the
+ * shorter side will be shifted. Therefore insertion is a linear-time
+ * operation, except near either end.
  */
 extern int array_insert(Array *array, int index, void *element);
 
 /*
  * Remove the element at the given index from the array.
  * This is a linear-time operation: when the element is removed,
- * the following elements are shifted backwards by one. Returns
+ * the elements on the shorter side are shifted by one. Returns
  * the element that was removed, or NULL if there was no element
  * in the array at that index.
  */
 extern void *array_remove(Array *array, int index);
 
+/*
+ * Insert count elements, read from the given buffer, into the array
+ * starting at the given index. The array grows at most once and the
+ * following elements are shifted with a single block move, so the
+ * whole operation is linear in the length of the array plus count.
+ * The buffer must not point into the array itself. Returns 1 if the
+ * insertion was successful, 0 otherwise (in which case the array is
+ * left untouched).
+ */
+extern int array_insert_range(Array *array, int index, const void *elements,
+	int count);
+
+/*
+ * Remove count elements from the array, starting at the given index.
+ * If out is not NULL, the removed elements are copied into it first,
+ * so it must have room for count elements. The following elements are
+ * shifted backwards with a single block move. Returns 1 if the removal
+ * was successful, 0 if the range is not within the array.
+ */
+extern int array_remove_range(Array *array, int index, int count,
+	void *out);
+
+/*
+ * Remove the element at the given index by moving the last element
+ * into its place. This is a constant-time operation, but it does not
+ * keep the order of the elements. Returns the element that was removed,
+ * or NULL if there was no element in the array at that index.
+ */
+extern void *array_swap_remove(Array *array, int index);
+
+/*
+ * Remove all elements for which the predicate returns zero (retain) or
+ * nonzero (remove_if), keeping the order of the rest. The predicate
+ * receives a pointer to each element (see array_sort) along with the
+ * given context, and is called exactly once per element, in order. All
+ * elements are moved at most once, so this takes linear time no matter
+ * how many are removed. Returns the number of elements removed.
+ */
+extern int array_retain(Array *array, int (*pred)(const void*, void*),
+	void *context);
+extern int array_remove_if(Array *array, int (*pred)(const void*, void*),
+	void *context);
+
 /*
  * Add the given element to the end of the array.
  * This is a constant-time operation.
@@ -73,6 +473,19 @@ extern int array_push(Array *array, void *element);
  */
 extern void *array_pop(Array *array);
 
+/*
+ * Add the given element to the front of the array, so that it gets
+ * index zero. Space freed at the front is reused, and the array grows
+ * when needed, so this takes amortized constant time.
+ */
+extern int array_push_front(Array *array, void *element);
+
+/*
+ * Remove the first element of the array and return it.
+ * This is a constant-time operation. Returns NULL if the array is empty.
+ */
+extern void *array_pop_front(Array *array);
+
 /*
  * Get the element from the array at the given index.
  * Returns NULL if there is nothing in that index.
@@ -92,10 +505,339 @@ extern int array_set(Array *array, int index, void *element);
 extern void *array_last(Array *array);
 
 /*
- * Sort the array with the given comparison function.
- * Internally, simply uses qsort, so the time complexity
- * depends on its implementation.
+ * Sort the array with the given comparison function, which receives
+ * pointers to two elements (so, for an array of pointers, pointers to
+ * pointers). Arrays of pointers are sorted with introsort in O(n log n)
+ * time; other element sizes are handed to qsort.
  */
 extern void array_sort(Array *array, int (*cmp)(const void*, const void*));
 
+/*
+ * Sort the array with the given comparison function, keeping elements
+ * that compare equal in their original order. Uses a natural merge sort
+ * in the style of timsort: existing ascending and descending runs are
+ * detected and merged, so input that is already nearly sorted is sorted
+ * in close to linear time, and the worst case is O(n log n). Returns 1
+ * if successful, 0 if the temporary buffer (up to half the size of the
+ * array) could not be allocated, in which case the array is untouched.
+ */
+extern int array_sort_stable(Array *array,
+	int (*cmp)(const void*, const void*));
+
+/*
+ * Merge the sorted arrays a and b into dst, replacing its contents. The
+ * result is sorted and stable: on ties, elements of a go first. Either
+ * a or b may be the same array as dst; merging a batch b into a large
+ * sorted array dst == a only moves the elements of dst that are greater
+ * than the first element of b, with no temporary buffer. All arrays
+ * must have the same element size. Returns 1 if successful, 0 otherwise
+ * (in which case dst is left untouched).
+ */
+extern int array_merge_sorted(Array *dst, Array *a, Array *b,
+	int (*cmp)(const void*, const void*));
+
+/*
+ * The following functions search an array that is sorted according to
+ * the given comparison function. As with array_sort, the comparison
+ * function receives pointers to elements, so key must point to a value
+ * of the element type (for an array of pointers, a pointer to a
+ * pointer). Searches take O(log n) time and are branch-free, so they
+ * stay fast on large arrays that don't fit in the cache.
+ *
+ * array_lower_bound returns the index of the first element that does
+ * not sort before key, and array_upper_bound the index of the first
+ * element that key sorts before. Both return the length of the array if
+ * there is no such element. array_bsearch returns the index of the first
+ * element equal to key, or -1 if there is none.
+ */
+extern int array_lower_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*));
+extern int array_upper_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*));
+extern int array_bsearch(Array *array, const void *key,
+	int (*cmp)(const void*, const void*));
+
+/*
+ * Insert the value pointed to into a sorted array, after any elements
+ * equal to it, so that the array stays sorted. Returns 1 if the
+ * insertion was successful, 0 otherwise.
+ */
+extern int array_insert_sorted(Array *array, const void *value,
+	int (*cmp)(const void*, const void*));
+
+/*
+ * Sort the array in ascending order of the unsigned integer keys returned
+ * by the given key function, which is called exactly once per element.
+ * Uses a stable LSD radix sort, so it takes linear time and no
+ * comparisons. Signed integer and floating point keys can be converted
+ * with array_key_from_int and array_key_from_double. Returns 1 if
+ * successful, 0 if the temporary buffers could not be allocated (in
+ * which case the array is left untouched).
+ */
+extern int array_sort_by_key(Array *array, uint64_t (*key)(const void*));
+
+/*
+ * Map a signed integer to an unsigned key with the same ordering.
+ */
+ARRAY_INLINE uint64_t array_key_from_int(int64_t value) {
+	return (uint64_t) value ^ ((uint64_t) 1 << 63);
+}
+
+/*
+ * Map a double to an unsigned key with the same ordering. Negative
+ * zero sorts before positive zero, and NaNs sort to either end
+ * depending on their sign bit.
+ */
+ARRAY_INLINE uint64_t array_key_from_double(double value) {
+	const uint64_t sign = (uint64_t) 1 << 63;
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (bits & sign) ? ~bits : bits | sign;
+}
+
+/*
+ * The following functions work on arrays of any element size. Values
+ * are passed in and out through pointers, and exactly element size
+ * bytes are copied. Each returns 1 if it succeeded, 0 otherwise. On
+ * failure, nothing is written to out. The out pointers of the remove
+ * functions may be NULL to discard the removed value. The value to
+ * insert or push may be an element of the same array.
+ */
+extern int array_insert_value(Array *array, int index, const void *value);
+extern int array_remove_value(Array *array, int index, void *out);
+extern int array_swap_remove_value(Array *array, int index, void *out);
+extern int array_push_value(Array *array, const void *value);
+extern int array_pop_value(Array *array, void *out);
+extern int array_push_front_value(Array *array, const void *value);
+extern int array_pop_front_value(Array *array, void *out);
+extern int array_get_value(Array *array, int index, void *out);
+extern int array_set_value(Array *array, int index, const void *value);
+
+/*
+ * Get a pointer to the element stored at the given index, or NULL if
+ * there is nothing in that index. The elements are contiguous, so the
+ * pointer can also be used to reach the following elements, except in a
+ * gap buffer. It stays valid until the array is next resized or modified.
+ * Elements shared with a snapshot are copied first, as the pointer can
+ * be used to modify them, and NULL is returned if that fails.
+ */
+extern void *array_at(Array *array, int index);
+
+/*
+ * Get a span over the current elements of the array, for walking them
+ * in a plain loop without a function call per element. The span of a
+ * NULL array is empty. The span stays valid until the array is next
+ * inserted into, removed from, resized or freed; writing elements in
+ * place (with the _set functions or a sort) does not invalidate it, but
+ * the span then sees the new values, unless the elements were shared
+ * with a snapshot and had to be copied. Getting the span of a gap buffer
+ * closes its gap.
+ */
+extern ArraySpan array_span(Array *array);
+
+/*
+ * Call fn for each element of the array in order, with a pointer to the
+ * element and the given context. Elements may be modified through the
+ * pointer, but fn must not insert or remove any. Iteration stops early
+ * if fn returns nonzero. Returns the index of the element at which it
+ * stopped, or the length of the array if all elements were visited.
+ * Elements shared with a snapshot are copied first, and 0 is returned
+ * if that fails.
+ */
+extern int array_foreach(Array *array, int (*fn)(void*, void*),
+	void *context);
+
+/*
+ * Versions of the functions above that take and return size_t lengths
+ * and indices, for arrays longer than INT_MAX elements. Each one works
+ * like the function of the same name without the 64, including returning
+ * 0 (or NULL) on invalid arguments; capacities are checked so that their
+ * size in bytes never wraps around.
+ */
+extern size_t array64_length(Array *array);
+extern size_t array64_capacity(Array *array);
+extern int array64_reserve(Array *array, size_t capacity);
+extern void *array64_at(Array *array, size_t index);
+extern int array64_get_value(Array *array, size_t index, void *out);
+extern int array64_set_value(Array *array, size_t index, const void *value);
+extern int array64_insert_value(Array *array, size_t index,
+	const void *value);
+extern int array64_remove_value(Array *array, size_t index, void *out);
+extern int array64_swap_remove_value(Array *array, size_t index, void *out);
+extern int array64_insert_range(Array *array, size_t index,
+	const void *elements, size_t count);
+extern int array64_remove_range(Array *array, size_t index, size_t count,
+	void *out);
+extern size_t array64_lower_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*));
+extern size_t array64_upper_bound(Array *array, const void *key,
+	int (*cmp)(const void*, const void*));
+
+/*
+ * Get the usage counters of the given array. Returns 1 if successful, 0
+ * if the array is NULL or the library was built without ARRAY_STATS, in
+ * which case all the counters are zero.
+ */
+extern int array_stats(Array *array, ArrayStats *out);
+
+/*
+ * Get the counters of all arrays, including the ones already freed, in
+ * the whole process. The peak capacity is the largest of any array.
+ * Safe to call from any thread. Returns 1 if successful, 0 if the
+ * library was built without ARRAY_STATS, in which case all the counters
+ * are zero.
+ */
+extern int array_stats_total(ArrayStats *out);
+
+/*
+ * Define a set of type-safe functions for an array storing values of
+ * the given type inline. For example, ARRAY_DEFINE(int_array, int)
+ * defines int_array_create, int_array_push(Array*, int) and so on. The
+ * functions are thin inline wrappers for the _value functions above.
+ * The _span function returns the elements as an array of the given type
+ * and stores their count in length. It returns NULL (and a length of
+ * zero) if the array is empty or its element size does not match.
+ */
+#define ARRAY_DEFINE(name, type) \
+	ARRAY_INLINE Array *name##_create(void) { \
+		return array_create_typed(sizeof(type)); \
+	} \
+	ARRAY_INLINE int name##_insert(Array *array, int index, type value) { \
+		return array_insert_value(array, index, &value); \
+	} \
+	ARRAY_INLINE int name##_remove(Array *array, int index, type *out) { \
+		return array_remove_value(array, index, out); \
+	} \
+	ARRAY_INLINE int name##_swap_remove(Array *array, int index, \
+		type *out) { \
+		return array_swap_remove_value(array, index, out); \
+	} \
+	ARRAY_INLINE int name##_push(Array *array, type value) { \
+		return array_push_value(array, &value); \
+	} \
+	ARRAY_INLINE int name##_pop(Array *array, type *out) { \
+		return array_pop_value(array, out); \
+	} \
+	ARRAY_INLINE int name##_push_front(Array *array, type value) { \
+		return array_push_front_value(array, &value); \
+	} \
+	ARRAY_INLINE int name##_pop_front(Array *array, type *out) { \
+		return array_pop_front_value(array, out); \
+	} \
+	ARRAY_INLINE int name##_get(Array *array, int index, type *out) { \
+		return array_get_value(array, index, out); \
+	} \
+	ARRAY_INLINE int name##_set(Array *array, int index, type value) { \
+		return array_set_value(array, index, &value); \
+	} \
+	ARRAY_INLINE type *name##_at(Array *array, int index) { \
+		return (type*) array_at(array, index); \
+	} \
+	ARRAY_INLINE const type *name##_span(Array *array, int *length) { \
+		ArraySpan span = array_span(array); \
+		if (span.length == 0 || span.element_size != sizeof(type)) { \
+			*length = 0; \
+			return NULL; \
+		} \
+		*length = span.length; \
+		return (const type*) span.elements; \
+	}
+
+#if defined(ARRAY_INLINE_API) && !defined(ARRAY_IMPLEMENTATION)
+
+/*
+ * Inline versions of the most frequently called functions. Each one
+ * behaves exactly like the library function it replaces.
+ */
+ARRAY_INLINE int array_length_inline(Array *array) {
+	if (array == NULL) {
+		return 0;
+	}
+	return array->length < (size_t) INT_MAX ? (int) array->length : INT_MAX;
+}
+
+/* Address of the element at the given index, which must be in bounds */
+ARRAY_INLINE void *array_slot_inline(Array *array, size_t index) {
+	/* Skip over the gap of a gap buffer */
+	if (index >= array->length - array->gap_tail) {
+		index += array->capacity - array->head - array->length;
+	}
+	return array->elements + index * array->element_size;
+}
+
+/* Address of the element at the given index, for reading it */
+ARRAY_INLINE void *array_element_inline(Array *array, int index) {
+	if (array != NULL && index >= 0 && (size_t) index < array->length) {
+		return array_slot_inline(array, (size_t) index);
+	}
+	return NULL;
+}
+
+ARRAY_INLINE void *array_at_inline(Array *array, int index) {
+	/* Shared elements have to be copied before they can be written */
+	if (array != NULL && array->references != NULL) {
+		return array_at(array, index);
+	}
+	return array_element_inline(array, index);
+}
+
+/* Whether the array stores pointers, so the pointer functions may use it */
+ARRAY_INLINE int array_holds_pointers_inline(Array *array) {
+	return array != NULL && array->element_size == sizeof(void*);
+}
+
+ARRAY_INLINE void *array_get_inline(Array *array, int index) {
+	void **slot;
+	if (!array_holds_pointers_inline(array)) {
+		return NULL;
+	}
+	slot = (void**) array_element_inline(array, index);
+	return slot != NULL ? *slot : NULL;
+}
+
+ARRAY_INLINE int array_set_inline(Array *array, int index, void *element) {
+	void **slot;
+	if (!array_holds_pointers_inline(array)) {
+		return 0;
+	}
+	slot = (void**) array_at_inline(array, index);
+	if (slot != NULL) {
+		*slot = element;
+		return 1;
+	}
+	return 0;
+}
+
+ARRAY_INLINE void *array_last_inline(Array *array) {
+	/* The length may not fit in an int index */
+	if (array_holds_pointers_inline(array) && array->length > 0) {
+		return *(void**) array_slot_inline(array, array->length - 1);
+	}
+	return NULL;
+}
+
+ARRAY_INLINE int array_push_inline(Array *array, void *element) {
+	/*
+	 * Only arrays of pointers with room left at the end, and elements of
+	 * their own, take the fast path
+	 */
+	if (array_holds_pointers_inline(array) &&
+		array->gap_tail == 0 && array->references == NULL &&
+		array->length < array->capacity - array->head) {
+		((void**) array->elements)[array->length++] = element;
+		return 1;
+	}
+	return array_push(array, element);
+}
+
+#define array_length(array) array_length_inline(array)
+#define array_at(array, index) array_at_inline(array, index)
+#define array_get(array, index) array_get_inline(array, index)
+#define array_set(array, index, element) \
+	array_set_inline(array, index, element)
+#define array_last(array) array_last_inline(array)
+#define array_push(array, element) array_push_inline(array, element)
+
+#endif
+
 #endif /* ARRAY_H */
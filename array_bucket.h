@@ -0,0 +1,46 @@
+/*
+ * Index arithmetic shared by the arrays that store their elements in
+ * buckets of doubling size instead of a single block. Bucket b holds
+ * ARRAY_BUCKET_LENGTH(b) elements, and the first element of bucket b
+ * has index ARRAY_BUCKET_LENGTH(b) - ARRAY_BUCKET_LENGTH(0). Together,
+ * the buckets have room for more than INT_MAX elements. Buckets never
+ * move once allocated, so neither do the elements.
+ */
+
+#ifndef ARRAY_BUCKET_H
+#define ARRAY_BUCKET_H
+
+#include <limits.h>
+#include "array.h"
+
+/* The first bucket holds 1 << ARRAY_BUCKET_SHIFT elements */
+#define ARRAY_BUCKET_SHIFT 4
+
+/* Enough doubling buckets for INT_MAX elements */
+#define ARRAY_BUCKET_COUNT (32 - ARRAY_BUCKET_SHIFT)
+
+/* Number of elements in the given bucket */
+#define ARRAY_BUCKET_LENGTH(bucket) \
+	((size_t) 1 << ((bucket) + ARRAY_BUCKET_SHIFT))
+
+/*
+ * Find the bucket of the element at the given index, which must not be
+ * greater than INT_MAX, and store its offset within the bucket.
+ */
+ARRAY_INLINE int array_bucket_locate(size_t index, size_t *offset) {
+	const unsigned long shifted =
+		(unsigned long) (index + ARRAY_BUCKET_LENGTH(0));
+	int bit;
+
+#if defined(__GNUC__)
+	bit = (int) (sizeof(shifted) * CHAR_BIT) - 1 - __builtin_clzl(shifted);
+#else
+	for (bit = 0; (shifted >> bit) > 1; bit++) {
+	}
+#endif
+
+	*offset = shifted - ((unsigned long) 1 << bit);
+	return bit - ARRAY_BUCKET_SHIFT;
+}
+
+#endif /* ARRAY_BUCKET_H */
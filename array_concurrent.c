@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <string.h>
+#include "array_bucket.h"
+#include "array_concurrent.h"
+
+/*
+ * Each bucket (see array_bucket.h) holds its elements, followed by one
+ * flag byte per element. A flag is set once the element has been
+ * written, which is what readers check before touching the element.
+ */
+struct ConcurrentArray {
+	size_t element_size;
+	size_t reserved;
+	char *buckets[ARRAY_BUCKET_COUNT];
+};
+
+/*
+ * Get the given bucket, allocating it if no other thread has yet. When
+ * two threads race to allocate it, one of them wins and the other one
+ * frees its block again. Returns NULL if we ran out of memory.
+ */
+static char *concurrent_array_bucket(ConcurrentArray *array, int bucket) {
+	char *block = __atomic_load_n(&array->buckets[bucket], __ATOMIC_ACQUIRE);
+	char *expected = NULL;
+	size_t length;
+
+	if (block != NULL) {
+		return block;
+	}
+
+	/* Zeroed, so that no element is flagged as written */
+	length = ARRAY_BUCKET_LENGTH(bucket);
+	block = calloc(length, array->element_size + 1);
+	if (block == NULL) {
+		return NULL;
+	}
+
+	if (!__atomic_compare_exchange_n(&array->buckets[bucket], &expected,
+		block, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(block);
+		block = expected;
+	}
+
+	return block;
+}
+
+ConcurrentArray *concurrent_array_create(size_t element_size) {
+	ConcurrentArray *array;
+	int i;
+
+	if (element_size == 0) {
+		return NULL;
+	}
+
+	array = malloc(sizeof(ConcurrentArray));
+
+	if (array != NULL) {
+		array->element_size = element_size;
+		array->reserved = 0;
+		for (i = 0; i < ARRAY_BUCKET_COUNT; i++) {
+			array->buckets[i] = NULL;
+		}
+	}
+
+	return array;
+}
+
+void concurrent_array_free(ConcurrentArray *array) {
+	int i;
+
+	if (array != NULL) {
+		for (i = 0; i < ARRAY_BUCKET_COUNT; i++) {
+			free(array->buckets[i]);
+		}
+		free(array);
+	}
+}
+
+int concurrent_array_push(ConcurrentArray *array, const void *value) {
+	size_t index, offset;
+	char *block;
+	int bucket;
+
+	if (array == NULL || value == NULL) {
+		return -1;
+	}
+
+	index = __atomic_fetch_add(&array->reserved, 1, __ATOMIC_RELAXED);
+
+	if (index > INT_MAX) {
+		return -1; /* Full */
+	}
+
+	bucket = array_bucket_locate(index, &offset);
+	block = concurrent_array_bucket(array, bucket);
+
+	if (block == NULL) {
+		return -1; /* Out of memory */
+	}
+
+	/* Write the element, then publish it by setting its flag */
+	memcpy(block + offset * array->element_size, value, array->element_size);
+	__atomic_store_n(block + ARRAY_BUCKET_LENGTH(bucket) *
+		array->element_size + offset, 1, __ATOMIC_RELEASE);
+
+	return (int) index;
+}
+
+const void *concurrent_array_at(ConcurrentArray *array, int index) {
+	size_t offset;
+	char *block;
+	int bucket;
+
+	if (array == NULL || index < 0) {
+		return NULL;
+	}
+
+	bucket = array_bucket_locate((size_t) index, &offset);
+	block = __atomic_load_n(&array->buckets[bucket], __ATOMIC_ACQUIRE);
+
+	if (block == NULL || !__atomic_load_n(block +
+		ARRAY_BUCKET_LENGTH(bucket) * array->element_size + offset,
+		__ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return block + offset * array->element_size;
+}
+
+int concurrent_array_get(ConcurrentArray *array, int index, void *out) {
+	const void *element = concurrent_array_at(array, index);
+
+	if (element == NULL || out == NULL) {
+		return 0;
+	}
+
+	memcpy(out, element, array->element_size);
+	return 1;
+}
+
+int concurrent_array_length(ConcurrentArray *array) {
+	size_t length;
+
+	if (array == NULL) {
+		return 0;
+	}
+
+	length = __atomic_load_n(&array->reserved, __ATOMIC_RELAXED);
+	return length > INT_MAX ? INT_MAX : (int) length;
+}
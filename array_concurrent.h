@@ -0,0 +1,65 @@
+/*
+ * An append-only array that many threads can push into and read from at
+ * the same time, without locks. Elements are stored inline in buckets of
+ * doubling size. A bucket is allocated once, when the first element that
+ * belongs to it is pushed, and never moves afterwards. Pointers to
+ * elements therefore stay valid for the lifetime of the array.
+ *
+ * Pushing reserves an index with a single atomic increment, so pushes
+ * from different threads never wait for each other, and look-up by
+ * index is wait-free. Creating and freeing an array must not overlap
+ * with any other operation on it.
+ *
+ * Requires a compiler with the __atomic builtins (GCC 4.7 or Clang).
+ */
+
+#ifndef ARRAY_CONCURRENT_H
+#define ARRAY_CONCURRENT_H
+
+#include <stddef.h>
+
+typedef struct ConcurrentArray ConcurrentArray;
+
+/*
+ * Allocate a new concurrent array storing values of the given size.
+ * Returns NULL if the element size is zero or we ran out of memory.
+ */
+extern ConcurrentArray *concurrent_array_create(size_t element_size);
+
+/*
+ * Free the array along with all its elements.
+ */
+extern void concurrent_array_free(ConcurrentArray *array);
+
+/*
+ * Copy the value pointed to into the next free slot of the array. May be
+ * called from any number of threads at once. Returns the index of the
+ * new element, or -1 if the array is full or we ran out of memory. In
+ * the latter case, the reserved index is left empty for good.
+ */
+extern int concurrent_array_push(ConcurrentArray *array, const void *value);
+
+/*
+ * Copy the element at the given index into out. Returns 1 if successful,
+ * 0 if there is no element at that index, or if its push has not
+ * finished yet. Once this succeeds for an index, it keeps succeeding and
+ * the element never changes.
+ */
+extern int concurrent_array_get(ConcurrentArray *array, int index,
+	void *out);
+
+/*
+ * Get a pointer to the element at the given index, or NULL as above.
+ * Elements never move, so the pointer stays valid until the array is
+ * freed. Each bucket is contiguous, but the array as a whole is not.
+ */
+extern const void *concurrent_array_at(ConcurrentArray *array, int index);
+
+/*
+ * Get the number of indices handed out by pushes so far. Pushes that are
+ * still in progress are included, so concurrent_array_get may fail for
+ * the last few indices below the length.
+ */
+extern int concurrent_array_length(ConcurrentArray *array);
+
+#endif /* ARRAY_CONCURRENT_H */
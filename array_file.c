@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Adopting the elements stored in a file needs the layout of arrays */
+#define ARRAY_IMPLEMENTATION
+#include "array_file.h"
+
+/* Identifies array files, along with the version of the format */
+#define ARRAY_FILE_MAGIC "ARRAYF01"
+
+/* The elements start this many bytes into the file */
+#define ARRAY_FILE_HEADER_SIZE 64
+
+struct ArrayFileHeader {
+	char magic[8];
+	uint64_t element_size;
+	uint64_t head;
+	uint64_t length;
+	uint64_t capacity;
+	uint64_t checksum;
+};
+
+/*
+ * An open array file. The file holds a single block: the elements of
+ * the array, right after the header. The header is always mapped, and
+ * the elements block is mapped right after it while the array has one.
+ */
+struct ArrayFile {
+	ArrayAllocator allocator;
+	Array *array;
+	int fd;
+	char *map;
+	size_t map_size;
+	int in_use;
+};
+
+/* 64-bit FNV-1a hash of the given bytes */
+static uint64_t array_file_checksum(const char *bytes, size_t size) {
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char) bytes[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
+/*
+ * Resize the file and its mapping to hold an elements block of the given
+ * size. The contents of the file are kept, up to the new size. Returns 1
+ * if successful, 0 otherwise, in which case the mapping is unchanged.
+ */
+static int array_file_map(struct ArrayFile *file, size_t size) {
+	const size_t map_size = ARRAY_FILE_HEADER_SIZE + size;
+	char *map;
+
+	/* The file must never be shorter than the mapping */
+	if (map_size > file->map_size &&
+		ftruncate(file->fd, (off_t) map_size) != 0) {
+		return 0;
+	}
+
+#ifdef MREMAP_MAYMOVE
+	map = mremap(file->map, file->map_size, map_size, MREMAP_MAYMOVE);
+#else
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		file->fd, 0);
+	if (map != MAP_FAILED) {
+		munmap(file->map, file->map_size);
+	}
+#endif
+
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+
+	if (map_size < file->map_size &&
+		ftruncate(file->fd, (off_t) map_size) != 0) {
+		/* The file just stays longer than needed */
+	}
+
+	file->map = map;
+	file->map_size = map_size;
+
+	return 1;
+}
+
+/*
+ * Store the current state of the array in the header. The elements are
+ * found through the mapping, as the array no longer points to them once
+ * it is being freed.
+ */
+static void array_file_write_header(struct ArrayFile *file) {
+	const Array *array = file->array;
+	const char *elements = file->map + ARRAY_FILE_HEADER_SIZE +
+		array->head * array->element_size;
+	struct ArrayFileHeader header;
+
+	memcpy(header.magic, ARRAY_FILE_MAGIC, sizeof(header.magic));
+	header.element_size = array->element_size;
+	header.head = (uint64_t) array->head;
+	header.length = (uint64_t) array->length;
+	header.capacity = (uint64_t) array->capacity;
+	header.checksum = array_file_checksum(elements,
+		array->length * array->element_size);
+	memcpy(file->map, &header, sizeof(header));
+}
+
+/* Save the array, then release the file along with the array itself */
+static void array_file_close(struct ArrayFile *file) {
+	array_file_write_header(file);
+	msync(file->map, file->map_size, MS_SYNC);
+	munmap(file->map, file->map_size);
+	close(file->fd);
+	free(file->array);
+	free(file);
+}
+
+static void *array_file_allocate(void *context, size_t size) {
+	struct ArrayFile *file = context;
+
+	/* Anything but the elements, like sorting buffers, is on the heap */
+	if (file->in_use) {
+		return malloc(size);
+	}
+
+	if (!array_file_map(file, size)) {
+		return NULL;
+	}
+
+	file->in_use = 1;
+	return file->map + ARRAY_FILE_HEADER_SIZE;
+}
+
+static void *array_file_reallocate(void *context, void *pointer,
+	size_t old_size, size_t new_size) {
+	struct ArrayFile *file = context;
+	(void) old_size;
+
+	if (pointer != file->map + ARRAY_FILE_HEADER_SIZE) {
+		return realloc(pointer, new_size);
+	}
+
+	if (!array_file_map(file, new_size)) {
+		return NULL;
+	}
+
+	return file->map + ARRAY_FILE_HEADER_SIZE;
+}
+
+static void array_file_deallocate(void *context, void *pointer,
+	size_t size) {
+	struct ArrayFile *file = context;
+	(void) size;
+
+	if (file->in_use && pointer == file->map + ARRAY_FILE_HEADER_SIZE) {
+		/*
+		 * Keep the elements mapped: when the array is being freed, they
+		 * still have to be checksummed, and otherwise the next
+		 * allocation resizes the mapping anyway.
+		 */
+		file->in_use = 0;
+	} else if (pointer == file->array) {
+		array_file_close(file);
+	} else {
+		free(pointer);
+	}
+}
+
+/*
+ * Check that the header describes a valid array of the given element
+ * size that fits in a file of the given size.
+ */
+static int array_file_check_header(const struct ArrayFileHeader *header,
+	size_t element_size, size_t file_size) {
+	return memcmp(header->magic, ARRAY_FILE_MAGIC,
+			sizeof(header->magic)) == 0 &&
+		header->element_size == element_size &&
+		header->length <= header->capacity &&
+		header->head <= header->capacity - header->length &&
+		header->capacity <= (file_size - ARRAY_FILE_HEADER_SIZE) /
+			element_size;
+}
+
+Array *array_open_file(const char *path, size_t element_size) {
+	struct ArrayFileHeader header;
+	struct ArrayFile *file;
+	struct stat status;
+	Array *array;
+	int valid = 0, created = 0;
+
+	if (path == NULL || element_size == 0) {
+		return NULL;
+	}
+
+	file = malloc(sizeof(struct ArrayFile));
+	array = malloc(sizeof(Array));
+
+	if (file == NULL || array == NULL) {
+		free(file);
+		free(array);
+		return NULL;
+	}
+
+	file->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+	if (file->fd < 0) {
+		free(file);
+		free(array);
+		return NULL;
+	}
+
+	if (fstat(file->fd, &status) != 0) {
+		valid = 0;
+	} else if (status.st_size == 0) {
+		/* A new file starts out as an empty array */
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, ARRAY_FILE_MAGIC, sizeof(header.magic));
+		header.element_size = element_size;
+		header.checksum = array_file_checksum(NULL, 0);
+		status.st_size = ARRAY_FILE_HEADER_SIZE;
+		valid = ftruncate(file->fd, ARRAY_FILE_HEADER_SIZE) == 0;
+		created = 1;
+	} else if (status.st_size >= ARRAY_FILE_HEADER_SIZE &&
+		pread(file->fd, &header, sizeof(header), 0) == sizeof(header)) {
+		valid = array_file_check_header(&header, element_size,
+			(size_t) status.st_size);
+	}
+
+	file->map = MAP_FAILED;
+	if (valid) {
+		file->map_size = (size_t) status.st_size;
+		file->map = mmap(NULL, file->map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, file->fd, 0);
+	}
+
+	if (file->map == MAP_FAILED) {
+		close(file->fd);
+		free(file);
+		free(array);
+		return NULL;
+	}
+
+	array_setup(array, &file->allocator, element_size);
+	array->length = (size_t) header.length;
+	array->capacity = (size_t) header.capacity;
+	array->head = (size_t) header.head;
+	array->elements = header.capacity > 0 ? file->map +
+		ARRAY_FILE_HEADER_SIZE + header.head * element_size : NULL;
+#ifdef ARRAY_STATS
+	array->stats.peak_capacity = header.capacity;
+#endif
+
+	/* Catch files that were modified without being saved properly */
+	if (array_file_checksum(array->elements, header.length * element_size) !=
+		header.checksum) {
+		munmap(file->map, file->map_size);
+		close(file->fd);
+		free(file);
+		free(array);
+		return NULL;
+	}
+
+	file->allocator.allocate = array_file_allocate;
+	file->allocator.reallocate = array_file_reallocate;
+	file->allocator.deallocate = array_file_deallocate;
+	file->allocator.extend = NULL;
+	file->allocator.context = file;
+	file->array = array;
+	file->in_use = header.capacity > 0;
+
+	if (created) {
+		array_file_write_header(file);
+	}
+
+	return array;
+}
+
+int array_sync(Array *array) {
+	struct ArrayFile *file;
+
+	if (array == NULL || array->allocator->allocate != array_file_allocate) {
+		return 0;
+	}
+
+	/* The file holds the elements in one piece, so close any gap */
+	array_span(array);
+	file = array->allocator->context;
+	array_file_write_header(file);
+
+	return msync(file->map, file->map_size, MS_SYNC) == 0;
+}
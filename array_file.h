@@ -0,0 +1,39 @@
+/*
+ * Arrays whose elements live in a memory-mapped file, so that they can
+ * be saved and reopened without copying or parsing anything. The file
+ * starts with a small header (element size, length, capacity and a
+ * checksum of the elements), followed by the element slots exactly as
+ * they are laid out in memory. Growing extends the file and the mapping
+ * instead of reallocating.
+ *
+ * Elements are stored byte for byte, so files are only portable between
+ * builds with the same element layout and byte order, and should only
+ * hold values without pointers. Requires POSIX mmap.
+ */
+
+#ifndef ARRAY_FILE_H
+#define ARRAY_FILE_H
+
+#include "array.h"
+
+/*
+ * Open the array stored in the file at the given path, creating an empty
+ * one if the file doesn't exist or is empty. The result is an ordinary
+ * array of values of the given size, and can be used with all the
+ * functions in array.h. Temporary memory, such as sorting buffers, still
+ * comes from the heap. Freeing the array saves it and closes the file.
+ *
+ * Returns NULL if the file can't be opened or mapped, if it was written
+ * with a different element size, or if its checksum does not match (for
+ * example, when the process that had it open crashed before saving).
+ */
+extern Array *array_open_file(const char *path, size_t element_size);
+
+/*
+ * Write the header of a file-backed array and flush the file to disk.
+ * Returns 1 if successful, 0 if the array is not file-backed or the
+ * flush failed.
+ */
+extern int array_sync(Array *array);
+
+#endif /* ARRAY_FILE_H */
@@ -0,0 +1,879 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Passes write their results straight into the destination array */
+#define ARRAY_IMPLEMENTATION
+#include "array_parallel.h"
+#include "array_sort.h"
+
+/* Ranges at most this long are sorted with insertion sort before merging */
+#define ARRAY_PARALLEL_RUN 16
+
+/* Size in bytes of a cache line, which chunks of a pass are made of */
+#define ARRAY_PARALLEL_CACHE_LINE 64
+
+/* A chunk of a pass covers about this many bytes of elements */
+#define ARRAY_PARALLEL_CHUNK_SIZE 16384
+
+/* Passes the comparison function to the introsort below */
+struct ArrayParallelCompare {
+	int (*cmp)(const void*, const void*);
+};
+
+#define array_parallel_less(a, b) \
+	(((struct ArrayParallelCompare*) context)->cmp((a), (b)) < 0)
+
+ARRAY_DEFINE_SORT(array_parallel_sort_pointers, void*, array_parallel_less)
+
+/*
+ * A piece of work for a single thread: either sorting a chunk in place
+ * (using scratch as temporary memory), or merging two sorted runs into
+ * out. Either run of a merge may be empty.
+ */
+struct ArraySortTask {
+	void (*run)(struct ArraySortTask *task);
+	char *base;
+	size_t length;
+	char *scratch;
+	const char *left;
+	size_t left_length;
+	const char *right;
+	size_t right_length;
+	char *out;
+	size_t element_size;
+	int (*cmp)(const void*, const void*);
+	int stable;
+};
+
+/*
+ * Merge two sorted runs into out. When elements compare equal, the one
+ * from the left run goes first, so the merge is stable.
+ */
+static void array_parallel_merge(const char *left, size_t left_length,
+	const char *right, size_t right_length, char *out, size_t element_size,
+	int (*cmp)(const void*, const void*)) {
+	while (left_length > 0 && right_length > 0) {
+		if (cmp(right, left) < 0) {
+			memcpy(out, right, element_size);
+			right += element_size;
+			right_length--;
+		} else {
+			memcpy(out, left, element_size);
+			left += element_size;
+			left_length--;
+		}
+		out += element_size;
+	}
+	memcpy(out, left, left_length * element_size);
+	out += left_length * element_size;
+	memcpy(out, right, right_length * element_size);
+}
+
+/*
+ * Stable merge sort of length elements at base, using scratch (which
+ * must have room for as many elements) as the other buffer. Short runs
+ * are insertion sorted first, then merged bottom-up.
+ */
+static void array_parallel_merge_sort(char *base, size_t length,
+	char *scratch, size_t element_size,
+	int (*cmp)(const void*, const void*)) {
+	char *source = base;
+	char *target = scratch;
+	size_t start, i, j, width;
+
+	/* The scratch buffer is free until merging, so it holds the key */
+	for (start = 0; start < length; start += ARRAY_PARALLEL_RUN) {
+		const size_t end = start + ARRAY_PARALLEL_RUN < length ?
+			start + ARRAY_PARALLEL_RUN : length;
+		for (i = start + 1; i < end; i++) {
+			memcpy(scratch, base + i * element_size, element_size);
+			for (j = i; j > start &&
+				cmp(scratch, base + (j - 1) * element_size) < 0; j--) {
+			}
+			memmove(base + (j + 1) * element_size, base + j * element_size,
+				(i - j) * element_size);
+			memcpy(base + j * element_size, scratch, element_size);
+		}
+	}
+
+	for (width = ARRAY_PARALLEL_RUN; width < length; width *= 2) {
+		char *temp;
+		for (start = 0; start < length; start += 2 * width) {
+			const size_t middle = start + width < length ?
+				start + width : length;
+			const size_t end = middle + width < length ?
+				middle + width : length;
+			array_parallel_merge(source + start * element_size,
+				middle - start, source + middle * element_size,
+				end - middle, target + start * element_size,
+				element_size, cmp);
+		}
+		temp = source;
+		source = target;
+		target = temp;
+	}
+
+	if (source != base) {
+		memcpy(base, source, length * element_size);
+	}
+}
+
+static void array_parallel_sort_chunk(struct ArraySortTask *task) {
+	if (task->stable) {
+		array_parallel_merge_sort(task->base, task->length, task->scratch,
+			task->element_size, task->cmp);
+	} else if (task->element_size == sizeof(void*)) {
+		struct ArrayParallelCompare context;
+		context.cmp = task->cmp;
+		array_parallel_sort_pointers_range((void**) task->base,
+			task->length, &context);
+	} else {
+		qsort(task->base, task->length, task->element_size, task->cmp);
+	}
+}
+
+static void array_parallel_merge_task(struct ArraySortTask *task) {
+	array_parallel_merge(task->left, task->left_length, task->right,
+		task->right_length, task->out, task->element_size, task->cmp);
+}
+
+/*
+ * Find how many of the first d elements of the merge of the sorted runs
+ * a (of length m) and b (of length n) come from a. Lets a merge be split
+ * into parts that can be done independently, while staying stable.
+ */
+static size_t array_parallel_corank(size_t d, const char *a, size_t m,
+	const char *b, size_t n, size_t element_size,
+	int (*cmp)(const void*, const void*)) {
+	size_t low = d > n ? d - n : 0;
+	size_t high = d < m ? d : m;
+
+	while (low < high) {
+		const size_t i = low + (high - low + 1) / 2;
+		/* a[i - 1] goes first unless b[d - i] is strictly smaller */
+		if (cmp(b + (d - i) * element_size, a + (i - 1) * element_size) >= 0) {
+			low = i;
+		} else {
+			high = i - 1;
+		}
+	}
+
+	return low;
+}
+
+/*
+ * The chunks of a pass that one thread starts with. Any thread can take
+ * the next one, which is how threads that run out steal from the others.
+ * Padded to a cache line of its own, as it is updated constantly.
+ */
+struct ArrayPoolQueue {
+	size_t next;
+	size_t end;
+	ArrayPool *pool;
+	char padding[ARRAY_PARALLEL_CACHE_LINE - 2 * sizeof(size_t) -
+		sizeof(ArrayPool*)];
+};
+
+/*
+ * A pass over the elements of an array, run one chunk at a time. Each
+ * kind of pass uses the fields it needs.
+ */
+struct ArrayPoolJob {
+	void (*run)(struct ArrayPoolJob *job, size_t chunk);
+	char *elements;
+	size_t length;
+	size_t element_size;
+	size_t chunk_length;
+	char *out;
+	size_t out_size;
+	unsigned char *flags;
+	size_t *counts;
+	void (*each)(void*, void*);
+	void (*map)(const void*, void*, void*);
+	int (*pred)(const void*, void*);
+	void (*fold)(void*, const void*, void*);
+	void *context;
+	struct ArraySortTask *tasks;
+};
+
+/*
+ * The threads wait for a new generation of work, then go through the
+ * queues, starting with their own. The last queue belongs to the thread
+ * that started the pass, which is the owner while the job is set.
+ */
+struct ArrayPool {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	pthread_mutex_t pass;
+	struct ArrayPoolQueue *queues;
+	pthread_t *threads;
+	int workers;
+	struct ArrayPoolJob *job;
+	pthread_t owner;
+	unsigned long generation;
+	int busy;
+	int stop;
+};
+
+/* Run chunks from all queues of the pool until none are left */
+static void array_pool_work(ArrayPool *pool, struct ArrayPoolJob *job,
+	size_t self) {
+	const size_t count = (size_t) pool->workers + 1;
+	size_t i, chunk;
+
+	for (i = 0; i < count; i++) {
+		struct ArrayPoolQueue *queue = &pool->queues[(self + i) % count];
+		while ((chunk = __atomic_fetch_add(&queue->next, 1,
+			__ATOMIC_RELAXED)) < queue->end) {
+			job->run(job, chunk);
+		}
+	}
+}
+
+static void *array_pool_thread(void *argument) {
+	struct ArrayPoolQueue *queue = argument;
+	ArrayPool *pool = queue->pool;
+	unsigned long generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		struct ArrayPoolJob *job;
+
+		while (pool->generation == generation && !pool->stop) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if (pool->stop) {
+			break;
+		}
+		generation = pool->generation;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		array_pool_work(pool, job, (size_t) (queue - pool->queues));
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0) {
+			pthread_cond_signal(&pool->idle);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+ArrayPool *array_pool_create(int threads) {
+	ArrayPool *pool;
+	int i;
+
+	if (threads <= 0) {
+		const long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (int) online : 1;
+	}
+
+	pool = malloc(sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	pool->queues = malloc(sizeof(*pool->queues) * (size_t) threads);
+	pool->threads = malloc(sizeof(*pool->threads) * (size_t) threads);
+	if (pool->queues == NULL || pool->threads == NULL) {
+		free(pool->queues);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pthread_mutex_init(&pool->pass, NULL);
+	pool->workers = 0;
+	pool->job = NULL;
+	pool->generation = 0;
+	pool->busy = 0;
+	pool->stop = 0;
+
+	for (i = 0; i < threads; i++) {
+		pool->queues[i].next = 0;
+		pool->queues[i].end = 0;
+		pool->queues[i].pool = pool;
+	}
+
+	/* Queues are handed out in order, so they stay packed if one fails */
+	for (i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool->threads[i], NULL, array_pool_thread,
+			&pool->queues[i]) != 0) {
+			break;
+		}
+		pool->workers++;
+	}
+
+	return pool;
+}
+
+void array_pool_free(ArrayPool *pool) {
+	int i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->workers; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->idle);
+	pthread_mutex_destroy(&pool->pass);
+	free(pool->queues);
+	free(pool->threads);
+	free(pool);
+}
+
+/*
+ * Whether the calling thread is working on a pass of the pool, which
+ * means it was called back from that pass
+ */
+static int array_pool_is_working(ArrayPool *pool) {
+	const pthread_t self = pthread_self();
+	int i, working;
+
+	for (i = 0; i < pool->workers; i++) {
+		if (pthread_equal(pool->threads[i], self)) {
+			return 1;
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	working = pool->job != NULL && pthread_equal(pool->owner, self);
+	pthread_mutex_unlock(&pool->lock);
+
+	return working;
+}
+
+/*
+ * Run the given number of chunks of the job, on the threads of the pool
+ * if there is one, and return once all are done. A pass started from a
+ * callback of another pass would wait for that one forever, so it runs
+ * on the calling thread instead.
+ */
+static void array_pool_run_chunks(ArrayPool *pool, struct ArrayPoolJob *job,
+	size_t chunks) {
+	size_t count, i;
+
+	if (pool == NULL || pool->workers == 0 || chunks < 2 ||
+		array_pool_is_working(pool)) {
+		for (i = 0; i < chunks; i++) {
+			job->run(job, i);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->pass);
+
+	/* Every thread starts with an equal share of the chunks */
+	count = (size_t) pool->workers + 1;
+	for (i = 0; i < count; i++) {
+		pool->queues[i].next = chunks * i / count;
+		pool->queues[i].end = chunks * (i + 1) / count;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->owner = pthread_self();
+	pool->generation++;
+	pool->busy = pool->workers;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	array_pool_work(pool, job, count - 1);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0) {
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	}
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_mutex_unlock(&pool->pass);
+}
+
+/* Run every chunk of the job, on the pool only if the job is long enough */
+static void array_pool_run(ArrayPool *pool, struct ArrayPoolJob *job) {
+	const size_t chunks = (job->length + job->chunk_length - 1) /
+		job->chunk_length;
+
+	array_pool_run_chunks(job->length < ARRAY_PARALLEL_THRESHOLD ? NULL :
+		pool, job, chunks);
+}
+
+/* Each chunk of a sorting pass is one of its tasks */
+static void array_parallel_task_chunk(struct ArrayPoolJob *job,
+	size_t chunk) {
+	job->tasks[chunk].run(&job->tasks[chunk]);
+}
+
+/* Run the given tasks concurrently on the pool */
+static void array_parallel_run(ArrayPool *pool, struct ArraySortTask *tasks,
+	size_t count) {
+	struct ArrayPoolJob job;
+
+	memset(&job, 0, sizeof(job));
+	job.run = array_parallel_task_chunk;
+	job.tasks = tasks;
+	array_pool_run_chunks(pool, &job, count);
+}
+
+int array_sort_pool(ArrayPool *pool, Array *array,
+	int (*cmp)(const void*, const void*), int stable) {
+	const ArrayAllocator *allocator;
+	struct ArraySortTask *tasks;
+	size_t *runs;
+	char *base, *scratch, *source, *target, *temp;
+	size_t length, element_size, chunks, run_count, task_count, i;
+
+	if (array == NULL || cmp == NULL) {
+		return 0;
+	}
+
+	length = array->length;
+	element_size = array->element_size;
+
+	if (length < 2) {
+		return 1;
+	}
+
+	/* The chunks are sorted in place through the span */
+	if (!array_unshare(array)) {
+		return 0;
+	}
+
+	chunks = 1;
+	if (pool != NULL && length >= ARRAY_PARALLEL_THRESHOLD) {
+		chunks = (size_t) pool->workers + 1;
+	}
+
+	if (chunks == 1 && !stable) {
+		array_sort(array, cmp);
+		return 1;
+	}
+
+	/*
+	 * One chunk per thread. Each round of merging needs at most one task
+	 * per thread plus one per pair of runs, since every merge is split in
+	 * proportion to its share of the array.
+	 */
+	allocator = array->allocator;
+	scratch = allocator->allocate(allocator->context, length * element_size);
+	tasks = malloc(sizeof(*tasks) * 2 * chunks);
+	runs = malloc(sizeof(*runs) * (chunks + 1));
+
+	if (scratch == NULL || tasks == NULL || runs == NULL) {
+		if (scratch != NULL) {
+			allocator->deallocate(allocator->context, scratch,
+				length * element_size);
+		}
+		free(tasks);
+		free(runs);
+		return 0;
+	}
+
+	/* The span is contiguous, even for a gap buffer */
+	base = (char*) array_span(array).elements;
+
+	/* Sort the chunks, each using its own part of the scratch buffer */
+	for (i = 0; i < chunks; i++) {
+		const size_t start = length * i / chunks;
+		const size_t end = length * (i + 1) / chunks;
+		tasks[i].run = array_parallel_sort_chunk;
+		tasks[i].base = base + start * element_size;
+		tasks[i].length = end - start;
+		tasks[i].scratch = scratch + start * element_size;
+		tasks[i].element_size = element_size;
+		tasks[i].cmp = cmp;
+		tasks[i].stable = stable;
+		runs[i] = start;
+	}
+	runs[chunks] = length;
+	run_count = chunks;
+	array_parallel_run(pool, tasks, chunks);
+	/* Merge pairs of runs until only one is left */
+	source = base;
+	target = scratch;
+	while (run_count > 1) {
+		size_t pair;
+		task_count = 0;
+
+		for (pair = 0; pair < run_count; pair += 2) {
+			/* A lone run at the end is merged with an empty one */
+			const size_t start = runs[pair];
+			const size_t middle = runs[pair + 1];
+			const size_t end = pair + 2 <= run_count ?
+				runs[pair + 2] : middle;
+			const char *left = source + start * element_size;
+			const char *right = source + middle * element_size;
+			const size_t left_length = middle - start;
+			const size_t right_length = end - middle;
+			size_t parts = chunks * (end - start) / length;
+			size_t part, previous = 0;
+
+			if (parts == 0) {
+				parts = 1;
+			}
+
+			/* Split the output evenly, and the runs to match */
+			for (part = 1; part <= parts; part++) {
+				const size_t d = (end - start) * part / parts;
+				const size_t from_left = d == end - start ? left_length :
+					array_parallel_corank(d, left, left_length, right,
+						right_length, element_size, cmp);
+				const size_t from_right = d - from_left;
+				const size_t prev_right = (end - start) * (part - 1) / parts -
+					previous;
+				struct ArraySortTask *task = &tasks[task_count++];
+
+				task->run = array_parallel_merge_task;
+				task->left = left + previous * element_size;
+				task->left_length = from_left - previous;
+				task->right = right + prev_right * element_size;
+				task->right_length = from_right - prev_right;
+				task->out = target + (start + previous + prev_right) *
+					element_size;
+				task->element_size = element_size;
+				task->cmp = cmp;
+				previous = from_left;
+			}
+		}
+
+		array_parallel_run(pool, tasks, task_count);
+
+		/* Every merged pair becomes a single run */
+		for (i = 0; 2 * i < run_count; i++) {
+			runs[i] = runs[2 * i];
+		}
+		runs[i] = length;
+		run_count = i;
+		temp = source;
+		source = target;
+		target = temp;
+	}
+
+	if (source != base) {
+		memcpy(base, source, length * element_size);
+	}
+
+	allocator->deallocate(allocator->context, scratch, length * element_size);
+	free(tasks);
+	free(runs);
+
+	return 1;
+}
+
+
+int array_sort_parallel(Array *array, int (*cmp)(const void*, const void*),
+	int threads, int stable) {
+	ArrayPool *pool = NULL;
+	int sorted;
+
+	if (array == NULL || cmp == NULL) {
+		return 0;
+	}
+
+	/* Threads are only started for arrays long enough to use them */
+	if (array->length >= ARRAY_PARALLEL_THRESHOLD) {
+		pool = array_pool_create(threads);
+		if (pool == NULL) {
+			return 0;
+		}
+	}
+
+	sorted = array_sort_pool(pool, array, cmp, stable);
+	array_pool_free(pool);
+
+	return sorted;
+}
+
+/* Number of elements of the given size that fill whole cache lines */
+static size_t array_parallel_line_length(size_t element_size) {
+	size_t a = ARRAY_PARALLEL_CACHE_LINE, b = element_size;
+
+	/* Divide the line by its greatest common divisor with the size */
+	while (b != 0) {
+		const size_t r = a % b;
+		a = b;
+		b = r;
+	}
+
+	return ARRAY_PARALLEL_CACHE_LINE / a;
+}
+
+/*
+ * Set up a pass over the elements of the array. Chunks span whole cache
+ * lines of both the elements and the output, if there is any.
+ */
+static void array_parallel_job(struct ArrayPoolJob *job, Array *array,
+	size_t out_size) {
+	size_t unit = array_parallel_line_length(array->element_size);
+
+	if (out_size > 0 && array_parallel_line_length(out_size) > unit) {
+		unit = array_parallel_line_length(out_size);
+	}
+
+	memset(job, 0, sizeof(*job));
+	/* The span is contiguous, even for a gap buffer */
+	job->elements = (char*) array_span(array).elements;
+	job->length = array->length;
+	job->element_size = array->element_size;
+	job->out_size = out_size;
+	job->chunk_length = ARRAY_PARALLEL_CHUNK_SIZE / array->element_size /
+		unit * unit;
+	if (job->chunk_length == 0) {
+		job->chunk_length = unit;
+	}
+}
+
+/* Find the first element of the given chunk and the number of elements */
+static size_t array_parallel_chunk(struct ArrayPoolJob *job, size_t chunk,
+	size_t *start) {
+	*start = chunk * job->chunk_length;
+	return job->length - *start < job->chunk_length ?
+		job->length - *start : job->chunk_length;
+}
+
+/*
+ * Empty dst and make room for length elements at its front, keeping its
+ * contents if that fails. Returns 1 if successful, 0 otherwise.
+ */
+static int array_parallel_output(Array *dst, size_t length) {
+	if (!array64_reserve(dst, length)) {
+		return 0;
+	}
+	array_span(dst);
+	dst->length = 0;
+	return 1;
+}
+
+static void array_parallel_for_chunk(struct ArrayPoolJob *job,
+	size_t chunk) {
+	size_t start, i;
+	const size_t count = array_parallel_chunk(job, chunk, &start);
+	char *element = job->elements + start * job->element_size;
+
+	for (i = 0; i < count; i++, element += job->element_size) {
+		job->each(element, job->context);
+	}
+}
+
+int array_parallel_for(ArrayPool *pool, Array *array,
+	void (*fn)(void *element, void *context), void *context) {
+	struct ArrayPoolJob job;
+
+	if (array == NULL || fn == NULL || !array_unshare(array)) {
+		return 0;
+	}
+
+	array_parallel_job(&job, array, 0);
+	job.run = array_parallel_for_chunk;
+	job.each = fn;
+	job.context = context;
+	array_pool_run(pool, &job);
+
+	return 1;
+}
+
+static void array_parallel_map_chunk(struct ArrayPoolJob *job,
+	size_t chunk) {
+	size_t start, i;
+	const size_t count = array_parallel_chunk(job, chunk, &start);
+	const char *element = job->elements + start * job->element_size;
+	char *out = job->out + start * job->out_size;
+
+	for (i = 0; i < count; i++) {
+		job->map(element, out, job->context);
+		element += job->element_size;
+		out += job->out_size;
+	}
+}
+
+int array_map(ArrayPool *pool, Array *dst, Array *src,
+	void (*fn)(const void *element, void *out, void *context),
+	void *context) {
+	struct ArrayPoolJob job;
+
+	if (dst == NULL || src == NULL || dst == src || fn == NULL ||
+		!array_parallel_output(dst, src->length)) {
+		return 0;
+	}
+
+	array_parallel_job(&job, src, dst->element_size);
+	job.run = array_parallel_map_chunk;
+	job.out = dst->elements;
+	job.map = fn;
+	job.context = context;
+	array_pool_run(pool, &job);
+	dst->length = src->length;
+
+	return 1;
+}
+
+/* Mark the elements of the chunk to keep, and count them */
+static void array_parallel_mark_chunk(struct ArrayPoolJob *job,
+	size_t chunk) {
+	size_t start, i, kept = 0;
+	const size_t count = array_parallel_chunk(job, chunk, &start);
+	const char *element = job->elements + start * job->element_size;
+
+	for (i = 0; i < count; i++, element += job->element_size) {
+		const int keep = job->pred(element, job->context) != 0;
+		job->flags[start + i] = (unsigned char) keep;
+		kept += (size_t) keep;
+	}
+
+	job->counts[chunk] = kept;
+}
+
+/* Copy the marked elements of the chunk to where its counts put them */
+static void array_parallel_compact_chunk(struct ArrayPoolJob *job,
+	size_t chunk) {
+	size_t start, i;
+	const size_t count = array_parallel_chunk(job, chunk, &start);
+	const char *element = job->elements + start * job->element_size;
+	char *out = job->out + job->counts[chunk] * job->element_size;
+
+	for (i = 0; i < count; i++, element += job->element_size) {
+		if (job->flags[start + i]) {
+			memcpy(out, element, job->element_size);
+			out += job->element_size;
+		}
+	}
+}
+
+int array_filter_into(ArrayPool *pool, Array *dst, Array *src,
+	int (*pred)(const void *element, void *context), void *context) {
+	struct ArrayPoolJob job;
+	size_t chunks, total, i;
+
+	if (dst == NULL || src == NULL || dst == src || pred == NULL ||
+		dst->element_size != src->element_size) {
+		return 0;
+	}
+
+	array_parallel_job(&job, src, 1);
+	chunks = (job.length + job.chunk_length - 1) / job.chunk_length;
+	job.flags = malloc(job.length > 0 ? job.length : 1);
+	job.counts = malloc(sizeof(*job.counts) * (chunks > 0 ? chunks : 1));
+
+	if (job.flags == NULL || job.counts == NULL) {
+		free(job.flags);
+		free(job.counts);
+		return 0;
+	}
+
+	job.run = array_parallel_mark_chunk;
+	job.pred = pred;
+	job.context = context;
+	array_pool_run(pool, &job);
+
+	/* Turn the counts into the position of the first element of each chunk */
+	total = 0;
+	for (i = 0; i < chunks; i++) {
+		const size_t kept = job.counts[i];
+		job.counts[i] = total;
+		total += kept;
+	}
+
+	if (!array_parallel_output(dst, total)) {
+		free(job.flags);
+		free(job.counts);
+		return 0;
+	}
+
+	job.run = array_parallel_compact_chunk;
+	job.out = dst->elements;
+	array_pool_run(pool, &job);
+	dst->length = total;
+
+	free(job.flags);
+	free(job.counts);
+
+	return 1;
+}
+
+static void array_parallel_reduce_chunk(struct ArrayPoolJob *job,
+	size_t chunk) {
+	size_t start, i;
+	const size_t count = array_parallel_chunk(job, chunk, &start);
+	const char *element = job->elements + start * job->element_size;
+	char *partial = job->out + chunk * job->out_size;
+
+	for (i = 0; i < count; i++, element += job->element_size) {
+		job->fold(partial, element, job->context);
+	}
+}
+
+int array_reduce(ArrayPool *pool, Array *array, void *result,
+	size_t result_size,
+	void (*fn)(void *result, const void *element, void *context),
+	void (*combine)(void *result, const void *partial, void *context),
+	void *context) {
+	struct ArrayPoolJob job;
+	size_t chunks, stride, i;
+	char *block;
+
+	if (array == NULL || result == NULL || result_size == 0 || fn == NULL ||
+		combine == NULL || result_size > (size_t) -1 -
+			ARRAY_PARALLEL_CACHE_LINE) {
+		return 0;
+	}
+
+	array_parallel_job(&job, array, 0);
+	chunks = (job.length + job.chunk_length - 1) / job.chunk_length;
+
+	if (chunks == 0) {
+		return 1;
+	}
+
+	/* Every chunk has its own cache lines to fold into */
+	stride = (result_size + ARRAY_PARALLEL_CACHE_LINE - 1) /
+		ARRAY_PARALLEL_CACHE_LINE * ARRAY_PARALLEL_CACHE_LINE;
+	if (chunks > ((size_t) -1 - ARRAY_PARALLEL_CACHE_LINE) / stride) {
+		return 0;
+	}
+	block = malloc(chunks * stride + ARRAY_PARALLEL_CACHE_LINE);
+	if (block == NULL) {
+		return 0;
+	}
+	job.out = block + (ARRAY_PARALLEL_CACHE_LINE - (size_t) block %
+		ARRAY_PARALLEL_CACHE_LINE) % ARRAY_PARALLEL_CACHE_LINE;
+
+	/* Each one starts from the identity value */
+	for (i = 0; i < chunks; i++) {
+		memcpy(job.out + i * stride, result, result_size);
+	}
+
+	job.run = array_parallel_reduce_chunk;
+	job.out_size = stride;
+	job.fold = fn;
+	job.context = context;
+	array_pool_run(pool, &job);
+
+	for (i = 0; i < chunks; i++) {
+		combine(result, job.out + i * stride, context);
+	}
+
+	free(block);
+
+	return 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * Parallel operations on arrays, built on POSIX threads. Threads are
+ * only used for arrays large enough to be worth it; smaller arrays are
+ * handled on the calling thread.
+ *
+ * While one of these functions is running, the array must not be
+ * accessed from any other thread.
+ *
+ * Passes over the elements (array_parallel_for, array_map,
+ * array_filter_into and array_reduce) run on a pool of threads that is
+ * created once and reused. The elements are split into chunks spanning
+ * whole cache lines, so that threads writing neighboring chunks don't
+ * contend for the same line, and each thread starts with its share of
+ * the chunks. A thread that runs out takes chunks from the others, so
+ * uneven work keeps all of them busy. Callbacks run concurrently on
+ * different elements, and must be safe to call that way. They may start
+ * passes or sorts of their own, even on the pool they run on, in which
+ * case those run on the thread of the callback. Requires a compiler with
+ * the __atomic builtins (GCC 4.7 or Clang).
+ */
+
+#ifndef ARRAY_PARALLEL_H
+#define ARRAY_PARALLEL_H
+
+#include "array.h"
+
+/* Arrays shorter than this are sorted on the calling thread */
+#ifndef ARRAY_PARALLEL_THRESHOLD
+	#define ARRAY_PARALLEL_THRESHOLD 65536
+#endif
+
+/*
+ * Sort the array with the given comparison function (see array_sort)
+ * using up to the given number of threads, or one per online processor
+ * if threads is zero or negative. The array is split into one chunk per
+ * thread, the chunks are sorted concurrently and then merged pairwise.
+ * Every merge is split into independent parts as well, so all threads
+ * stay busy until the end. The threads are started once for the whole
+ * sort, in a pool of their own (see array_sort_pool), and the temporary
+ * buffer comes from the allocator of the array.
+ *
+ * If stable is nonzero, elements that compare equal keep their order.
+ * Returns 1 if successful, 0 if the arguments are invalid or temporary
+ * memory could not be allocated, in which case the array is left
+ * untouched.
+ */
+extern int array_sort_parallel(Array *array,
+	int (*cmp)(const void*, const void*), int threads, int stable);
+
+/* A pool of threads for the passes over elements below */
+typedef struct ArrayPool ArrayPool;
+
+/*
+ * Create a pool for running passes with up to the given number of
+ * threads, or one per online processor if threads is zero or negative.
+ * The calling thread counts as one of them, as it works on the pass as
+ * well, so a pool of one thread starts none. If some threads can't be
+ * started, the pool makes do with the others. Returns the new pool, or
+ * NULL if out of memory.
+ */
+extern ArrayPool *array_pool_create(int threads);
+
+/* Stop the threads of the pool and free it */
+extern void array_pool_free(ArrayPool *pool);
+
+/*
+ * Like array_sort_parallel, but on the threads of the given pool, with
+ * one chunk per thread. Every round of merging is a pass on the pool, so
+ * no threads are started. With a NULL pool, or for arrays shorter than
+ * ARRAY_PARALLEL_THRESHOLD, the array is sorted on the calling thread.
+ */
+extern int array_sort_pool(ArrayPool *pool, Array *array,
+	int (*cmp)(const void*, const void*), int stable);
+
+/*
+ * Call fn for every element of the array with a pointer to the element,
+ * which fn may modify, and the given context. The elements are visited
+ * in no particular order. A pool runs one pass at a time, so passes
+ * started from other threads wait for it. With a NULL pool, or for
+ * arrays shorter than ARRAY_PARALLEL_THRESHOLD, everything runs on the
+ * calling thread. Returns 1 if successful, 0 if the arguments are
+ * invalid.
+ */
+extern int array_parallel_for(ArrayPool *pool, Array *array,
+	void (*fn)(void *element, void *context), void *context);
+
+/*
+ * Replace the contents of dst with the result of calling fn for every
+ * element of src, which fn writes to out, an element of dst. The arrays
+ * may have different element sizes, but must not be the same array.
+ * Returns 1 if successful, 0 if the arguments are invalid or dst could
+ * not grow, in which case dst is left untouched.
+ */
+extern int array_map(ArrayPool *pool, Array *dst, Array *src,
+	void (*fn)(const void *element, void *out, void *context),
+	void *context);
+
+/*
+ * Replace the contents of dst with the elements of src for which pred
+ * returns nonzero, in the same order. Every thread first marks and
+ * counts the elements it keeps; the counts are summed up to give each
+ * chunk its place in dst, and the kept elements are then copied there
+ * in parallel. The arrays must have the same element size and must not
+ * be the same array (see array_retain for filtering in place). Returns
+ * 1 if successful, 0 if the arguments are invalid or we ran out of
+ * memory, in which case dst is left untouched.
+ */
+extern int array_filter_into(ArrayPool *pool, Array *dst, Array *src,
+	int (*pred)(const void *element, void *context), void *context);
+
+/*
+ * Reduce the elements of the array to a single value of result_size
+ * bytes, held in result. On entry, result must hold the identity value
+ * of the reduction, such as 0 for a sum. Every chunk starts from a copy
+ * of it and folds its elements in with fn, in order, and the results of
+ * the chunks are then folded into result with combine, in order as well.
+ * The chunks depend only on the length and the element size, so the
+ * result is the same whatever the number of threads, even for floating
+ * point sums, as long as combine is associative. Returns 1 if
+ * successful, 0 if the arguments are invalid or we ran out of memory.
+ */
+extern int array_reduce(ArrayPool *pool, Array *array, void *result,
+	size_t result_size,
+	void (*fn)(void *result, const void *element, void *context),
+	void (*combine)(void *result, const void *partial, void *context),
+	void *context);
+
+#endif /* ARRAY_PARALLEL_H */
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include "array_bucket.h"
+#include "array_segmented.h"
+
+/*
+ * The buckets (see array_bucket.h) are allocated in order, and the ones
+ * after the last element stay allocated until shrinking.
+ */
+struct SegmentedArray {
+	int length;
+	size_t element_size;
+	char *buckets[ARRAY_BUCKET_COUNT];
+};
+
+SegmentedArray *segmented_array_create(size_t element_size) {
+	SegmentedArray *array;
+	int i;
+
+	if (element_size == 0) {
+		return NULL;
+	}
+
+	array = malloc(sizeof(SegmentedArray));
+
+	if (array != NULL) {
+		array->length = 0;
+		array->element_size = element_size;
+		for (i = 0; i < ARRAY_BUCKET_COUNT; i++) {
+			array->buckets[i] = NULL;
+		}
+	}
+
+	return array;
+}
+
+void segmented_array_free(SegmentedArray *array) {
+	int i;
+
+	if (array != NULL) {
+		for (i = 0; i < ARRAY_BUCKET_COUNT; i++) {
+			free(array->buckets[i]);
+		}
+		free(array);
+	}
+}
+
+int segmented_array_length(SegmentedArray *array) {
+	if (array != NULL) {
+		return array->length;
+	}
+	return 0;
+}
+
+int segmented_array_push(SegmentedArray *array, const void *value) {
+	size_t offset;
+	int bucket;
+
+	if (array == NULL || value == NULL || array->length == INT_MAX) {
+		return 0;
+	}
+
+	bucket = array_bucket_locate((size_t) array->length, &offset);
+
+	if (array->buckets[bucket] == NULL) {
+		/* Large elements may make the bucket larger than memory */
+		if (ARRAY_BUCKET_LENGTH(bucket) >
+			(size_t) -1 / array->element_size) {
+			return 0;
+		}
+
+		/* The only allocation a push ever makes; nothing is copied */
+		array->buckets[bucket] =
+			malloc(ARRAY_BUCKET_LENGTH(bucket) * array->element_size);
+		if (array->buckets[bucket] == NULL) {
+			return 0; /* Out of memory */
+		}
+	}
+
+	memcpy(array->buckets[bucket] + offset * array->element_size, value,
+		array->element_size);
+	array->length++;
+
+	return 1;
+}
+
+int segmented_array_pop(SegmentedArray *array, void *out) {
+	if (array == NULL || array->length == 0) {
+		return 0;
+	}
+
+	if (out != NULL) {
+		memcpy(out, segmented_array_at(array, array->length - 1),
+			array->element_size);
+	}
+	array->length--;
+
+	return 1;
+}
+
+void *segmented_array_at(SegmentedArray *array, int index) {
+	size_t offset;
+	int bucket;
+
+	if (array != NULL && index >= 0 && index < array->length) {
+		bucket = array_bucket_locate((size_t) index, &offset);
+		return array->buckets[bucket] + offset * array->element_size;
+	}
+
+	return NULL;
+}
+
+int segmented_array_get(SegmentedArray *array, int index, void *out) {
+	const void *element = segmented_array_at(array, index);
+
+	if (element != NULL && out != NULL) {
+		memcpy(out, element, array->element_size);
+		return 1;
+	}
+
+	return 0;
+}
+
+int segmented_array_set(SegmentedArray *array, int index,
+	const void *value) {
+	void *element = segmented_array_at(array, index);
+
+	if (element != NULL && value != NULL) {
+		memcpy(element, value, array->element_size);
+		return 1;
+	}
+
+	return 0;
+}
+
+int segmented_array_shrink_to_fit(SegmentedArray *array) {
+	size_t offset;
+	int i;
+
+	if (array == NULL) {
+		return 0;
+	}
+
+	/* Keep every bucket up to and including the one of the last element */
+	i = array->length > 0 ?
+		array_bucket_locate((size_t) array->length - 1, &offset) + 1 : 0;
+
+	for (; i < ARRAY_BUCKET_COUNT; i++) {
+		free(array->buckets[i]);
+		array->buckets[i] = NULL;
+	}
+
+	return 1;
+}
+
+int segmented_array_foreach(SegmentedArray *array, int (*fn)(void*, void*),
+	void *context) {
+	int bucket, index = 0;
+
+	if (array == NULL || fn == NULL) {
+		return 0;
+	}
+
+	for (bucket = 0; index < array->length; bucket++) {
+		char *element = array->buckets[bucket];
+		size_t i, count = ARRAY_BUCKET_LENGTH(bucket);
+
+		if (count > (size_t) (array->length - index)) {
+			count = (size_t) (array->length - index);
+		}
+
+		for (i = 0; i < count; i++, index++) {
+			if (fn(element, context)) {
+				return index;
+			}
+			element += array->element_size;
+		}
+	}
+
+	return array->length;
+}
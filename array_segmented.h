@@ -0,0 +1,82 @@
+/*
+ * An array that stores its elements in buckets of doubling size instead
+ * of a single block. Growing allocates one new bucket and never copies
+ * existing elements, so the worst-case cost of a push is a single
+ * allocation, and the memory in use never has to double up temporarily.
+ * Elements never move, so pointers to them stay valid until they are
+ * popped. Look-up by index is still constant-time.
+ *
+ * Unlike Array, the elements are not contiguous as a whole (only within
+ * each bucket), so this type has its own, smaller interface. Elements
+ * can be added and removed at the end only.
+ */
+
+#ifndef ARRAY_SEGMENTED_H
+#define ARRAY_SEGMENTED_H
+
+#include <stddef.h>
+
+typedef struct SegmentedArray SegmentedArray;
+
+/*
+ * Allocate a new segmented array storing values of the given size.
+ * No buckets are allocated until the first push. Returns NULL if the
+ * element size is zero or we ran out of memory.
+ */
+extern SegmentedArray *segmented_array_create(size_t element_size);
+
+/*
+ * Free the array along with all its elements.
+ */
+extern void segmented_array_free(SegmentedArray *array);
+
+/*
+ * Get the length of the array.
+ * The length of a NULL array is zero.
+ */
+extern int segmented_array_length(SegmentedArray *array);
+
+/*
+ * Copy the value pointed to onto the end of the array, allocating a new
+ * bucket if the last one is full. Returns 1 if successful, 0 otherwise.
+ */
+extern int segmented_array_push(SegmentedArray *array, const void *value);
+
+/*
+ * Remove the last element, copying it into out unless out is NULL.
+ * Buckets are kept for reuse; see segmented_array_shrink_to_fit.
+ * Returns 1 if successful, 0 if the array is empty.
+ */
+extern int segmented_array_pop(SegmentedArray *array, void *out);
+
+/*
+ * Copy the element at the given index into out, or replace it with the
+ * value pointed to. Both return 1 if successful, 0 otherwise.
+ */
+extern int segmented_array_get(SegmentedArray *array, int index, void *out);
+extern int segmented_array_set(SegmentedArray *array, int index,
+	const void *value);
+
+/*
+ * Get a pointer to the element stored at the given index, or NULL if
+ * there is nothing in that index. The pointer stays valid until the
+ * element is popped or the array is freed.
+ */
+extern void *segmented_array_at(SegmentedArray *array, int index);
+
+/*
+ * Free the buckets that no longer hold any elements.
+ * Returns 1 if successful, 0 otherwise.
+ */
+extern int segmented_array_shrink_to_fit(SegmentedArray *array);
+
+/*
+ * Call fn for each element of the array in order, with a pointer to the
+ * element and the given context, one bucket at a time. Iteration stops
+ * early if fn returns nonzero. Returns the index of the element at which
+ * it stopped, or the length of the array if all elements were visited.
+ */
+extern int segmented_array_foreach(SegmentedArray *array,
+	int (*fn)(void*, void*), void *context);
+
+#endif /* ARRAY_SEGMENTED_H */
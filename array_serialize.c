@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <string.h>
+
+/* Loading reads the elements straight into the new array */
+#define ARRAY_IMPLEMENTATION
+#include "array_serialize.h"
+
+/* Identifies serialized arrays */
+#define ARRAY_SERIALIZE_MAGIC "ARRS"
+
+/* Bumped whenever the format changes */
+#define ARRAY_SERIALIZE_VERSION 1
+
+/*
+ * Magic, version, encoding and two reserved bytes, followed by the
+ * element size, the length and the size of the encoded elements as
+ * 64-bit little-endian integers
+ */
+#define ARRAY_SERIALIZE_HEADER_SIZE 32
+
+/* Encoded elements are written and read in chunks of this many bytes */
+#define ARRAY_SERIALIZE_BUFFER_SIZE 4096
+
+/* A variable-length integer takes at most this many bytes */
+#define ARRAY_SERIALIZE_VARINT_SIZE 10
+
+/* Collects small writes into larger ones */
+struct ArrayWriter {
+	size_t (*write)(const void*, size_t, void*);
+	void *context;
+	size_t used;
+	unsigned char buffer[ARRAY_SERIALIZE_BUFFER_SIZE];
+};
+
+/* Reads a known number of bytes in chunks */
+struct ArrayReader {
+	size_t (*read)(void*, size_t, void*);
+	void *context;
+	uint64_t remaining;
+	size_t position;
+	size_t end;
+	unsigned char buffer[ARRAY_SERIALIZE_BUFFER_SIZE];
+};
+
+static void array_serialize_put64(unsigned char *bytes, uint64_t value) {
+	int i;
+	for (i = 0; i < 8; i++) {
+		bytes[i] = (unsigned char) (value >> (8 * i));
+	}
+}
+
+static uint64_t array_serialize_get64(const unsigned char *bytes) {
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < 8; i++) {
+		value |= (uint64_t) bytes[i] << (8 * i);
+	}
+	return value;
+}
+
+/* Load a signed integer element of the given size, sign-extended */
+static uint64_t array_serialize_load(const char *element, size_t size) {
+	switch (size) {
+		case 1: {
+			int8_t value;
+			memcpy(&value, element, sizeof(value));
+			return (uint64_t) (int64_t) value;
+		}
+		case 2: {
+			int16_t value;
+			memcpy(&value, element, sizeof(value));
+			return (uint64_t) (int64_t) value;
+		}
+		case 4: {
+			int32_t value;
+			memcpy(&value, element, sizeof(value));
+			return (uint64_t) (int64_t) value;
+		}
+		default: {
+			int64_t value;
+			memcpy(&value, element, sizeof(value));
+			return (uint64_t) value;
+		}
+	}
+}
+
+/* Store the low bytes of the given value as an element of the given size */
+static void array_serialize_store(char *element, size_t size,
+	uint64_t value) {
+	switch (size) {
+		case 1: {
+			uint8_t truncated = (uint8_t) value;
+			memcpy(element, &truncated, sizeof(truncated));
+			break;
+		}
+		case 2: {
+			uint16_t truncated = (uint16_t) value;
+			memcpy(element, &truncated, sizeof(truncated));
+			break;
+		}
+		case 4: {
+			uint32_t truncated = (uint32_t) value;
+			memcpy(element, &truncated, sizeof(truncated));
+			break;
+		}
+		default:
+			memcpy(element, &value, sizeof(value));
+			break;
+	}
+}
+
+/*
+ * Map the difference between two elements to an unsigned integer that is
+ * small when the difference is small in either direction (zigzag).
+ */
+static uint64_t array_serialize_delta(uint64_t value, uint64_t previous) {
+	const uint64_t delta = value - previous;
+	return (delta << 1) ^ (0 - (delta >> 63));
+}
+
+/* Number of bytes taken by the variable-length encoding of the value */
+static size_t array_serialize_varint_size(uint64_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+/* Size of the elements of the array in the given encoding */
+static uint64_t array_serialize_payload_size(Array *array, int encoding) {
+	uint64_t size = 0, previous = 0, value;
+	size_t i;
+
+	if (encoding == ARRAY_ENCODING_RAW) {
+		return (uint64_t) array->length * array->element_size;
+	}
+
+	for (i = 0; i < array->length; i++) {
+		value = array_serialize_load(array->elements +
+			i * array->element_size, array->element_size);
+		size += array_serialize_varint_size(
+			array_serialize_delta(value, previous));
+		previous = value;
+	}
+
+	return size;
+}
+
+static int array_writer_flush(struct ArrayWriter *writer) {
+	const size_t used = writer->used;
+	writer->used = 0;
+	return used == 0 ||
+		writer->write(writer->buffer, used, writer->context) == used;
+}
+
+static int array_serialize_deltas(Array *array, struct ArrayWriter *writer) {
+	uint64_t previous = 0, value, encoded;
+	size_t i;
+
+	for (i = 0; i < array->length; i++) {
+		if (writer->used > sizeof(writer->buffer) -
+			ARRAY_SERIALIZE_VARINT_SIZE && !array_writer_flush(writer)) {
+			return 0;
+		}
+
+		value = array_serialize_load(array->elements +
+			i * array->element_size, array->element_size);
+		encoded = array_serialize_delta(value, previous);
+		previous = value;
+
+		/* Seven bits at a time, with the high bit set on all but the last */
+		while (encoded >= 0x80) {
+			writer->buffer[writer->used++] =
+				(unsigned char) ((encoded & 0x7f) | 0x80);
+			encoded >>= 7;
+		}
+		writer->buffer[writer->used++] = (unsigned char) encoded;
+	}
+
+	return array_writer_flush(writer);
+}
+
+int array_serialize(Array *array,
+	size_t (*write)(const void *data, size_t size, void *context),
+	void *context, int encoding) {
+	struct ArrayWriter writer;
+	const size_t size = array != NULL ? array->element_size : 0;
+
+	if (array == NULL || write == NULL || (encoding != ARRAY_ENCODING_RAW &&
+		(encoding != ARRAY_ENCODING_DELTA ||
+			(size != 1 && size != 2 && size != 4 && size != 8)))) {
+		return 0;
+	}
+
+	/* The elements are read in one piece, so close any gap */
+	array_span(array);
+
+	writer.write = write;
+	writer.context = context;
+	writer.used = ARRAY_SERIALIZE_HEADER_SIZE;
+	memset(writer.buffer, 0, ARRAY_SERIALIZE_HEADER_SIZE);
+	memcpy(writer.buffer, ARRAY_SERIALIZE_MAGIC, 4);
+	writer.buffer[4] = ARRAY_SERIALIZE_VERSION;
+	writer.buffer[5] = (unsigned char) encoding;
+	array_serialize_put64(writer.buffer + 8, size);
+	array_serialize_put64(writer.buffer + 16, (uint64_t) array->length);
+	array_serialize_put64(writer.buffer + 24,
+		array_serialize_payload_size(array, encoding));
+
+	if (encoding == ARRAY_ENCODING_DELTA) {
+		return array_serialize_deltas(array, &writer);
+	}
+
+	/* Raw elements go to the sink straight from the array */
+	return array_writer_flush(&writer) && (array->length == 0 ||
+		write(array->elements, array->length * size, context) ==
+			array->length * size);
+}
+
+/* Get the next byte of the encoded elements. Returns 0 at the end. */
+static int array_reader_byte(struct ArrayReader *reader,
+	unsigned char *byte) {
+	if (reader->position == reader->end) {
+		size_t chunk = sizeof(reader->buffer);
+
+		if (reader->remaining < chunk) {
+			chunk = (size_t) reader->remaining;
+		}
+
+		if (chunk == 0 ||
+			reader->read(reader->buffer, chunk, reader->context) != chunk) {
+			return 0;
+		}
+
+		reader->remaining -= chunk;
+		reader->position = 0;
+		reader->end = chunk;
+	}
+
+	*byte = reader->buffer[reader->position++];
+	return 1;
+}
+
+static int array_deserialize_deltas(Array *array, size_t length,
+	struct ArrayReader *reader) {
+	uint64_t previous = 0, encoded;
+	unsigned char byte;
+	size_t i;
+	int shift;
+
+	for (i = 0; i < length; i++) {
+		encoded = 0;
+		shift = 0;
+
+		do {
+			if (shift > 63 || !array_reader_byte(reader, &byte)) {
+				return 0;
+			}
+			encoded |= (uint64_t) (byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+
+		previous += (encoded >> 1) ^ (0 - (encoded & 1));
+		array_serialize_store(array->elements + i * array->element_size,
+			array->element_size, previous);
+	}
+
+	/* Every byte must have been used up */
+	return reader->position == reader->end && reader->remaining == 0;
+}
+
+Array *array_deserialize(
+	size_t (*read)(void *data, size_t size, void *context),
+	void *context, const ArrayAllocator *allocator) {
+	unsigned char header[ARRAY_SERIALIZE_HEADER_SIZE];
+	struct ArrayReader reader;
+	uint64_t element_size, length, payload_size;
+	Array *array;
+	int encoding, valid;
+
+	if (read == NULL ||
+		read(header, sizeof(header), context) != sizeof(header) ||
+		memcmp(header, ARRAY_SERIALIZE_MAGIC, 4) != 0 ||
+		header[4] != ARRAY_SERIALIZE_VERSION) {
+		return NULL;
+	}
+
+	encoding = header[5];
+	element_size = array_serialize_get64(header + 8);
+	length = array_serialize_get64(header + 16);
+	payload_size = array_serialize_get64(header + 24);
+
+	if (element_size == 0 || element_size > (size_t) -1) {
+		return NULL;
+	}
+
+	/* The elements must fit in memory, which bounds the length as well */
+	if (encoding == ARRAY_ENCODING_RAW) {
+		valid = (length == 0 || element_size <= (size_t) -1 / length) &&
+			payload_size == length * element_size;
+	} else if (encoding == ARRAY_ENCODING_DELTA) {
+		valid = (element_size == 1 || element_size == 2 ||
+			element_size == 4 || element_size == 8) &&
+			length <= (size_t) -1 / element_size &&
+			payload_size >= length &&
+			payload_size <= length * ARRAY_SERIALIZE_VARINT_SIZE;
+	} else {
+		valid = 0;
+	}
+
+	if (!valid) {
+		return NULL;
+	}
+
+	/* The only allocation of elements, sized exactly */
+	array = array_create_ex(allocator, (size_t) element_size, 0);
+
+	if (array == NULL) {
+		return NULL;
+	}
+
+	if (!array64_reserve(array, (size_t) length)) {
+		array_free(array);
+		return NULL;
+	}
+
+	if (encoding == ARRAY_ENCODING_RAW) {
+		valid = length == 0 || read(array->elements, (size_t) payload_size,
+			context) == (size_t) payload_size;
+	} else {
+		reader.read = read;
+		reader.context = context;
+		reader.remaining = payload_size;
+		reader.position = 0;
+		reader.end = 0;
+		valid = array_deserialize_deltas(array, (size_t) length, &reader);
+	}
+
+	if (!valid) {
+		array_free(array);
+		return NULL;
+	}
+
+	array->length = (size_t) length;
+	return array;
+}
+
+static size_t array_stream_write(const void *data, size_t size,
+	void *context) {
+	return fwrite(data, 1, size, (FILE*) context);
+}
+
+static size_t array_stream_read(void *data, size_t size, void *context) {
+	return fread(data, 1, size, (FILE*) context);
+}
+
+int array_serialize_file(Array *array, FILE *stream, int encoding) {
+	if (stream == NULL) {
+		return 0;
+	}
+	return array_serialize(array, array_stream_write, stream, encoding);
+}
+
+Array *array_deserialize_file(FILE *stream) {
+	if (stream == NULL) {
+		return NULL;
+	}
+	return array_deserialize(array_stream_read, stream, NULL);
+}
@@ -0,0 +1,62 @@
+/*
+ * Saving arrays to, and loading them from, a stream of bytes. The stream
+ * is written and read through callbacks, so it can be a file, a socket
+ * or a memory buffer; wrappers for stdio streams are included.
+ *
+ * The format starts with a versioned header holding the encoding, the
+ * element size and the length, stored in little-endian byte order. It
+ * is followed by the elements, either as raw bytes or, for arrays of
+ * integers, as variable-length differences between consecutive elements,
+ * which makes sorted arrays much smaller. Either way, the elements
+ * themselves are read and written in native byte order.
+ */
+
+#ifndef ARRAY_SERIALIZE_H
+#define ARRAY_SERIALIZE_H
+
+#include <stdio.h>
+#include "array.h"
+
+/* The elements are stored byte for byte */
+#define ARRAY_ENCODING_RAW 0
+
+/*
+ * The elements are signed integers of 1, 2, 4 or 8 bytes, and each one
+ * is stored as a variable-length difference from the previous one. Any
+ * array of integers round-trips exactly, but sorted arrays with small
+ * gaps compress best.
+ */
+#define ARRAY_ENCODING_DELTA 1
+
+/*
+ * Write the array to the given sink, which must write all of the size
+ * bytes of data it is given and return size, or return anything else on
+ * failure. Raw elements are passed to the sink directly from the array,
+ * in a single call. Returns 1 if successful, 0 if the arguments are
+ * invalid (including an element size the encoding doesn't support) or
+ * the sink failed.
+ */
+extern int array_serialize(Array *array,
+	size_t (*write)(const void *data, size_t size, void *context),
+	void *context, int encoding);
+
+/*
+ * Read an array written by array_serialize from the given source, which
+ * must fill in size bytes and return size, or return anything else if
+ * it can't. The elements are allocated only once, with exactly the
+ * stored length as the capacity, using the given allocator (or the
+ * default one if allocator is NULL). Returns the new array, or NULL if
+ * the data is invalid or truncated, or if we ran out of memory.
+ */
+extern Array *array_deserialize(
+	size_t (*read)(void *data, size_t size, void *context),
+	void *context, const ArrayAllocator *allocator);
+
+/*
+ * Write the array to, or read one from, the given stdio stream, opened
+ * in binary mode. Work like array_serialize and array_deserialize.
+ */
+extern int array_serialize_file(Array *array, FILE *stream, int encoding);
+extern Array *array_deserialize_file(FILE *stream);
+
+#endif /* ARRAY_SERIALIZE_H */
@@ -0,0 +1,925 @@
+#include <string.h>
+#include "array_simd.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	#define ARRAY_SIMD_X86
+	#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+	#define ARRAY_SIMD_LOAD(level) __atomic_load_n(&(level), __ATOMIC_RELAXED)
+	#define ARRAY_SIMD_STORE(level, value) \
+		__atomic_store_n(&(level), (value), __ATOMIC_RELAXED)
+#else
+	#define ARRAY_SIMD_LOAD(level) (level)
+	#define ARRAY_SIMD_STORE(level, value) ((level) = (value))
+#endif
+
+/* Number of partial sums, which is the width of the widest kernel */
+#define ARRAY_SIMD_SUMS 16
+
+/* Filling copies a block of elements of about this many bytes over and over */
+#define ARRAY_SIMD_FILL_BLOCK 4096
+
+/* Instruction set in use, or -1 until the first call picks one */
+static int array_simd_current = -1;
+
+/* Size of the elements of each type */
+static const size_t array_simd_sizes[] = {
+	sizeof(int32_t),
+	sizeof(int64_t),
+	sizeof(float),
+	sizeof(double)
+};
+
+/*
+ * Plain C kernels, which the others must match exactly. Integer sums
+ * are done in unsigned arithmetic, which wraps around instead of
+ * overflowing. Sums go through the same partial sums as the vector
+ * kernels, so that floating point results match.
+ */
+#define ARRAY_SCALAR_KERNELS(suffix, type, sum_type, result_type) \
+	static size_t array_find_scalar_##suffix(const void *elements, \
+		size_t n, const void *value) { \
+		const type *p = elements; \
+		type key; \
+		size_t i; \
+		memcpy(&key, value, sizeof(key)); \
+		for (i = 0; i < n && !(p[i] == key); i++) { \
+		} \
+		return i; \
+	} \
+	static size_t array_count_scalar_##suffix(const void *elements, \
+		size_t n, const void *value) { \
+		const type *p = elements; \
+		type key; \
+		size_t i, count = 0; \
+		memcpy(&key, value, sizeof(key)); \
+		for (i = 0; i < n; i++) { \
+			count += p[i] == key; \
+		} \
+		return count; \
+	} \
+	static void array_min_scalar_##suffix(const void *elements, size_t n, \
+		void *out) { \
+		const type *p = elements; \
+		type result = p[0]; \
+		size_t i; \
+		for (i = 1; i < n; i++) { \
+			if (p[i] < result) { \
+				result = p[i]; \
+			} \
+		} \
+		memcpy(out, &result, sizeof(result)); \
+	} \
+	static void array_max_scalar_##suffix(const void *elements, size_t n, \
+		void *out) { \
+		const type *p = elements; \
+		type result = p[0]; \
+		size_t i; \
+		for (i = 1; i < n; i++) { \
+			if (p[i] > result) { \
+				result = p[i]; \
+			} \
+		} \
+		memcpy(out, &result, sizeof(result)); \
+	} \
+	static void array_sum_scalar_##suffix(const void *elements, size_t n, \
+		void *out) { \
+		const type *p = elements; \
+		sum_type sums[ARRAY_SIMD_SUMS]; \
+		result_type result; \
+		size_t i; \
+		int width; \
+		for (i = 0; i < ARRAY_SIMD_SUMS; i++) { \
+			sums[i] = 0; \
+		} \
+		for (i = 0; i < n; i++) { \
+			sums[i % ARRAY_SIMD_SUMS] += (sum_type) p[i]; \
+		} \
+		ARRAY_SIMD_ADD_SUMS(sums, width, i); \
+		result = (result_type) sums[0]; \
+		memcpy(out, &result, sizeof(result)); \
+	}
+
+/* Add up the partial sums pairwise, into the first one */
+#define ARRAY_SIMD_ADD_SUMS(sums, width, i) \
+	for (width = ARRAY_SIMD_SUMS / 2; width > 0; width /= 2) { \
+		for (i = 0; i < (size_t) width; i++) { \
+			sums[i] += sums[i + width]; \
+		} \
+	}
+
+ARRAY_SCALAR_KERNELS(int32, int32_t, uint64_t, int64_t)
+ARRAY_SCALAR_KERNELS(int64, int64_t, uint64_t, int64_t)
+ARRAY_SCALAR_KERNELS(float, float, float, float)
+ARRAY_SCALAR_KERNELS(double, double, double, double)
+
+/* Floating point values are compared with ==, so -0.0 equals 0.0 */
+#define ARRAY_SCALAR_EQUAL(suffix, type) \
+	static int array_equal_scalar_##suffix(const void *a_elements, \
+		const void *b_elements, size_t n) { \
+		const type *a = a_elements; \
+		const type *b = b_elements; \
+		size_t i; \
+		for (i = 0; i < n; i++) { \
+			if (!(a[i] == b[i])) { \
+				return 0; \
+			} \
+		} \
+		return 1; \
+	}
+
+ARRAY_SCALAR_EQUAL(float, float)
+ARRAY_SCALAR_EQUAL(double, double)
+
+/* Integers are equal exactly when their bytes are */
+static int array_equal_int32(const void *a, const void *b, size_t n) {
+	return memcmp(a, b, n * sizeof(int32_t)) == 0;
+}
+
+static int array_equal_int64(const void *a, const void *b, size_t n) {
+	return memcmp(a, b, n * sizeof(int64_t)) == 0;
+}
+
+static void array_prefix_sum_scalar_int32(void *elements, size_t n) {
+	int32_t *p = elements;
+	uint32_t sum = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		sum += (uint32_t) p[i];
+		p[i] = (int32_t) sum;
+	}
+}
+
+static void array_prefix_sum_scalar_int64(void *elements, size_t n) {
+	int64_t *p = elements;
+	uint64_t sum = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		sum += (uint64_t) p[i];
+		p[i] = (int64_t) sum;
+	}
+}
+
+static void array_prefix_sum_float(void *elements, size_t n) {
+	float *p = elements;
+	size_t i;
+	for (i = 1; i < n; i++) {
+		p[i] += p[i - 1];
+	}
+}
+
+static void array_prefix_sum_double(void *elements, size_t n) {
+	double *p = elements;
+	size_t i;
+	for (i = 1; i < n; i++) {
+		p[i] += p[i - 1];
+	}
+}
+
+#ifdef ARRAY_SIMD_X86
+
+/*
+ * Vector kernels, written once in terms of the operations below, which
+ * every instruction set defines for every type as ARRAY_<SET>_<TYPE>_
+ * followed by the name of the operation:
+ *
+ * VECTOR, LANES: the vector type and the number of elements in one
+ * LOAD, STORE, SET1: unaligned load and store, and broadcast
+ * EQ: compare for equality, giving a mask with one bit per lane
+ * MIN, MAX: elementwise minimum and maximum
+ * SUM_VECTOR, SUM_REGISTERS: the vectors holding the partial sums
+ * SUM_ZERO, SUM_STORE: clear the partial sums, store them in order
+ * SUM16(sums, p): add the 16 elements at p to the partial sums
+ */
+
+#define ARRAY_SIMD_FIND(name, target, ops, type) \
+	target static size_t name(const void *elements, size_t n, \
+		const void *value) { \
+		const type *p = elements; \
+		ops##_VECTOR keys, v; \
+		type key; \
+		size_t i; \
+		memcpy(&key, value, sizeof(key)); \
+		keys = ops##_SET1(key); \
+		for (i = 0; i + ops##_LANES <= n; i += ops##_LANES) { \
+			unsigned mask; \
+			v = ops##_LOAD(p + i); \
+			mask = ops##_EQ(v, keys); \
+			if (mask != 0) { \
+				return i + (size_t) __builtin_ctz(mask); \
+			} \
+		} \
+		for (; i < n && !(p[i] == key); i++) { \
+		} \
+		return i; \
+	}
+
+#define ARRAY_SIMD_COUNT(name, target, ops, type) \
+	target static size_t name(const void *elements, size_t n, \
+		const void *value) { \
+		const type *p = elements; \
+		ops##_VECTOR keys, v; \
+		type key; \
+		size_t i, count = 0; \
+		memcpy(&key, value, sizeof(key)); \
+		keys = ops##_SET1(key); \
+		for (i = 0; i + ops##_LANES <= n; i += ops##_LANES) { \
+			v = ops##_LOAD(p + i); \
+			count += (size_t) __builtin_popcount(ops##_EQ(v, keys)); \
+		} \
+		for (; i < n; i++) { \
+			count += p[i] == key; \
+		} \
+		return count; \
+	}
+
+#define ARRAY_SIMD_EXTREME(name, target, ops, type, op, cmp) \
+	target static void name(const void *elements, size_t n, void *out) { \
+		const type *p = elements; \
+		type lanes[ops##_LANES]; \
+		type result = p[0]; \
+		size_t i = 1; \
+		int lane; \
+		if (n >= ops##_LANES) { \
+			ops##_VECTOR extreme = ops##_LOAD(p), v; \
+			for (i = ops##_LANES; i + ops##_LANES <= n; i += ops##_LANES) { \
+				v = ops##_LOAD(p + i); \
+				extreme = ops##_##op(extreme, v); \
+			} \
+			ops##_STORE(lanes, extreme); \
+			for (lane = 0; lane < ops##_LANES; lane++) { \
+				if (lanes[lane] cmp result) { \
+					result = lanes[lane]; \
+				} \
+			} \
+		} \
+		for (; i < n; i++) { \
+			if (p[i] cmp result) { \
+				result = p[i]; \
+			} \
+		} \
+		memcpy(out, &result, sizeof(result)); \
+	}
+
+#define ARRAY_SIMD_EQUAL(name, target, ops, type) \
+	target static int name(const void *a_elements, const void *b_elements, \
+		size_t n) { \
+		const type *a = a_elements; \
+		const type *b = b_elements; \
+		ops##_VECTOR x, y; \
+		size_t i; \
+		for (i = 0; i + ops##_LANES <= n; i += ops##_LANES) { \
+			x = ops##_LOAD(a + i); \
+			y = ops##_LOAD(b + i); \
+			if (ops##_EQ(x, y) != (1u << ops##_LANES) - 1) { \
+				return 0; \
+			} \
+		} \
+		for (; i < n; i++) { \
+			if (!(a[i] == b[i])) { \
+				return 0; \
+			} \
+		} \
+		return 1; \
+	}
+
+#define ARRAY_SIMD_SUM(name, target, ops, type, sum_type, result_type) \
+	target static void name(const void *elements, size_t n, void *out) { \
+		const type *p = elements; \
+		ops##_SUM_VECTOR vectors[ops##_SUM_REGISTERS]; \
+		sum_type sums[ARRAY_SIMD_SUMS]; \
+		result_type result; \
+		size_t i; \
+		int width; \
+		for (width = 0; width < ops##_SUM_REGISTERS; width++) { \
+			vectors[width] = ops##_SUM_ZERO; \
+		} \
+		for (i = 0; i + ARRAY_SIMD_SUMS <= n; i += ARRAY_SIMD_SUMS) { \
+			ops##_SUM16(vectors, p + i); \
+		} \
+		for (width = 0; width < ops##_SUM_REGISTERS; width++) { \
+			ops##_SUM_STORE(sums + width * \
+				(ARRAY_SIMD_SUMS / ops##_SUM_REGISTERS), vectors[width]); \
+		} \
+		/* The rest go to the partial sums a plain loop would add them to */ \
+		for (width = 0; i < n; i++, width++) { \
+			sums[width] += (sum_type) p[i]; \
+		} \
+		ARRAY_SIMD_ADD_SUMS(sums, width, i); \
+		result = (result_type) sums[0]; \
+		memcpy(out, &result, sizeof(result)); \
+	}
+
+/* SUM16 for types whose partial sums have the type of the elements */
+#define ARRAY_SIMD_SUM16(ops, vectors, p) { \
+		int r; \
+		for (r = 0; r < ops##_SUM_REGISTERS; r++) { \
+			vectors[r] = ops##_ADD(vectors[r], \
+				ops##_LOAD((p) + r * ops##_LANES)); \
+		} \
+	}
+
+/* All the kernels of one instruction set */
+#define ARRAY_SIMD_KERNELS(set, target, ops) \
+	ARRAY_SIMD_FIND(array_find_##set##_int32, target, ops##_INT32, int32_t) \
+	ARRAY_SIMD_FIND(array_find_##set##_int64, target, ops##_INT64, int64_t) \
+	ARRAY_SIMD_FIND(array_find_##set##_float, target, ops##_FLOAT, float) \
+	ARRAY_SIMD_FIND(array_find_##set##_double, target, ops##_DOUBLE, double) \
+	ARRAY_SIMD_COUNT(array_count_##set##_int32, target, ops##_INT32, \
+		int32_t) \
+	ARRAY_SIMD_COUNT(array_count_##set##_int64, target, ops##_INT64, \
+		int64_t) \
+	ARRAY_SIMD_COUNT(array_count_##set##_float, target, ops##_FLOAT, float) \
+	ARRAY_SIMD_COUNT(array_count_##set##_double, target, ops##_DOUBLE, \
+		double) \
+	ARRAY_SIMD_EXTREME(array_min_##set##_int32, target, ops##_INT32, \
+		int32_t, MIN, <) \
+	ARRAY_SIMD_EXTREME(array_max_##set##_int32, target, ops##_INT32, \
+		int32_t, MAX, >) \
+	ARRAY_SIMD_EXTREME(array_min_##set##_float, target, ops##_FLOAT, \
+		float, MIN, <) \
+	ARRAY_SIMD_EXTREME(array_max_##set##_float, target, ops##_FLOAT, \
+		float, MAX, >) \
+	ARRAY_SIMD_EXTREME(array_min_##set##_double, target, ops##_DOUBLE, \
+		double, MIN, <) \
+	ARRAY_SIMD_EXTREME(array_max_##set##_double, target, ops##_DOUBLE, \
+		double, MAX, >) \
+	ARRAY_SIMD_EQUAL(array_equal_##set##_float, target, ops##_FLOAT, float) \
+	ARRAY_SIMD_EQUAL(array_equal_##set##_double, target, ops##_DOUBLE, \
+		double) \
+	ARRAY_SIMD_SUM(array_sum_##set##_int32, target, ops##_INT32, int32_t, \
+		uint64_t, int64_t) \
+	ARRAY_SIMD_SUM(array_sum_##set##_int64, target, ops##_INT64, int64_t, \
+		uint64_t, int64_t) \
+	ARRAY_SIMD_SUM(array_sum_##set##_float, target, ops##_FLOAT, float, \
+		float, float) \
+	ARRAY_SIMD_SUM(array_sum_##set##_double, target, ops##_DOUBLE, double, \
+		double, double)
+
+/* SSE2, which every x86-64 processor has */
+
+#define ARRAY_SSE2_TARGET __attribute__((target("sse2")))
+
+/* Take the lanes of a where mask is set and those of b elsewhere */
+static __inline__ __m128i array_sse2_select(__m128i mask, __m128i a,
+	__m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* Compare 64-bit lanes, which SSE2 only does as pairs of 32-bit halves */
+static __inline__ unsigned array_sse2_eq64(__m128i a, __m128i b) {
+	const __m128i halves = _mm_cmpeq_epi32(a, b);
+	return (unsigned) _mm_movemask_pd(_mm_castsi128_pd(_mm_and_si128(
+		halves, _mm_shuffle_epi32(halves, 0xb1))));
+}
+
+#define ARRAY_SSE2_INT32_VECTOR __m128i
+#define ARRAY_SSE2_INT32_LANES 4
+#define ARRAY_SSE2_INT32_LOAD(p) _mm_loadu_si128((const __m128i*) (p))
+#define ARRAY_SSE2_INT32_STORE(p, v) _mm_storeu_si128((__m128i*) (p), v)
+#define ARRAY_SSE2_INT32_SET1(x) _mm_set1_epi32(x)
+#define ARRAY_SSE2_INT32_EQ(a, b) \
+	(unsigned) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)))
+#define ARRAY_SSE2_INT32_MIN(a, b) \
+	array_sse2_select(_mm_cmpgt_epi32(a, b), b, a)
+#define ARRAY_SSE2_INT32_MAX(a, b) \
+	array_sse2_select(_mm_cmpgt_epi32(a, b), a, b)
+#define ARRAY_SSE2_INT32_SUM_VECTOR __m128i
+#define ARRAY_SSE2_INT32_SUM_REGISTERS 8
+#define ARRAY_SSE2_INT32_SUM_ZERO _mm_setzero_si128()
+#define ARRAY_SSE2_INT32_SUM_STORE(p, v) _mm_storeu_si128((__m128i*) (p), v)
+#define ARRAY_SSE2_INT32_SUM16(vectors, p) { \
+		int r; \
+		for (r = 0; r < 4; r++) { \
+			const __m128i v = _mm_loadu_si128((const __m128i*) (p) + r); \
+			const __m128i sign = _mm_cmpgt_epi32(_mm_setzero_si128(), v); \
+			vectors[2 * r] = _mm_add_epi64(vectors[2 * r], \
+				_mm_unpacklo_epi32(v, sign)); \
+			vectors[2 * r + 1] = _mm_add_epi64(vectors[2 * r + 1], \
+				_mm_unpackhi_epi32(v, sign)); \
+		} \
+	}
+
+#define ARRAY_SSE2_INT64_VECTOR __m128i
+#define ARRAY_SSE2_INT64_LANES 2
+#define ARRAY_SSE2_INT64_LOAD(p) _mm_loadu_si128((const __m128i*) (p))
+#define ARRAY_SSE2_INT64_SET1(x) _mm_set1_epi64x(x)
+#define ARRAY_SSE2_INT64_EQ(a, b) array_sse2_eq64(a, b)
+#define ARRAY_SSE2_INT64_ADD(a, b) _mm_add_epi64(a, b)
+#define ARRAY_SSE2_INT64_SUM_VECTOR __m128i
+#define ARRAY_SSE2_INT64_SUM_REGISTERS 8
+#define ARRAY_SSE2_INT64_SUM_ZERO _mm_setzero_si128()
+#define ARRAY_SSE2_INT64_SUM_STORE(p, v) _mm_storeu_si128((__m128i*) (p), v)
+#define ARRAY_SSE2_INT64_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_SSE2_INT64, vectors, p)
+
+#define ARRAY_SSE2_FLOAT_VECTOR __m128
+#define ARRAY_SSE2_FLOAT_LANES 4
+#define ARRAY_SSE2_FLOAT_LOAD(p) _mm_loadu_ps(p)
+#define ARRAY_SSE2_FLOAT_STORE(p, v) _mm_storeu_ps(p, v)
+#define ARRAY_SSE2_FLOAT_SET1(x) _mm_set1_ps(x)
+#define ARRAY_SSE2_FLOAT_EQ(a, b) (unsigned) _mm_movemask_ps(_mm_cmpeq_ps(a, b))
+#define ARRAY_SSE2_FLOAT_MIN(a, b) _mm_min_ps(a, b)
+#define ARRAY_SSE2_FLOAT_MAX(a, b) _mm_max_ps(a, b)
+#define ARRAY_SSE2_FLOAT_ADD(a, b) _mm_add_ps(a, b)
+#define ARRAY_SSE2_FLOAT_SUM_VECTOR __m128
+#define ARRAY_SSE2_FLOAT_SUM_REGISTERS 4
+#define ARRAY_SSE2_FLOAT_SUM_ZERO _mm_setzero_ps()
+#define ARRAY_SSE2_FLOAT_SUM_STORE(p, v) _mm_storeu_ps(p, v)
+#define ARRAY_SSE2_FLOAT_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_SSE2_FLOAT, vectors, p)
+
+#define ARRAY_SSE2_DOUBLE_VECTOR __m128d
+#define ARRAY_SSE2_DOUBLE_LANES 2
+#define ARRAY_SSE2_DOUBLE_LOAD(p) _mm_loadu_pd(p)
+#define ARRAY_SSE2_DOUBLE_STORE(p, v) _mm_storeu_pd(p, v)
+#define ARRAY_SSE2_DOUBLE_SET1(x) _mm_set1_pd(x)
+#define ARRAY_SSE2_DOUBLE_EQ(a, b) \
+	(unsigned) _mm_movemask_pd(_mm_cmpeq_pd(a, b))
+#define ARRAY_SSE2_DOUBLE_MIN(a, b) _mm_min_pd(a, b)
+#define ARRAY_SSE2_DOUBLE_MAX(a, b) _mm_max_pd(a, b)
+#define ARRAY_SSE2_DOUBLE_ADD(a, b) _mm_add_pd(a, b)
+#define ARRAY_SSE2_DOUBLE_SUM_VECTOR __m128d
+#define ARRAY_SSE2_DOUBLE_SUM_REGISTERS 8
+#define ARRAY_SSE2_DOUBLE_SUM_ZERO _mm_setzero_pd()
+#define ARRAY_SSE2_DOUBLE_SUM_STORE(p, v) _mm_storeu_pd(p, v)
+#define ARRAY_SSE2_DOUBLE_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_SSE2_DOUBLE, vectors, p)
+
+ARRAY_SIMD_KERNELS(sse2, ARRAY_SSE2_TARGET, ARRAY_SSE2)
+
+/* Without a 64-bit comparison in SSE2, these stay scalar */
+#define array_min_sse2_int64 array_min_scalar_int64
+#define array_max_sse2_int64 array_max_scalar_int64
+
+/*
+ * Prefix sums add each vector shifted by one and then two lanes to
+ * itself, then carry the last sum over to the next vector. Wider
+ * vectors would need shuffles across their halves, so every level uses
+ * these.
+ */
+static void array_prefix_sum_sse2_int32(void *elements, size_t n) {
+	int32_t *p = elements;
+	__m128i carry = _mm_setzero_si128();
+	uint32_t sum;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi32(v, carry);
+		_mm_storeu_si128((__m128i*) (p + i), v);
+		carry = _mm_shuffle_epi32(v, 0xff);
+	}
+
+	/* The rest start from the last sum, or from nothing */
+	for (sum = i > 0 ? (uint32_t) p[i - 1] : 0; i < n; i++) {
+		sum += (uint32_t) p[i];
+		p[i] = (int32_t) sum;
+	}
+}
+
+static void array_prefix_sum_sse2_int64(void *elements, size_t n) {
+	int64_t *p = elements;
+	__m128i carry = _mm_setzero_si128();
+	uint64_t sum;
+	size_t i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+		v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi64(v, carry);
+		_mm_storeu_si128((__m128i*) (p + i), v);
+		carry = _mm_shuffle_epi32(v, 0xee);
+	}
+
+	for (sum = i > 0 ? (uint64_t) p[i - 1] : 0; i < n; i++) {
+		sum += (uint64_t) p[i];
+		p[i] = (int64_t) sum;
+	}
+}
+
+/* AVX2 */
+
+#define ARRAY_AVX2_TARGET __attribute__((target("avx2,popcnt")))
+
+#define ARRAY_AVX2_INT32_VECTOR __m256i
+#define ARRAY_AVX2_INT32_LANES 8
+#define ARRAY_AVX2_INT32_LOAD(p) _mm256_loadu_si256((const __m256i*) (p))
+#define ARRAY_AVX2_INT32_STORE(p, v) _mm256_storeu_si256((__m256i*) (p), v)
+#define ARRAY_AVX2_INT32_SET1(x) _mm256_set1_epi32(x)
+#define ARRAY_AVX2_INT32_EQ(a, b) (unsigned) _mm256_movemask_ps( \
+	_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)))
+#define ARRAY_AVX2_INT32_MIN(a, b) _mm256_min_epi32(a, b)
+#define ARRAY_AVX2_INT32_MAX(a, b) _mm256_max_epi32(a, b)
+#define ARRAY_AVX2_INT32_SUM_VECTOR __m256i
+#define ARRAY_AVX2_INT32_SUM_REGISTERS 4
+#define ARRAY_AVX2_INT32_SUM_ZERO _mm256_setzero_si256()
+#define ARRAY_AVX2_INT32_SUM_STORE(p, v) \
+	_mm256_storeu_si256((__m256i*) (p), v)
+#define ARRAY_AVX2_INT32_SUM16(vectors, p) { \
+		int r; \
+		for (r = 0; r < 2; r++) { \
+			const __m256i v = _mm256_loadu_si256((const __m256i*) (p) + r); \
+			vectors[2 * r] = _mm256_add_epi64(vectors[2 * r], \
+				_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v))); \
+			vectors[2 * r + 1] = _mm256_add_epi64(vectors[2 * r + 1], \
+				_mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1))); \
+		} \
+	}
+
+#define ARRAY_AVX2_INT64_VECTOR __m256i
+#define ARRAY_AVX2_INT64_LANES 4
+#define ARRAY_AVX2_INT64_LOAD(p) _mm256_loadu_si256((const __m256i*) (p))
+#define ARRAY_AVX2_INT64_STORE(p, v) _mm256_storeu_si256((__m256i*) (p), v)
+#define ARRAY_AVX2_INT64_SET1(x) _mm256_set1_epi64x(x)
+#define ARRAY_AVX2_INT64_EQ(a, b) (unsigned) _mm256_movemask_pd( \
+	_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b)))
+#define ARRAY_AVX2_INT64_MIN(a, b) \
+	_mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b))
+#define ARRAY_AVX2_INT64_MAX(a, b) \
+	_mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b))
+#define ARRAY_AVX2_INT64_ADD(a, b) _mm256_add_epi64(a, b)
+#define ARRAY_AVX2_INT64_SUM_VECTOR __m256i
+#define ARRAY_AVX2_INT64_SUM_REGISTERS 4
+#define ARRAY_AVX2_INT64_SUM_ZERO _mm256_setzero_si256()
+#define ARRAY_AVX2_INT64_SUM_STORE(p, v) \
+	_mm256_storeu_si256((__m256i*) (p), v)
+#define ARRAY_AVX2_INT64_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_AVX2_INT64, vectors, p)
+
+#define ARRAY_AVX2_FLOAT_VECTOR __m256
+#define ARRAY_AVX2_FLOAT_LANES 8
+#define ARRAY_AVX2_FLOAT_LOAD(p) _mm256_loadu_ps(p)
+#define ARRAY_AVX2_FLOAT_STORE(p, v) _mm256_storeu_ps(p, v)
+#define ARRAY_AVX2_FLOAT_SET1(x) _mm256_set1_ps(x)
+#define ARRAY_AVX2_FLOAT_EQ(a, b) \
+	(unsigned) _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ))
+#define ARRAY_AVX2_FLOAT_MIN(a, b) _mm256_min_ps(a, b)
+#define ARRAY_AVX2_FLOAT_MAX(a, b) _mm256_max_ps(a, b)
+#define ARRAY_AVX2_FLOAT_ADD(a, b) _mm256_add_ps(a, b)
+#define ARRAY_AVX2_FLOAT_SUM_VECTOR __m256
+#define ARRAY_AVX2_FLOAT_SUM_REGISTERS 2
+#define ARRAY_AVX2_FLOAT_SUM_ZERO _mm256_setzero_ps()
+#define ARRAY_AVX2_FLOAT_SUM_STORE(p, v) _mm256_storeu_ps(p, v)
+#define ARRAY_AVX2_FLOAT_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_AVX2_FLOAT, vectors, p)
+
+#define ARRAY_AVX2_DOUBLE_VECTOR __m256d
+#define ARRAY_AVX2_DOUBLE_LANES 4
+#define ARRAY_AVX2_DOUBLE_LOAD(p) _mm256_loadu_pd(p)
+#define ARRAY_AVX2_DOUBLE_STORE(p, v) _mm256_storeu_pd(p, v)
+#define ARRAY_AVX2_DOUBLE_SET1(x) _mm256_set1_pd(x)
+#define ARRAY_AVX2_DOUBLE_EQ(a, b) \
+	(unsigned) _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ))
+#define ARRAY_AVX2_DOUBLE_MIN(a, b) _mm256_min_pd(a, b)
+#define ARRAY_AVX2_DOUBLE_MAX(a, b) _mm256_max_pd(a, b)
+#define ARRAY_AVX2_DOUBLE_ADD(a, b) _mm256_add_pd(a, b)
+#define ARRAY_AVX2_DOUBLE_SUM_VECTOR __m256d
+#define ARRAY_AVX2_DOUBLE_SUM_REGISTERS 4
+#define ARRAY_AVX2_DOUBLE_SUM_ZERO _mm256_setzero_pd()
+#define ARRAY_AVX2_DOUBLE_SUM_STORE(p, v) _mm256_storeu_pd(p, v)
+#define ARRAY_AVX2_DOUBLE_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_AVX2_DOUBLE, vectors, p)
+
+ARRAY_SIMD_KERNELS(avx2, ARRAY_AVX2_TARGET, ARRAY_AVX2)
+ARRAY_SIMD_EXTREME(array_min_avx2_int64, ARRAY_AVX2_TARGET, ARRAY_AVX2_INT64,
+	int64_t, MIN, <)
+ARRAY_SIMD_EXTREME(array_max_avx2_int64, ARRAY_AVX2_TARGET, ARRAY_AVX2_INT64,
+	int64_t, MAX, >)
+
+/* AVX-512, of which only the foundation is needed */
+
+#define ARRAY_AVX512_TARGET __attribute__((target("avx512f,popcnt")))
+
+#define ARRAY_AVX512_INT32_VECTOR __m512i
+#define ARRAY_AVX512_INT32_LANES 16
+#define ARRAY_AVX512_INT32_LOAD(p) _mm512_loadu_si512((const void*) (p))
+#define ARRAY_AVX512_INT32_STORE(p, v) _mm512_storeu_si512((void*) (p), v)
+#define ARRAY_AVX512_INT32_SET1(x) _mm512_set1_epi32(x)
+#define ARRAY_AVX512_INT32_EQ(a, b) (unsigned) _mm512_cmpeq_epi32_mask(a, b)
+#define ARRAY_AVX512_INT32_MIN(a, b) _mm512_min_epi32(a, b)
+#define ARRAY_AVX512_INT32_MAX(a, b) _mm512_max_epi32(a, b)
+#define ARRAY_AVX512_INT32_SUM_VECTOR __m512i
+#define ARRAY_AVX512_INT32_SUM_REGISTERS 2
+#define ARRAY_AVX512_INT32_SUM_ZERO _mm512_setzero_si512()
+#define ARRAY_AVX512_INT32_SUM_STORE(p, v) _mm512_storeu_si512((void*) (p), v)
+#define ARRAY_AVX512_INT32_SUM16(vectors, p) { \
+		const __m512i v = _mm512_loadu_si512((const void*) (p)); \
+		vectors[0] = _mm512_add_epi64(vectors[0], \
+			_mm512_cvtepi32_epi64(_mm512_castsi512_si256(v))); \
+		vectors[1] = _mm512_add_epi64(vectors[1], \
+			_mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1))); \
+	}
+
+#define ARRAY_AVX512_INT64_VECTOR __m512i
+#define ARRAY_AVX512_INT64_LANES 8
+#define ARRAY_AVX512_INT64_LOAD(p) _mm512_loadu_si512((const void*) (p))
+#define ARRAY_AVX512_INT64_STORE(p, v) _mm512_storeu_si512((void*) (p), v)
+#define ARRAY_AVX512_INT64_SET1(x) _mm512_set1_epi64(x)
+#define ARRAY_AVX512_INT64_EQ(a, b) (unsigned) _mm512_cmpeq_epi64_mask(a, b)
+#define ARRAY_AVX512_INT64_MIN(a, b) _mm512_min_epi64(a, b)
+#define ARRAY_AVX512_INT64_MAX(a, b) _mm512_max_epi64(a, b)
+#define ARRAY_AVX512_INT64_ADD(a, b) _mm512_add_epi64(a, b)
+#define ARRAY_AVX512_INT64_SUM_VECTOR __m512i
+#define ARRAY_AVX512_INT64_SUM_REGISTERS 2
+#define ARRAY_AVX512_INT64_SUM_ZERO _mm512_setzero_si512()
+#define ARRAY_AVX512_INT64_SUM_STORE(p, v) _mm512_storeu_si512((void*) (p), v)
+#define ARRAY_AVX512_INT64_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_AVX512_INT64, vectors, p)
+
+#define ARRAY_AVX512_FLOAT_VECTOR __m512
+#define ARRAY_AVX512_FLOAT_LANES 16
+#define ARRAY_AVX512_FLOAT_LOAD(p) _mm512_loadu_ps(p)
+#define ARRAY_AVX512_FLOAT_STORE(p, v) _mm512_storeu_ps(p, v)
+#define ARRAY_AVX512_FLOAT_SET1(x) _mm512_set1_ps(x)
+#define ARRAY_AVX512_FLOAT_EQ(a, b) \
+	(unsigned) _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ)
+#define ARRAY_AVX512_FLOAT_MIN(a, b) _mm512_min_ps(a, b)
+#define ARRAY_AVX512_FLOAT_MAX(a, b) _mm512_max_ps(a, b)
+#define ARRAY_AVX512_FLOAT_ADD(a, b) _mm512_add_ps(a, b)
+#define ARRAY_AVX512_FLOAT_SUM_VECTOR __m512
+#define ARRAY_AVX512_FLOAT_SUM_REGISTERS 1
+#define ARRAY_AVX512_FLOAT_SUM_ZERO _mm512_setzero_ps()
+#define ARRAY_AVX512_FLOAT_SUM_STORE(p, v) _mm512_storeu_ps(p, v)
+#define ARRAY_AVX512_FLOAT_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_AVX512_FLOAT, vectors, p)
+
+#define ARRAY_AVX512_DOUBLE_VECTOR __m512d
+#define ARRAY_AVX512_DOUBLE_LANES 8
+#define ARRAY_AVX512_DOUBLE_LOAD(p) _mm512_loadu_pd(p)
+#define ARRAY_AVX512_DOUBLE_STORE(p, v) _mm512_storeu_pd(p, v)
+#define ARRAY_AVX512_DOUBLE_SET1(x) _mm512_set1_pd(x)
+#define ARRAY_AVX512_DOUBLE_EQ(a, b) \
+	(unsigned) _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ)
+#define ARRAY_AVX512_DOUBLE_MIN(a, b) _mm512_min_pd(a, b)
+#define ARRAY_AVX512_DOUBLE_MAX(a, b) _mm512_max_pd(a, b)
+#define ARRAY_AVX512_DOUBLE_ADD(a, b) _mm512_add_pd(a, b)
+#define ARRAY_AVX512_DOUBLE_SUM_VECTOR __m512d
+#define ARRAY_AVX512_DOUBLE_SUM_REGISTERS 2
+#define ARRAY_AVX512_DOUBLE_SUM_ZERO _mm512_setzero_pd()
+#define ARRAY_AVX512_DOUBLE_SUM_STORE(p, v) _mm512_storeu_pd(p, v)
+#define ARRAY_AVX512_DOUBLE_SUM16(vectors, p) \
+	ARRAY_SIMD_SUM16(ARRAY_AVX512_DOUBLE, vectors, p)
+
+ARRAY_SIMD_KERNELS(avx512, ARRAY_AVX512_TARGET, ARRAY_AVX512)
+ARRAY_SIMD_EXTREME(array_min_avx512_int64, ARRAY_AVX512_TARGET,
+	ARRAY_AVX512_INT64, int64_t, MIN, <)
+ARRAY_SIMD_EXTREME(array_max_avx512_int64, ARRAY_AVX512_TARGET,
+	ARRAY_AVX512_INT64, int64_t, MAX, >)
+
+/* The kernels of each level for each type, from the plain C ones up */
+#define ARRAY_SIMD_TABLE(op) { \
+		{op##_scalar_int32, op##_scalar_int64, op##_scalar_float, \
+			op##_scalar_double}, \
+		{op##_sse2_int32, op##_sse2_int64, op##_sse2_float, op##_sse2_double}, \
+		{op##_avx2_int32, op##_avx2_int64, op##_avx2_float, op##_avx2_double}, \
+		{op##_avx512_int32, op##_avx512_int64, op##_avx512_float, \
+			op##_avx512_double} \
+	}
+
+/* Integers compare as bytes at every level */
+#define ARRAY_SIMD_EQUAL_TABLE { \
+		{array_equal_int32, array_equal_int64, array_equal_scalar_float, \
+			array_equal_scalar_double}, \
+		{array_equal_int32, array_equal_int64, array_equal_sse2_float, \
+			array_equal_sse2_double}, \
+		{array_equal_int32, array_equal_int64, array_equal_avx2_float, \
+			array_equal_avx2_double}, \
+		{array_equal_int32, array_equal_int64, array_equal_avx512_float, \
+			array_equal_avx512_double} \
+	}
+
+#define ARRAY_SIMD_PREFIX_SUM_TABLE { \
+		{array_prefix_sum_scalar_int32, array_prefix_sum_scalar_int64, \
+			array_prefix_sum_float, array_prefix_sum_double}, \
+		{array_prefix_sum_sse2_int32, array_prefix_sum_sse2_int64, \
+			array_prefix_sum_float, array_prefix_sum_double}, \
+		{array_prefix_sum_sse2_int32, array_prefix_sum_sse2_int64, \
+			array_prefix_sum_float, array_prefix_sum_double}, \
+		{array_prefix_sum_sse2_int32, array_prefix_sum_sse2_int64, \
+			array_prefix_sum_float, array_prefix_sum_double} \
+	}
+
+/* Find the best level this processor supports */
+static int array_simd_detect(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return ARRAY_SIMD_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return ARRAY_SIMD_AVX2;
+	}
+	return ARRAY_SIMD_SSE2;
+}
+
+#else
+
+#define ARRAY_SIMD_TABLE(op) { \
+		{op##_scalar_int32, op##_scalar_int64, op##_scalar_float, \
+			op##_scalar_double} \
+	}
+
+#define ARRAY_SIMD_EQUAL_TABLE { \
+		{array_equal_int32, array_equal_int64, array_equal_scalar_float, \
+			array_equal_scalar_double} \
+	}
+
+#define ARRAY_SIMD_PREFIX_SUM_TABLE { \
+		{array_prefix_sum_scalar_int32, array_prefix_sum_scalar_int64, \
+			array_prefix_sum_float, array_prefix_sum_double} \
+	}
+
+static int array_simd_detect(void) {
+	return ARRAY_SIMD_NONE;
+}
+
+#endif
+
+static size_t (*const array_find_kernels[][4])(const void*, size_t,
+	const void*) = ARRAY_SIMD_TABLE(array_find);
+static size_t (*const array_count_kernels[][4])(const void*, size_t,
+	const void*) = ARRAY_SIMD_TABLE(array_count);
+static void (*const array_min_kernels[][4])(const void*, size_t, void*) =
+	ARRAY_SIMD_TABLE(array_min);
+static void (*const array_max_kernels[][4])(const void*, size_t, void*) =
+	ARRAY_SIMD_TABLE(array_max);
+static int (*const array_equal_kernels[][4])(const void*, const void*,
+	size_t) = ARRAY_SIMD_EQUAL_TABLE;
+static void (*const array_sum_kernels[][4])(const void*, size_t, void*) =
+	ARRAY_SIMD_TABLE(array_sum);
+static void (*const array_prefix_sum_kernels[][4])(void*, size_t) =
+	ARRAY_SIMD_PREFIX_SUM_TABLE;
+
+int array_simd_level(void) {
+	int level = ARRAY_SIMD_LOAD(array_simd_current);
+
+	if (level < 0) {
+		level = array_simd_detect();
+		ARRAY_SIMD_STORE(array_simd_current, level);
+	}
+
+	return level;
+}
+
+int array_simd_set_level(int level) {
+	const int best = array_simd_detect();
+
+	if (level < 0 || level > best) {
+		level = best;
+	}
+
+	ARRAY_SIMD_STORE(array_simd_current, level);
+	return level;
+}
+
+/*
+ * Get the elements of an array of the given type, in one piece. Returns
+ * 1 if the array holds that type, 0 otherwise.
+ */
+static int array_simd_elements(Array *array, int type, char **elements,
+	size_t *length) {
+	if (array == NULL || type < ARRAY_TYPE_INT32 ||
+		type > ARRAY_TYPE_DOUBLE ||
+		array_element_size(array) != array_simd_sizes[type]) {
+		return 0;
+	}
+
+	*elements = (char*) array_span(array).elements;
+	*length = array64_length(array);
+	return 1;
+}
+
+int array_find(Array *array, int type, const void *value) {
+	char *elements;
+	size_t length, index;
+
+	if (value == NULL ||
+		!array_simd_elements(array, type, &elements, &length)) {
+		return -1;
+	}
+
+	index = array_find_kernels[array_simd_level()][type](elements, length,
+		value);
+
+	return index < length && index <= INT_MAX ? (int) index : -1;
+}
+
+int array_count(Array *array, int type, const void *value) {
+	char *elements;
+	size_t length, count;
+
+	if (value == NULL ||
+		!array_simd_elements(array, type, &elements, &length)) {
+		return 0;
+	}
+
+	count = array_count_kernels[array_simd_level()][type](elements, length,
+		value);
+
+	return count < (size_t) INT_MAX ? (int) count : INT_MAX;
+}
+
+int array_min(Array *array, int type, void *out) {
+	char *elements;
+	size_t length;
+
+	if (out == NULL || !array_simd_elements(array, type, &elements, &length) ||
+		length == 0) {
+		return 0;
+	}
+
+	array_min_kernels[array_simd_level()][type](elements, length, out);
+	return 1;
+}
+
+int array_max(Array *array, int type, void *out) {
+	char *elements;
+	size_t length;
+
+	if (out == NULL || !array_simd_elements(array, type, &elements, &length) ||
+		length == 0) {
+		return 0;
+	}
+
+	array_max_kernels[array_simd_level()][type](elements, length, out);
+	return 1;
+}
+
+int array_fill(Array *array, const void *value) {
+	char *elements;
+	size_t length, size, block, done;
+
+	if (array == NULL || value == NULL || !array_unshare(array)) {
+		return 0;
+	}
+
+	elements = (char*) array_span(array).elements;
+	length = array64_length(array);
+	size = array_element_size(array);
+
+	if (length == 0) {
+		return 1;
+	}
+
+	/* The value may be one of the elements */
+	memmove(elements, value, size);
+
+	/* Double the first elements up to a block, then repeat the block */
+	block = ARRAY_SIMD_FILL_BLOCK / size > 0 ? ARRAY_SIMD_FILL_BLOCK / size : 1;
+	for (done = 1; done < length; done += block < done ? block : done) {
+		const size_t count = done < block ? done : block;
+		memcpy(elements + done * size, elements,
+			(count < length - done ? count : length - done) * size);
+	}
+
+	return 1;
+}
+
+int array_equal(Array *a, Array *b, int type) {
+	char *a_elements, *b_elements;
+	size_t a_length, b_length;
+
+	if (!array_simd_elements(a, type, &a_elements, &a_length) ||
+		!array_simd_elements(b, type, &b_elements, &b_length) ||
+		a_length != b_length) {
+		return 0;
+	}
+
+	if (a_length == 0) {
+		return 1;
+	}
+
+	return array_equal_kernels[array_simd_level()][type](a_elements,
+		b_elements, a_length);
+}
+
+int array_sum(Array *array, int type, void *out) {
+	char *elements;
+	size_t length;
+
+	if (out == NULL || !array_simd_elements(array, type, &elements, &length)) {
+		return 0;
+	}
+
+	array_sum_kernels[array_simd_level()][type](elements, length, out);
+	return 1;
+}
+
+int array_prefix_sum(Array *array, int type) {
+	char *elements;
+	size_t length;
+
+	if (!array_simd_elements(array, type, &elements, &length) ||
+		!array_unshare(array)) {
+		return 0;
+	}
+
+	/* Elements shared with a snapshot have just been copied */
+	elements = (char*) array_span(array).elements;
+	array_prefix_sum_kernels[array_simd_level()][type](elements, length);
+	return 1;
+}
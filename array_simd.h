@@ -0,0 +1,105 @@
+/*
+ * Scans over arrays of int32_t, int64_t, float or double values, using
+ * the widest vector instructions the processor supports. The kernels
+ * for each instruction set are compiled into the library side by side,
+ * and the first call picks the best one for the processor it runs on,
+ * so the library itself can be built for the baseline. On x86-64 with
+ * GCC or Clang, that is SSE2, AVX2 or AVX-512; elsewhere the plain C
+ * versions are used.
+ *
+ * The element type is given with every call, and the functions check
+ * it against the element size of the array. Comparisons follow those of
+ * C: NaN is not equal to anything, and -0.0 equals 0.0. Results are the
+ * same whichever kernel runs, including floating point sums (see
+ * array_sum), except for the minimum and maximum of arrays containing
+ * NaN, which are unspecified, as is which of 0.0 and -0.0 is returned
+ * when both are the smallest or largest.
+ *
+ * Gap buffers have their gap closed first, as the scans need the
+ * elements in one piece.
+ */
+
+#ifndef ARRAY_SIMD_H
+#define ARRAY_SIMD_H
+
+#include "array.h"
+
+/* Element types */
+#define ARRAY_TYPE_INT32 0
+#define ARRAY_TYPE_INT64 1
+#define ARRAY_TYPE_FLOAT 2
+#define ARRAY_TYPE_DOUBLE 3
+
+/* Instruction sets, from the plain C kernels up */
+#define ARRAY_SIMD_NONE 0
+#define ARRAY_SIMD_SSE2 1
+#define ARRAY_SIMD_AVX2 2
+#define ARRAY_SIMD_AVX512 3
+
+/* Get the instruction set the kernels currently use */
+extern int array_simd_level(void);
+
+/*
+ * Use the given instruction set, or the best one the processor supports
+ * if that is lower or level is negative. Meant for comparing kernels in
+ * tests and benchmarks; the kernels for every level give the same
+ * results. Returns the level now in use.
+ */
+extern int array_simd_set_level(int level);
+
+/*
+ * Find the first element equal to the value pointed to. Returns its
+ * index, or -1 if there is none within the reach of an int, or if the
+ * arguments are invalid.
+ */
+extern int array_find(Array *array, int type, const void *value);
+
+/*
+ * Count the elements equal to the value pointed to. The count stops at
+ * INT_MAX. Returns 0 if the arguments are invalid.
+ */
+extern int array_count(Array *array, int type, const void *value);
+
+/*
+ * Store the smallest or largest element in out. Returns 1 if successful,
+ * 0 if the array is empty or the arguments are invalid.
+ */
+extern int array_min(Array *array, int type, void *out);
+extern int array_max(Array *array, int type, void *out);
+
+/*
+ * Set every element of the array to the value pointed to, which must be
+ * of the element size. Works for any element type: the value is copied
+ * into a block that is then copied over the elements. Returns 1 if
+ * successful, 0 if the arguments are invalid.
+ */
+extern int array_fill(Array *array, const void *value);
+
+/*
+ * Check whether two arrays of the given type hold equal elements in the
+ * same order. Integers are compared as bytes, floating point values
+ * with ==. Returns 1 if they do, 0 if they don't or the arguments are
+ * invalid.
+ */
+extern int array_equal(Array *a, Array *b, int type);
+
+/*
+ * Store the sum of the elements in out: an int64_t for integers, which
+ * wraps around on overflow, or a value of the element type for floating
+ * point. Element i is added to the ith of 16 partial sums, which are
+ * then added pairwise, so floating point sums come out the same with
+ * every kernel (though not as a plain loop would add them). The sum of
+ * an empty array is 0. Returns 1 if successful, 0 if the arguments are
+ * invalid.
+ */
+extern int array_sum(Array *array, int type, void *out);
+
+/*
+ * Replace every element with the sum of itself and all elements before
+ * it. Integers wrap around on overflow. Floating point values are added
+ * in order, exactly like a plain loop, which leaves nothing to vectorize.
+ * Returns 1 if successful, 0 if the arguments are invalid.
+ */
+extern int array_prefix_sum(Array *array, int type);
+
+#endif /* ARRAY_SIMD_H */
@@ -0,0 +1,201 @@
+/*
+ * Type-specialized sorting and searching for arrays. Unlike array_sort
+ * and array_lower_bound, which call the comparison function through a
+ * pointer for every comparison, the functions generated here compare
+ * elements with an expression that the compiler can inline.
+ *
+ * The sorting algorithm is introsort: quicksort with a median-of-three
+ * pivot, falling back to heapsort if the recursion gets too deep, so the
+ * worst case is O(n log n). Short ranges are left for a final insertion
+ * sort pass. The sort is not stable.
+ */
+
+#ifndef ARRAY_SORT_H
+#define ARRAY_SORT_H
+
+#include "array.h"
+
+/* Ranges at most this long are left for insertion sort */
+#define ARRAY_SORT_THRESHOLD 16
+
+/*
+ * Define a sort for arrays storing values of the given type inline.
+ * The less argument is a function or function-like macro taking two
+ * pointers to elements and returning nonzero if the first one should
+ * come first. It may also refer to the context pointer given to the
+ * _range function as "context". For example:
+ *
+ *     #define int_less(a, b) (*(a) < *(b))
+ *     ARRAY_DEFINE_SORT(int_array_sort, int, int_less)
+ *
+ * defines int_array_sort(Array*), which sorts a whole array, and
+ * int_array_sort_range(int *base, size_t n, void *context), which sorts
+ * n elements starting at base. The array version does nothing if the
+ * element size of the array does not match the type.
+ */
+#define ARRAY_DEFINE_SORT(name, type, less) \
+	ARRAY_INLINE void name##_insertion(type *base, size_t n, \
+		void *context) { \
+		size_t i, j; \
+		(void) context; \
+		for (i = 1; i < n; i++) { \
+			type value = base[i]; \
+			for (j = i; j > 0 && less(&value, &base[j - 1]); j--) { \
+				base[j] = base[j - 1]; \
+			} \
+			base[j] = value; \
+		} \
+	} \
+	ARRAY_INLINE void name##_sift(type *base, size_t root, size_t n, \
+		void *context) { \
+		type value = base[root]; \
+		size_t child; \
+		(void) context; \
+		while ((child = 2 * root + 1) < n) { \
+			if (child + 1 < n && less(&base[child], &base[child + 1])) { \
+				child++; \
+			} \
+			if (!less(&value, &base[child])) { \
+				break; \
+			} \
+			base[root] = base[child]; \
+			root = child; \
+		} \
+		base[root] = value; \
+	} \
+	ARRAY_INLINE void name##_heapsort(type *base, size_t n, \
+		void *context) { \
+		size_t i; \
+		type temp; \
+		for (i = n / 2; i > 0; i--) { \
+			name##_sift(base, i - 1, n, context); \
+		} \
+		for (i = n; i > 1; i--) { \
+			temp = base[0]; \
+			base[0] = base[i - 1]; \
+			base[i - 1] = temp; \
+			name##_sift(base, 0, i - 1, context); \
+		} \
+	} \
+	ARRAY_INLINE void name##_introsort(type *base, size_t n, size_t depth, \
+		void *context) { \
+		while (n > ARRAY_SORT_THRESHOLD) { \
+			const size_t mid = n / 2; \
+			size_t i = 0; \
+			size_t j = n - 1; \
+			type pivot; \
+			type temp; \
+			if (depth-- == 0) { \
+				name##_heapsort(base, n, context); \
+				return; \
+			} \
+			/* Order the first, middle and last elements */ \
+			if (less(&base[mid], &base[0])) { \
+				temp = base[mid]; base[mid] = base[0]; base[0] = temp; \
+			} \
+			if (less(&base[n - 1], &base[mid])) { \
+				temp = base[mid]; base[mid] = base[n - 1]; base[n - 1] = temp; \
+				if (less(&base[mid], &base[0])) { \
+					temp = base[mid]; base[mid] = base[0]; base[0] = temp; \
+				} \
+			} \
+			/* Hoare partition around the median */ \
+			pivot = base[mid]; \
+			for (;;) { \
+				while (less(&base[i], &pivot)) { \
+					i++; \
+				} \
+				while (less(&pivot, &base[j])) { \
+					j--; \
+				} \
+				if (i >= j) { \
+					break; \
+				} \
+				temp = base[i]; base[i] = base[j]; base[j] = temp; \
+				i++; \
+				j--; \
+			} \
+			/* Recurse into the smaller part, loop on the larger one */ \
+			if (j + 1 < n - j - 1) { \
+				name##_introsort(base, j + 1, depth, context); \
+				base += j + 1; \
+				n -= j + 1; \
+			} else { \
+				name##_introsort(base + j + 1, n - j - 1, depth, context); \
+				n = j + 1; \
+			} \
+		} \
+	} \
+	ARRAY_INLINE void name##_range(type *base, size_t n, void *context) { \
+		size_t depth = 0; \
+		size_t m; \
+		for (m = n; m > 1; m >>= 1) { \
+			depth += 2; \
+		} \
+		name##_introsort(base, n, depth, context); \
+		name##_insertion(base, n, context); \
+	} \
+	ARRAY_INLINE void name(Array *array) { \
+		if (array_element_size(array) == sizeof(type) && \
+			array64_length(array) > 1 && array_unshare(array)) { \
+			/* The span is contiguous, even for a gap buffer */ \
+			name##_range((type*) array_span(array).elements, \
+				array64_length(array), NULL); \
+		} \
+	}
+
+/*
+ * Define binary searches for sorted arrays storing values of the given
+ * type inline, with less as for ARRAY_DEFINE_SORT (the context is always
+ * NULL). For example, ARRAY_DEFINE_SEARCH(int_array, int, int_less)
+ * defines int_array_lower_bound(Array*, int key) and
+ * int_array_upper_bound(Array*, int key), which work like
+ * array_lower_bound and array_upper_bound, and int_array_lower_bound64
+ * and int_array_upper_bound64, which work like array64_lower_bound and
+ * array64_upper_bound. All of them search the whole array, however
+ * long. With the comparison inlined, the loop compiles to conditional
+ * moves without any branches on the data.
+ */
+#define ARRAY_DEFINE_SEARCH(name, type, less) \
+	ARRAY_INLINE size_t name##_lower_bound64(Array *array, type key) { \
+		const type *first = (const type*) array_span(array).elements; \
+		const type *base = first; \
+		size_t n = array64_length(array); \
+		void *context = NULL; \
+		(void) context; \
+		if (n == 0 || array_element_size(array) != sizeof(type)) { \
+			return 0; \
+		} \
+		while (n > 1) { \
+			const size_t half = n / 2; \
+			base = less(&base[half], &key) ? base + half : base; \
+			n -= half; \
+		} \
+		return (size_t) (base - first) + (less(base, &key) ? 1 : 0); \
+	} \
+	ARRAY_INLINE size_t name##_upper_bound64(Array *array, type key) { \
+		const type *first = (const type*) array_span(array).elements; \
+		const type *base = first; \
+		size_t n = array64_length(array); \
+		void *context = NULL; \
+		(void) context; \
+		if (n == 0 || array_element_size(array) != sizeof(type)) { \
+			return 0; \
+		} \
+		while (n > 1) { \
+			const size_t half = n / 2; \
+			base = less(&key, &base[half]) ? base : base + half; \
+			n -= half; \
+		} \
+		return (size_t) (base - first) + (less(&key, base) ? 0 : 1); \
+	} \
+	ARRAY_INLINE int name##_lower_bound(Array *array, type key) { \
+		const size_t index = name##_lower_bound64(array, key); \
+		return index < (size_t) INT_MAX ? (int) index : INT_MAX; \
+	} \
+	ARRAY_INLINE int name##_upper_bound(Array *array, type key) { \
+		const size_t index = name##_upper_bound64(array, key); \
+		return index < (size_t) INT_MAX ? (int) index : INT_MAX; \
+	}
+
+#endif /* ARRAY_SORT_H */
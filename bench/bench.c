@@ -0,0 +1,921 @@
+/*
+ * Benchmarks for the array operations. Every benchmark runs for a range
+ * of array sizes, and reports the time per operation, the throughput,
+ * the allocations made through the array allocator and the peak resident
+ * set size, as CSV (the default) or JSON on stdout.
+ *
+ * Usage: array_bench [-n max_size] [-f csv|json] [-b baseline.csv]
+ *                    [-t threshold_percent] [-r runs] [-o operation]
+ *
+ * Every benchmark is measured -r times (5 by default), in as many rounds
+ * over all of them, so that its runs are spread over the whole session
+ * rather than all caught in the same busy moment of the machine. The
+ * fastest run is reported as ns_per_op, along with spread_pct, how much
+ * slower the median run was, as a measure of the noise. Every run is in
+ * a child process of its own, so peak_rss_kb is the peak of that
+ * benchmark alone (plus the program itself, about a megabyte), and every
+ * run starts from the same random numbers.
+ *
+ * With -b, the results are compared against a CSV file from an earlier
+ * run. Every operation whose fastest run got slower by more than the
+ * threshold (10% by default) plus the larger spread of the two runs is
+ * reported on stderr, and the exit status is 1. A baseline that can't be
+ * read, or has no results in it, makes the exit status 2.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "array.h"
+#include "array_parallel.h"
+#include "array_serialize.h"
+#include "array_simd.h"
+#include "array_sort.h"
+
+/* Small sizes are repeated until at least this many elements are done */
+#define BENCH_MIN_WORK 1000000
+
+/* Operations that take linear time each are capped at this many */
+#define BENCH_MAX_SLOW_OPS 10000
+
+/* Largest array size that can be benchmarked */
+#define BENCH_MAX_SIZE 100000000
+
+/* Maximum number of results kept for comparison */
+#define BENCH_MAX_RESULTS 1024
+
+/* Maximum number of times every benchmark can be measured */
+#define BENCH_MAX_RUNS 20
+
+ARRAY_DEFINE(int_array, int)
+
+#define int_less(a, b) (*(a) < *(b))
+ARRAY_DEFINE_SORT(int_array_sort, int, int_less)
+
+/* Counts what goes through the allocator of the benchmarked arrays */
+struct BenchCounter {
+    long allocations;
+    size_t bytes;
+};
+
+static struct BenchCounter bench_counter;
+
+static void *bench_allocate(void *context, size_t size) {
+    struct BenchCounter *counter = context;
+    counter->allocations++;
+    counter->bytes += size;
+    return malloc(size);
+}
+
+static void *bench_reallocate(void *context, void *pointer, size_t old_size,
+    size_t new_size) {
+    struct BenchCounter *counter = context;
+    (void) old_size;
+    counter->allocations++;
+    counter->bytes += new_size;
+    return realloc(pointer, new_size);
+}
+
+static void bench_deallocate(void *context, void *pointer, size_t size) {
+    (void) context;
+    (void) size;
+    free(pointer);
+}
+
+static const ArrayAllocator bench_allocator = {
+    bench_allocate,
+    bench_reallocate,
+    bench_deallocate,
+    NULL,
+    &bench_counter
+};
+
+/* The state of a single benchmark run */
+struct Bench {
+    int size;
+    int repeat;
+    long ops;
+    double start;
+    double seconds;
+    struct BenchCounter counter;
+};
+
+/* What is reported for a benchmark, over all of its runs */
+struct BenchResult {
+    char name[64];
+    int size;
+    long ops;
+    double ns_per_op;
+    double spread_pct;
+    struct BenchCounter counter;
+    long peak_rss_kb;
+};
+
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Start timing the part of the benchmark that is measured */
+static void bench_start(struct Bench *bench) {
+    bench_counter.allocations = 0;
+    bench_counter.bytes = 0;
+    bench->start = bench_now();
+}
+
+/* Stop timing, adding ops operations to the count */
+static void bench_stop(struct Bench *bench, long ops) {
+    bench->seconds += bench_now() - bench->start;
+    bench->ops += ops;
+    bench->counter.allocations += bench_counter.allocations;
+    bench->counter.bytes += bench_counter.bytes;
+}
+
+static unsigned long bench_random_state = 1;
+
+static int bench_random(void) {
+    bench_random_state = bench_random_state * 1103515245UL + 12345UL;
+    return (int) ((bench_random_state >> 1) & 0x3fffffffUL);
+}
+
+static Array *bench_create_ints(int size, int sorted) {
+    Array *array = array_create_ex(&bench_allocator, sizeof(int), size);
+    int i, value;
+    for (i = 0; i < size; i++) {
+        value = sorted ? i * 2 : bench_random();
+        int_array_push(array, value);
+    }
+    return array;
+}
+
+static int bench_compare_ints(const void *a, const void *b) {
+    const int x = *(const int*) a;
+    const int y = *(const int*) b;
+    return (x > y) - (x < y);
+}
+
+static int bench_compare_pointers(const void *a, const void *b) {
+    return bench_compare_ints(*(const int* const*) a, *(const int* const*) b);
+}
+
+static uint64_t bench_int_key(const void *element) {
+    return array_key_from_int(*(const int*) element);
+}
+
+static int bench_is_even(const void *element, void *context) {
+    (void) context;
+    return *(const int*) element % 2 == 0;
+}
+
+static size_t bench_discard(const void *data, size_t size, void *context) {
+    (void) data;
+    (void) context;
+    return size;
+}
+
+static void bench_push_pointers(struct Bench *bench) {
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array;
+        bench_start(bench);
+        array = array_create_ex(&bench_allocator, sizeof(void*), 0);
+        for (i = 0; i < bench->size; i++) {
+            array_push(array, &bench_counter);
+        }
+        array_free(array);
+        bench_stop(bench, bench->size);
+    }
+}
+
+static void bench_push_ints(struct Bench *bench) {
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array;
+        bench_start(bench);
+        array = array_create_ex(&bench_allocator, sizeof(int), 0);
+        for (i = 0; i < bench->size; i++) {
+            int_array_push(array, i);
+        }
+        array_free(array);
+        bench_stop(bench, bench->size);
+    }
+}
+
+static void bench_push_reserved(struct Bench *bench) {
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array;
+        bench_start(bench);
+        array = array_create_ex(&bench_allocator, sizeof(int), bench->size);
+        for (i = 0; i < bench->size; i++) {
+            int_array_push(array, i);
+        }
+        array_free(array);
+        bench_stop(bench, bench->size);
+    }
+}
+
+static void bench_push_front(struct Bench *bench) {
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array;
+        bench_start(bench);
+        array = array_create_ex(&bench_allocator, sizeof(int), 0);
+        for (i = 0; i < bench->size; i++) {
+            int_array_push_front(array, i);
+        }
+        array_free(array);
+        bench_stop(bench, bench->size);
+    }
+}
+
+static void bench_queue(struct Bench *bench) {
+    int i, rep, value;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 1);
+        bench_start(bench);
+        for (i = 0; i < bench->size; i++) {
+            int_array_pop_front(array, &value);
+            int_array_push(array, value);
+        }
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_insert_random(struct Bench *bench) {
+    const int ops = bench->size < BENCH_MAX_SLOW_OPS ?
+        bench->size : BENCH_MAX_SLOW_OPS;
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        for (i = 0; i < ops; i++) {
+            int_array_insert(array, bench_random() % (array_length(array) + 1),
+                i);
+        }
+        bench_stop(bench, ops);
+        array_free(array);
+    }
+}
+
+static void bench_remove_random(struct Bench *bench) {
+    const int ops = bench->size < BENCH_MAX_SLOW_OPS ?
+        bench->size : BENCH_MAX_SLOW_OPS;
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        for (i = 0; i < ops; i++) {
+            int_array_remove(array, bench_random() % array_length(array), NULL);
+        }
+        bench_stop(bench, ops);
+        array_free(array);
+    }
+}
+
+/* Type and delete around a cursor that wanders slowly through the array */
+static void bench_edit_cursor(struct Bench *bench, int gap_buffer) {
+    const int ops = bench->size < BENCH_MAX_SLOW_OPS ?
+        bench->size : BENCH_MAX_SLOW_OPS;
+    int i, rep, cursor;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        array_set_gap_buffer(array, gap_buffer);
+        cursor = bench->size / 2;
+        bench_start(bench);
+        for (i = 0; i < ops; i++) {
+            const int step = bench_random() % 8;
+            if (step < 5) {
+                int_array_insert(array, cursor++, i);
+            } else if (step < 7 && cursor > 0) {
+                int_array_remove(array, --cursor, NULL);
+            } else if (cursor > 16) {
+                cursor -= 16;
+            }
+        }
+        bench_stop(bench, ops);
+        array_free(array);
+    }
+}
+
+static void bench_edit_plain(struct Bench *bench) {
+    bench_edit_cursor(bench, 0);
+}
+
+static void bench_edit_gap(struct Bench *bench) {
+    bench_edit_cursor(bench, 1);
+}
+
+static void bench_swap_remove_random(struct Bench *bench) {
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        for (i = 0; i < bench->size; i++) {
+            int_array_swap_remove(array, bench_random() % array_length(array),
+                NULL);
+        }
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_get(struct Bench *bench) {
+    volatile void *sink = NULL;
+    int i, rep;
+    Array *array = array_create_ex(&bench_allocator, sizeof(void*),
+        bench->size);
+    for (i = 0; i < bench->size; i++) {
+        array_push(array, &bench_counter);
+    }
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        for (i = 0; i < bench->size; i++) {
+            sink = array_get(array, i);
+        }
+        bench_stop(bench, bench->size);
+    }
+    (void) sink;
+    array_free(array);
+}
+
+static void bench_span_scan(struct Bench *bench) {
+    volatile long sink = 0;
+    const int *values;
+    int i, rep, length;
+    long sum;
+    Array *array = bench_create_ints(bench->size, 0);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        values = int_array_span(array, &length);
+        sum = 0;
+        for (i = 0; i < length; i++) {
+            sum += values[i];
+        }
+        sink = sum;
+        bench_stop(bench, bench->size);
+    }
+    (void) sink;
+    array_free(array);
+}
+
+static void bench_sort_pointers(struct Bench *bench) {
+    int i, rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *values = bench_create_ints(bench->size, 0);
+        Array *array = array_create_ex(&bench_allocator, sizeof(void*),
+            bench->size);
+        for (i = 0; i < bench->size; i++) {
+            array_push(array, int_array_at(values, i));
+        }
+        bench_start(bench);
+        array_sort(array, bench_compare_pointers);
+        bench_stop(bench, bench->size);
+        array_free(array);
+        array_free(values);
+    }
+}
+
+static void bench_sort_qsort(struct Bench *bench) {
+    int rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        array_sort(array, bench_compare_ints);
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_sort_typed(struct Bench *bench) {
+    int rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        int_array_sort(array);
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_sort_stable(struct Bench *bench) {
+    int rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        array_sort_stable(array, bench_compare_ints);
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_sort_by_key(struct Bench *bench) {
+    int rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        array_sort_by_key(array, bench_int_key);
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_sort_parallel(struct Bench *bench) {
+    int rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        array_sort_parallel(array, bench_compare_ints, 0, 0);
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_lower_bound(struct Bench *bench) {
+    volatile int sink = 0;
+    int i, rep, key;
+    Array *array = bench_create_ints(bench->size, 1);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        for (i = 0; i < bench->size; i++) {
+            key = bench_random() % (2 * bench->size);
+            sink = array_lower_bound(array, &key, bench_compare_ints);
+        }
+        bench_stop(bench, bench->size);
+    }
+    (void) sink;
+    array_free(array);
+}
+
+static void bench_insert_sorted(struct Bench *bench) {
+    const int ops = bench->size < BENCH_MAX_SLOW_OPS ?
+        bench->size : BENCH_MAX_SLOW_OPS;
+    int i, rep, value;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 1);
+        bench_start(bench);
+        for (i = 0; i < ops; i++) {
+            value = bench_random() % (2 * bench->size);
+            array_insert_sorted(array, &value, bench_compare_ints);
+        }
+        bench_stop(bench, ops);
+        array_free(array);
+    }
+}
+
+static void bench_retain(struct Bench *bench) {
+    int rep;
+    for (rep = 0; rep < bench->repeat; rep++) {
+        Array *array = bench_create_ints(bench->size, 0);
+        bench_start(bench);
+        array_retain(array, bench_is_even, NULL);
+        bench_stop(bench, bench->size);
+        array_free(array);
+    }
+}
+
+static void bench_filter_into(struct Bench *bench) {
+    int rep;
+    ArrayPool *pool = array_pool_create(0);
+    Array *array = bench_create_ints(bench->size, 0);
+    Array *kept = array_create_ex(&bench_allocator, sizeof(int), 0);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        array_filter_into(pool, kept, array, bench_is_even, NULL);
+        bench_stop(bench, bench->size);
+    }
+    array_free(kept);
+    array_free(array);
+    array_pool_free(pool);
+}
+
+static void bench_add_int(void *result, const void *element, void *context) {
+    (void) context;
+    *(int64_t*) result += *(const int*) element;
+}
+
+static void bench_add_sum(void *result, const void *partial, void *context) {
+    (void) context;
+    *(int64_t*) result += *(const int64_t*) partial;
+}
+
+static void bench_reduce(struct Bench *bench) {
+    volatile int64_t sink = 0;
+    int rep;
+    ArrayPool *pool = array_pool_create(0);
+    Array *array = bench_create_ints(bench->size, 0);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        int64_t sum = 0;
+        bench_start(bench);
+        array_reduce(pool, array, &sum, sizeof(sum), bench_add_int,
+            bench_add_sum, NULL);
+        bench_stop(bench, bench->size);
+        sink += sum;
+    }
+    (void) sink;
+    array_free(array);
+    array_pool_free(pool);
+}
+
+/* Scan for a value that isn't there, with the kernels of the given level */
+static void bench_find_level(struct Bench *bench, int level) {
+    volatile int sink = 0;
+    int rep, missing = -1;
+    Array *array = bench_create_ints(bench->size, 0);
+    array_simd_set_level(level);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        sink += array_find(array, ARRAY_TYPE_INT32, &missing);
+        bench_stop(bench, bench->size);
+    }
+    (void) sink;
+    array_simd_set_level(-1);
+    array_free(array);
+}
+
+static void bench_find_scalar(struct Bench *bench) {
+    bench_find_level(bench, ARRAY_SIMD_NONE);
+}
+
+static void bench_find_simd(struct Bench *bench) {
+    bench_find_level(bench, -1);
+}
+
+static void bench_sum_level(struct Bench *bench, int level) {
+    volatile int64_t sink = 0;
+    int rep;
+    Array *array = bench_create_ints(bench->size, 0);
+    array_simd_set_level(level);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        int64_t sum;
+        bench_start(bench);
+        array_sum(array, ARRAY_TYPE_INT32, &sum);
+        bench_stop(bench, bench->size);
+        sink += sum;
+    }
+    (void) sink;
+    array_simd_set_level(-1);
+    array_free(array);
+}
+
+static void bench_sum_scalar(struct Bench *bench) {
+    bench_sum_level(bench, ARRAY_SIMD_NONE);
+}
+
+static void bench_sum_simd(struct Bench *bench) {
+    bench_sum_level(bench, -1);
+}
+
+/* Copy the whole array for a reader, which then drops it */
+static void bench_clone(struct Bench *bench) {
+    int rep;
+    Array *array = bench_create_ints(bench->size, 0);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        array_free(array_clone(array));
+        bench_stop(bench, bench->size);
+    }
+    array_free(array);
+}
+
+/*
+ * The same with a snapshot, which is dropped before the array is next
+ * written to, so nothing is copied. Snapshots only share elements from
+ * the default allocator.
+ */
+static void bench_snapshot(struct Bench *bench) {
+    int i, rep;
+    Array *array = int_array_create();
+    for (i = 0; i < bench->size; i++) {
+        int_array_push(array, bench_random());
+    }
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        array_free(array_snapshot(array));
+        int_array_set(array, rep % bench->size, rep);
+        bench_stop(bench, bench->size);
+    }
+    array_free(array);
+}
+
+static void bench_serialize_delta(struct Bench *bench) {
+    int rep;
+    Array *array = bench_create_ints(bench->size, 1);
+    for (rep = 0; rep < bench->repeat; rep++) {
+        bench_start(bench);
+        array_serialize(array, bench_discard, NULL, ARRAY_ENCODING_DELTA);
+        bench_stop(bench, bench->size);
+    }
+    array_free(array);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(struct Bench *bench);
+} bench_operations[] = {
+    {"push_pointers", bench_push_pointers},
+    {"push_ints", bench_push_ints},
+    {"push_reserved", bench_push_reserved},
+    {"push_front", bench_push_front},
+    {"queue", bench_queue},
+    {"insert_random", bench_insert_random},
+    {"remove_random", bench_remove_random},
+    {"swap_remove_random", bench_swap_remove_random},
+    {"edit_plain", bench_edit_plain},
+    {"edit_gap", bench_edit_gap},
+    {"get", bench_get},
+    {"span_scan", bench_span_scan},
+    {"sort_pointers", bench_sort_pointers},
+    {"sort_qsort", bench_sort_qsort},
+    {"sort_typed", bench_sort_typed},
+    {"sort_stable", bench_sort_stable},
+    {"sort_by_key", bench_sort_by_key},
+    {"sort_parallel", bench_sort_parallel},
+    {"lower_bound", bench_lower_bound},
+    {"insert_sorted", bench_insert_sorted},
+    {"retain", bench_retain},
+    {"filter_into", bench_filter_into},
+    {"reduce", bench_reduce},
+    {"find_scalar", bench_find_scalar},
+    {"find_simd", bench_find_simd},
+    {"sum_scalar", bench_sum_scalar},
+    {"sum_simd", bench_sum_simd},
+    {"clone", bench_clone},
+    {"snapshot", bench_snapshot},
+    {"serialize_delta", bench_serialize_delta}
+};
+
+#define BENCH_OPERATION_COUNT \
+    ((int) (sizeof(bench_operations) / sizeof(bench_operations[0])))
+
+/* Peak resident set size of the process so far, in kilobytes */
+static long bench_peak_rss(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+static int bench_compare_doubles(const void *a, const void *b) {
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/* Run the given operation once at the given size and fill in the result */
+static void bench_measure(int operation, int size,
+    struct BenchResult *result) {
+    struct Bench bench;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.size = size;
+    bench.repeat = size < BENCH_MIN_WORK ? BENCH_MIN_WORK / size : 1;
+    bench_operations[operation].run(&bench);
+
+    memset(result, 0, sizeof(*result));
+    strcpy(result->name, bench_operations[operation].name);
+    result->size = size;
+    result->ops = bench.ops;
+    result->ns_per_op = bench.ops > 0 ? bench.seconds * 1e9 / bench.ops : 0;
+    result->counter = bench.counter;
+    result->peak_rss_kb = bench_peak_rss();
+}
+
+/*
+ * Run bench_measure in a child process, which sends the result back
+ * through a pipe. Returns 1 if successful, 0 otherwise.
+ */
+static int bench_measure_in_child(int operation, int size,
+    struct BenchResult *result) {
+    int fds[2], status, received;
+    pid_t pid;
+
+    if (pipe(fds) != 0) {
+        return 0;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+
+    if (pid == 0) {
+        close(fds[0]);
+        bench_measure(operation, size, result);
+        status = write(fds[1], result, sizeof(*result)) ==
+            (ssize_t) sizeof(*result) ? 0 : 1;
+        _exit(status);
+    }
+
+    close(fds[1]);
+    received = pid > 0 &&
+        read(fds[0], result, sizeof(*result)) == (ssize_t) sizeof(*result);
+    close(fds[0]);
+
+    if (pid > 0 && (waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        received = 0;
+    }
+
+    return received;
+}
+
+/*
+ * Set the time of the result to the fastest of the given runs, and its
+ * spread to how much slower the median one was
+ */
+static void bench_summarize(struct BenchResult *result, double *ns_per_op,
+    int runs) {
+    qsort(ns_per_op, (size_t) runs, sizeof(ns_per_op[0]),
+        bench_compare_doubles);
+    result->ns_per_op = ns_per_op[0];
+    result->spread_pct = ns_per_op[0] > 0 ?
+        100.0 * (ns_per_op[runs / 2] / ns_per_op[0] - 1.0) : 0;
+}
+
+/* Read the results of an earlier run. Returns the number read. */
+static int bench_load_baseline(const char *path, struct BenchResult *results) {
+    char line[256];
+    int count = 0;
+    FILE *stream = fopen(path, "r");
+
+    if (stream == NULL) {
+        fprintf(stderr, "Can't open baseline %s\n", path);
+        return 0;
+    }
+
+    while (count < BENCH_MAX_RESULTS && fgets(line, sizeof(line), stream)) {
+        struct BenchResult *result = &results[count];
+        const int fields = sscanf(line, "%63[^,],%d,%ld,%lf,%lf",
+            result->name, &result->size, &result->ops, &result->ns_per_op,
+            &result->spread_pct);
+        if (fields >= 4) {
+            /* Baselines from before the spread was measured have none */
+            if (fields == 4) {
+                result->spread_pct = 0;
+            }
+            count++;
+        }
+    }
+
+    fclose(stream);
+    return count;
+}
+
+/*
+ * Compare a result against the baseline, if it has the same operation
+ * and size. A change within the noise of either run doesn't count, so
+ * the threshold is widened by the larger of the two spreads. Returns 1
+ * if the result is a regression, 0 otherwise.
+ */
+static int bench_compare(const struct BenchResult *result,
+    const struct BenchResult *baseline, int count, double threshold) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (baseline[i].size == result->size &&
+            strcmp(baseline[i].name, result->name) == 0) {
+            const double change = 100.0 *
+                (result->ns_per_op / baseline[i].ns_per_op - 1.0);
+            const double allowed = threshold +
+                (result->spread_pct > baseline[i].spread_pct ?
+                    result->spread_pct : baseline[i].spread_pct);
+            fprintf(stderr, "%-20s %10d %12.2f %12.2f %+8.1f%% %8.1f%%%s\n",
+                result->name, result->size, baseline[i].ns_per_op,
+                result->ns_per_op, change, allowed,
+                change > allowed ? "  REGRESSION" : "");
+            return change > allowed;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static struct BenchResult baseline[BENCH_MAX_RESULTS];
+    static struct BenchResult results[BENCH_MAX_RESULTS];
+    static double ns_per_op[BENCH_MAX_RESULTS][BENCH_MAX_RUNS];
+    static int operations[BENCH_MAX_RESULTS], sizes[BENCH_MAX_RESULTS];
+    const char *format = "csv", *baseline_path = NULL, *only = NULL;
+    double threshold = 10.0;
+    int max_size = 1000000, runs = 5, baseline_count = 0, regressions = 0;
+    int count = 0, run, i, size;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) {
+            max_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            format = argv[i + 1];
+        } else if (strcmp(argv[i], "-b") == 0) {
+            baseline_path = argv[i + 1];
+        } else if (strcmp(argv[i], "-t") == 0) {
+            threshold = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            runs = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            only = argv[i + 1];
+        } else {
+            break;
+        }
+    }
+
+    if (i < argc || max_size < 10 || max_size > BENCH_MAX_SIZE ||
+        runs < 1 || runs > BENCH_MAX_RUNS) {
+        fprintf(stderr, "Usage: %s [-n max_size] [-f csv|json] "
+            "[-b baseline.csv] [-t threshold_percent] [-r runs] "
+            "[-o operation]\n", argv[0]);
+        return 2;
+    }
+
+    if (baseline_path != NULL) {
+        /* Comparing against nothing must not pass for no regressions */
+        baseline_count = bench_load_baseline(baseline_path, baseline);
+        if (baseline_count == 0) {
+            fprintf(stderr, "No results in baseline %s\n", baseline_path);
+            return 2;
+        }
+        fprintf(stderr, "%-20s %10s %12s %12s %9s %9s\n", "operation",
+            "size", "baseline_ns", "current_ns", "change", "allowed");
+    }
+
+    /* Every operation at every size, in order */
+    for (i = 0; i < BENCH_OPERATION_COUNT; i++) {
+        if (only != NULL && strcmp(only, bench_operations[i].name) != 0) {
+            continue;
+        }
+        for (size = 10; size <= max_size && count < BENCH_MAX_RESULTS;
+            size *= 10) {
+            operations[count] = i;
+            sizes[count] = size;
+            count++;
+        }
+    }
+
+    for (run = 0; run < runs; run++) {
+        for (i = 0; i < count; i++) {
+            if (!bench_measure_in_child(operations[i], sizes[i],
+                &results[i])) {
+                fprintf(stderr, "Can't run %s at size %d\n",
+                    bench_operations[operations[i]].name, sizes[i]);
+                return 2;
+            }
+            ns_per_op[i][run] = results[i].ns_per_op;
+        }
+    }
+
+    if (strcmp(format, "json") == 0) {
+        printf("[\n");
+    } else {
+        printf("operation,size,ops,ns_per_op,spread_pct,ops_per_sec,"
+            "allocations,bytes_allocated,peak_rss_kb\n");
+    }
+
+    for (i = 0; i < count; i++) {
+        struct BenchResult *result = &results[i];
+        double ops_per_sec;
+
+        bench_summarize(result, ns_per_op[i], runs);
+        ops_per_sec = result->ns_per_op > 0 ? 1e9 / result->ns_per_op : 0;
+
+        if (strcmp(format, "json") == 0) {
+            printf("%s  {\"operation\": \"%s\", \"size\": %d, "
+                "\"ops\": %ld, \"ns_per_op\": %.3f, "
+                "\"spread_pct\": %.1f, \"ops_per_sec\": %.0f, "
+                "\"allocations\": %ld, \"bytes_allocated\": %lu, "
+                "\"peak_rss_kb\": %ld}",
+                i == 0 ? "" : ",\n", result->name, result->size,
+                result->ops, result->ns_per_op, result->spread_pct,
+                ops_per_sec, result->counter.allocations,
+                (unsigned long) result->counter.bytes, result->peak_rss_kb);
+        } else {
+            printf("%s,%d,%ld,%.3f,%.1f,%.0f,%ld,%lu,%ld\n", result->name,
+                result->size, result->ops, result->ns_per_op,
+                result->spread_pct, ops_per_sec, result->counter.allocations,
+                (unsigned long) result->counter.bytes, result->peak_rss_kb);
+        }
+
+        if (baseline_count > 0) {
+            regressions += bench_compare(result, baseline, baseline_count,
+                threshold);
+        }
+    }
+
+    if (strcmp(format, "json") == 0) {
+        printf("\n]\n");
+    }
+
+    if (regressions > 0) {
+        fprintf(stderr, "%d regression(s) over the allowed change\n",
+            regressions);
+        return 1;
+    }
+
+    return 0;
+}
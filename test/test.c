@@ -1,5 +1,35 @@
+#include <limits.h>
+#include <pthread.h>
 #include "test.h"
 #include "array.h"
+#include "array_concurrent.h"
+#include "array_file.h"
+#include "array_parallel.h"
+#include "array_segmented.h"
+#include "array_serialize.h"
+#include "array_simd.h"
+#include "array_sort.h"
+
+/* For typed array tests */
+struct Point {
+    double x;
+    double y;
+    char tag;
+};
+
+ARRAY_DEFINE(int_array, int)
+
+#define int_less(a, b) (*(a) < *(b))
+ARRAY_DEFINE_SORT(int_array_sort, int, int_less)
+ARRAY_DEFINE_SEARCH(int_array, int, int_less)
+
+/* Deterministic pseudo-random numbers for sorting tests */
+static unsigned long test_random_state = 1;
+
+static int test_random(void) {
+    test_random_state = test_random_state * 1103515245UL + 12345UL;
+    return (int) ((test_random_state >> 16) & 0x7fff);
+}
 
 static void test_array_create(void) {
     Array *array = array_create();
@@ -21,12 +51,206 @@ static void test_array_create_no_memory(void) {
 static void test_array_create_no_memory_for_elements(void) {
     Array *array;
     test_malloc_fail_after(1); /* Fail when allocating elements */
-    array = array_create();
+    array = array_create_typed(2 * ARRAY_SMALL_SIZE);
     test_malloc_enable();
     test_assert(array == NULL);
     array_free(array);
 }
 
+static void test_array_small(void) {
+    int i, capacity, a[5];
+    Array *array = array_create();
+    capacity = array_capacity(array);
+    test_assert(capacity == (int) (ARRAY_SMALL_SIZE / sizeof(void*)));
+    /* Nothing is allocated while the elements fit in the array */
+    test_malloc_disable();
+    for (i = 0; i < capacity; i++) {
+        test_assert(array_push(array, &a[i]) == 1);
+    }
+    if (test_can_fail_allocations()) {
+        test_assert(array_push(array, &a[4]) == 0);
+    }
+    test_malloc_enable();
+    test_assert(array_push(array, &a[4]) == 1);
+    test_assert(array_capacity(array) > capacity);
+    for (i = 0; i <= capacity; i++) {
+        test_assert(array_get(array, i) == &a[i]);
+    }
+    /* Shrinking moves them back in */
+    array_pop(array);
+    array_pop(array);
+    test_assert(array_shrink_to_fit(array) == 1);
+    test_assert(array_capacity(array) == capacity - 1);
+    for (i = 0; i < capacity - 1; i++) {
+        test_assert(array_get(array, i) == &a[i]);
+    }
+    array_free(array);
+}
+
+static void test_array_create_with_capacity(void) {
+    Array *array = array_create_with_capacity(1000);
+    test_assert(array != NULL);
+    test_assert(array_length(array) == 0);
+    test_assert(array_capacity(array) == 1000);
+    array_free(array);
+    test_assert(array_create_with_capacity(-1) == NULL);
+}
+
+static void test_array_create_with_zero_capacity(void) {
+    int a = 1;
+    Array *array = array_create_with_capacity(0);
+    test_assert(array != NULL);
+    test_assert(array_capacity(array) == 0);
+    test_assert(array_push(array, &a) == 1);
+    test_assert(array_capacity(array) > 0);
+    test_assert(array_get(array, 0) == &a);
+    array_free(array);
+}
+
+/* For allocator tests: keeps track of what has been allocated */
+struct TestAllocator {
+    long blocks;
+    long bytes;
+    long extends;
+};
+
+/* Blocks are at least this large, so that they can be extended */
+#define TEST_BLOCK_SIZE 256
+
+static void *test_allocate(void *context, size_t size) {
+    struct TestAllocator *counts = context;
+    counts->blocks++;
+    counts->bytes += size;
+    return malloc(size < TEST_BLOCK_SIZE ? TEST_BLOCK_SIZE : size);
+}
+
+static void test_deallocate(void *context, void *pointer, size_t size) {
+    struct TestAllocator *counts = context;
+    counts->blocks--;
+    counts->bytes -= size;
+    free(pointer);
+}
+
+/* Extends blocks in place up to the size that was really allocated */
+static int test_extend(void *context, void *pointer, size_t old_size,
+    size_t new_size) {
+    struct TestAllocator *counts = context;
+    (void) pointer;
+    if (new_size > TEST_BLOCK_SIZE) {
+        return 0;
+    }
+    counts->extends++;
+    counts->bytes += new_size - old_size;
+    return 1;
+}
+
+static void test_array_create_ex(void) {
+    struct TestAllocator counts = {0, 0, 0};
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    Array *array;
+    allocator.allocate = test_allocate;
+    allocator.deallocate = test_deallocate;
+    allocator.context = &counts;
+    array = array_create_ex(&allocator, sizeof(void*), 4);
+    test_assert(array != NULL);
+    test_assert(counts.blocks == 2);
+    test_assert(counts.bytes > (long) (4 * sizeof(void*)));
+    array_free(array);
+    test_assert(counts.blocks == 0);
+    test_assert(counts.bytes == 0);
+}
+
+static void test_array_create_ex_without_reallocate(void) {
+    int i;
+    int a[100];
+    struct TestAllocator counts = {0, 0, 0};
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    Array *array;
+    allocator.allocate = test_allocate;
+    allocator.deallocate = test_deallocate;
+    allocator.context = &counts;
+    array = array_create_ex(&allocator, sizeof(void*), 1);
+    for (i = 0; i < 100; i++) {
+        test_assert(array_push(array, &a[i]) == 1);
+    }
+    for (i = 0; i < 100; i++) {
+        test_assert(array_get(array, i) == &a[i]);
+    }
+    test_assert(counts.blocks == 2);
+    array_free(array);
+    test_assert(counts.blocks == 0);
+    test_assert(counts.bytes == 0);
+}
+
+static void test_array_create_ex_extends_in_place(void) {
+    int i;
+    struct TestAllocator counts = {0, 0, 0};
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    Array *array;
+    allocator.allocate = test_allocate;
+    allocator.deallocate = test_deallocate;
+    allocator.extend = test_extend;
+    allocator.context = &counts;
+    array = array_create_ex(&allocator, sizeof(void*), 2);
+    for (i = 0; i < 32; i++) {
+        array_push(array, NULL);
+    }
+    /* Grew from 2 to 32 elements without moving */
+    test_assert(counts.extends == 4);
+    test_assert(counts.blocks == 2);
+    array_free(array);
+    test_assert(counts.bytes == 0);
+}
+
+#ifdef ARRAY_INLINE_API
+static void test_array_init(void) {
+    int i, value;
+    struct TestAllocator counts = {0, 0, 0};
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    Array array;
+    test_malloc_disable();
+    test_assert(array_init(&array, NULL, sizeof(int)) == 1);
+    for (i = 0; i < (int) (ARRAY_SMALL_SIZE / sizeof(int)); i++) {
+        test_assert(int_array_push(&array, i) == 1);
+    }
+    test_malloc_enable();
+    for (; i < 100; i++) {
+        test_assert(int_array_push(&array, i) == 1);
+    }
+    for (i = 0; i < 100; i++) {
+        test_assert(int_array_get(&array, i, &value) && value == i);
+    }
+    array_destroy(&array);
+    test_assert(array_length(&array) == 0 && array_capacity(&array) == 0);
+    test_assert(int_array_push(&array, 1) == 1);
+    array_destroy(&array);
+
+    /* Arrays with their own allocator get all memory from it */
+    allocator.allocate = test_allocate;
+    allocator.deallocate = test_deallocate;
+    allocator.context = &counts;
+    test_assert(array_init(&array, &allocator, sizeof(void*)) == 1);
+    test_assert(array_capacity(&array) == 0 && counts.blocks == 0);
+    test_assert(array_push(&array, NULL) == 1 && counts.blocks == 1);
+    array_destroy(&array);
+    test_assert(counts.blocks == 0 && counts.bytes == 0);
+
+    test_assert(array_init(NULL, NULL, sizeof(int)) == 0);
+    test_assert(array_init(&array, NULL, 0) == 0);
+    allocator.deallocate = NULL;
+    test_assert(array_init(&array, &allocator, sizeof(int)) == 0);
+    array_destroy(NULL);
+}
+#endif
+
+static void test_array_create_ex_invalid_allocator(void) {
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    test_assert(array_create_ex(&allocator, sizeof(void*), 16) == NULL);
+    allocator.allocate = test_allocate;
+    test_assert(array_create_ex(&allocator, sizeof(void*), 16) == NULL);
+    test_assert(array_create_ex(NULL, sizeof(void*), -1) == NULL);
+}
+
 static void test_array_length_of_empty(void) {
     Array *array = array_create();
     test_assert(array_length(array) == 0);
@@ -182,6 +406,102 @@ static void test_array_remove_from_null(void) {
     test_assert(array_remove(NULL, 0) == NULL);
 }
 
+static void test_array_insert_range_at_middle(void) {
+    int a[] = {1, 2, 3, 4};
+    void *range[2];
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[3]);
+    range[0] = &a[1];
+    range[1] = &a[2];
+    test_assert(array_insert_range(array, 1, range, 2) == 1);
+    test_assert(array_length(array) == 4);
+    test_assert(array_get(array, 0) == &a[0]);
+    test_assert(array_get(array, 1) == &a[1]);
+    test_assert(array_get(array, 2) == &a[2]);
+    test_assert(array_get(array, 3) == &a[3]);
+    array_free(array);
+}
+
+static void test_array_insert_range_grows_once(void) {
+    int i;
+    void *range[100];
+    Array *array = array_create();
+    for (i = 0; i < 100; i++) {
+        range[i] = &range[i];
+    }
+    test_realloc_fail_after(1); /* Only a single reallocation is allowed */
+    test_assert(array_insert_range(array, 0, range, 100) == 1);
+    test_realloc_enable();
+    test_assert(array_length(array) == 100);
+    test_assert(array_capacity(array) >= 100);
+    for (i = 0; i < 100; i++) {
+        test_assert(array_get(array, i) == &range[i]);
+    }
+    array_free(array);
+}
+
+static void test_array_insert_range_out_of_bounds(void) {
+    void *range[1];
+    Array *array = array_create();
+    range[0] = NULL;
+    test_assert(array_insert_range(array, -1, range, 1) == 0);
+    test_assert(array_insert_range(array, 1, range, 1) == 0);
+    test_assert(array_insert_range(array, 0, range, -1) == 0);
+    test_assert(array_insert_range(array, 0, NULL, 1) == 0);
+    test_assert(array_insert_range(NULL, 0, range, 1) == 0);
+    test_assert(array_length(array) == 0);
+    array_free(array);
+}
+
+static void test_array_insert_range_no_memory(void) {
+    int i;
+    void *range[17];
+    Array *array = array_create();
+    for (i = 0; i < 17; i++) {
+        range[i] = NULL;
+    }
+    test_malloc_disable();
+    test_realloc_disable();
+    test_assert(array_insert_range(array, 0, range, 17) == 0);
+    test_realloc_enable();
+    test_malloc_enable();
+    test_assert(array_length(array) == 0);
+    array_free(array);
+}
+
+static void test_array_remove_range(void) {
+    int a[] = {1, 2, 3, 4};
+    void *out[2];
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    array_push(array, &a[2]);
+    array_push(array, &a[3]);
+    test_assert(array_remove_range(array, 1, 2, out) == 1);
+    test_assert(out[0] == &a[1]);
+    test_assert(out[1] == &a[2]);
+    test_assert(array_length(array) == 2);
+    test_assert(array_get(array, 0) == &a[0]);
+    test_assert(array_get(array, 1) == &a[3]);
+    test_assert(array_remove_range(array, 0, 2, NULL) == 1);
+    test_assert(array_length(array) == 0);
+    array_free(array);
+}
+
+static void test_array_remove_range_out_of_bounds(void) {
+    int a[] = {1, 2};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    test_assert(array_remove_range(array, -1, 1, NULL) == 0);
+    test_assert(array_remove_range(array, 1, 2, NULL) == 0);
+    test_assert(array_remove_range(array, 0, -1, NULL) == 0);
+    test_assert(array_remove_range(NULL, 0, 1, NULL) == 0);
+    test_assert(array_length(array) == 2);
+    array_free(array);
+}
+
 static void test_array_push_adds_to_end(void) {
     int a[] = {1, 2};
     Array *array = array_create();
@@ -240,9 +560,11 @@ static void test_array_capacity_no_memory(void) {
         array_push(array, NULL);
     }
     test_assert(array_capacity(array) == initial_capacity);
+    test_malloc_disable();
     test_realloc_disable();
     test_assert(array_push(array, NULL) == 0);
     test_realloc_enable();
+    test_malloc_enable();
     test_assert(array_capacity(array) == initial_capacity);
     array_free(array);
 }
@@ -257,114 +579,1087 @@ static void test_array_capacity_of_null(void) {
     test_assert(array_capacity(NULL) == 0);
 }
 
-static void test_array_pop_returns_element(void) {
-    int a[] = {1, 2};
+static void test_array_reserve(void) {
     Array *array = array_create();
-    array_push(array, &a[0]);
-    array_push(array, &a[1]);
-    test_assert(array_length(array) == 2);
-    test_assert((int*) array_pop(array) == &a[1]);
-    test_assert((int*) array_pop(array) == &a[0]);
-    test_assert(array_length(array) == 0);
+    test_assert(array_reserve(array, 1000) == 1);
+    test_assert(array_capacity(array) == 1000);
+    /* Reserving less than the capacity does nothing */
+    test_assert(array_reserve(array, 10) == 1);
+    test_assert(array_capacity(array) == 1000);
+    test_assert(array_reserve(array, -1) == 0);
+    test_assert(array_reserve(NULL, 10) == 0);
     array_free(array);
 }
 
-static void test_array_pop_from_empty(void) {
+static void test_array_reserve_no_memory(void) {
     Array *array = array_create();
-    test_assert(array_length(array) == 0);
-    test_assert((int*) array_pop(array) == NULL);
-    test_assert(array_length(array) == 0);
+    test_malloc_disable();
+    test_realloc_disable();
+    test_assert(array_reserve(array, 1000) == 0);
+    test_realloc_enable();
+    test_malloc_enable();
+    test_assert(array_capacity(array) > 0);
+    test_assert(array_capacity(array) < 1000);
     array_free(array);
 }
 
-static void test_array_pop_from_null(void) {
-    test_assert(array_pop(NULL) == NULL);
+static void test_array_shrink_to_fit(void) {
+    int a[] = {1, 2, 3};
+    Array *array = array_create_with_capacity(100);
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    array_push(array, &a[2]);
+    test_assert(array_shrink_to_fit(array) == 1);
+    test_assert(array_capacity(array) == 3);
+    test_assert(array_get(array, 0) == &a[0]);
+    test_assert(array_get(array, 2) == &a[2]);
+    /* Should still be able to grow afterwards */
+    test_assert(array_push(array, &a[0]) == 1);
+    test_assert(array_length(array) == 4);
+    array_free(array);
+    test_assert(array_shrink_to_fit(NULL) == 0);
 }
 
-static void test_array_get(void) {
-    int a[] = {1, 2};
+static void test_array_shrink_to_fit_empty(void) {
     Array *array = array_create();
-    array_push(array, &a[0]);
-    array_push(array, &a[1]);
-    test_assert((int*) array_get(array, 0) == &a[0]);
-    test_assert((int*) array_get(array, 1) == &a[1]);
+    test_assert(array_shrink_to_fit(array) == 1);
+    test_assert(array_capacity(array) == 0);
+    test_assert(array_push(array, NULL) == 1);
+    test_assert(array_length(array) == 1);
     array_free(array);
 }
 
-static void test_array_get_out_of_bounds(void) {
-    int a[] = {1, 2};
+static void test_array_shrink_threshold(void) {
+    int i;
     Array *array = array_create();
-    array_push(array, &a[0]);
-    array_push(array, &a[1]);
-    test_assert((int*) array_get(array, -1) == NULL);
-    test_assert((int*) array_get(array, 2) == NULL);
+    test_assert(array_set_shrink_threshold(array, 0.25) == 1);
+    for (i = 0; i < 1024; i++) {
+        array_push(array, NULL);
+    }
+    test_assert(array_capacity(array) == 1024);
+    /* Not below the threshold yet */
+    array_remove_range(array, 0, 768, NULL);
+    test_assert(array_capacity(array) == 1024);
+    /* Dropping below it leaves the array half full */
+    array_pop(array);
+    test_assert(array_length(array) == 255);
+    test_assert(array_capacity(array) == 510);
     array_free(array);
 }
 
-static void test_array_get_from_empty(void) {
+static void test_array_shrink_threshold_invalid(void) {
     Array *array = array_create();
-    test_assert(array_get(array, -1) == NULL);
-    test_assert(array_get(array, 0) == NULL);
-    test_assert(array_get(array, 1) == NULL);
+    test_assert(array_set_shrink_threshold(array, -0.1) == 0);
+    test_assert(array_set_shrink_threshold(array, 0.5) == 0);
+    test_assert(array_set_shrink_threshold(NULL, 0.25) == 0);
+    test_assert(array_set_shrink_threshold(array, 0) == 1);
     array_free(array);
 }
 
-static void test_array_get_from_null(void) {
-    test_assert(array_get(NULL, -1) == NULL);
-    test_assert(array_get(NULL, 0) == NULL);
-    test_assert(array_get(NULL, 1) == NULL);
+static void test_array_growth_policies(void) {
+    int i, range[37] = {0};
+    Array *array = array_create_ex(NULL, sizeof(int), 16);
+    test_assert(array_set_growth_policy(array, ARRAY_GROWTH_HALF, 0) == 1);
+    for (i = 0; i < 17; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_capacity(array) == 24);
+    for (; i < 25; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_capacity(array) == 36);
+    test_assert(array_set_growth_policy(array, ARRAY_GROWTH_LINEAR, 10) == 1);
+    for (; i < 37; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_capacity(array) == 46);
+    /* Growing to fit many elements at once still reallocates once */
+    test_assert(array_insert_range(array, 0, range, 37));
+    test_assert(array_capacity(array) == 76 && array_length(array) == 74);
+    array_free(array);
+
+    array = int_array_create();
+    test_assert(array_set_growth_policy(array, ARRAY_GROWTH_PAGES, 4096));
+    for (i = 0; i < 17; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_capacity(array) == 4096 / sizeof(int));
+    for (i = 0; i < 17; i++) {
+        test_assert(*int_array_at(array, i) == i);
+    }
+    array_free(array);
 }
 
-static void test_array_set(void) {
-    int a[] = {1, 2};
+static void test_array_growth_policy_invalid(void) {
     Array *array = array_create();
-    array_push(array, &a[0]);
-    test_assert(array_get(array, 0) == &a[0]);
-    test_assert(array_set(array, 0, &a[1]) == 1);
-    test_assert(array_get(array, 0) == &a[1]);
+    test_assert(array_set_growth_policy(NULL, ARRAY_GROWTH_HALF, 0) == 0);
+    test_assert(array_set_growth_policy(array, -1, 0) == 0);
+    test_assert(array_set_growth_policy(array, 4, 0) == 0);
+    test_assert(array_set_growth_policy(array, ARRAY_GROWTH_LINEAR, 0) == 0);
+    test_assert(array_set_growth_policy(array, ARRAY_GROWTH_PAGES, 0) == 0);
+    test_assert(array_set_growth_policy(array, ARRAY_GROWTH_DOUBLE, 0));
+    array_free(array);
 }
 
-static void test_array_set_out_of_bounds(void) {
-    Array *array = array_create();
-    test_assert(array_set(array, -1, NULL) == 0);
-    test_assert(array_set(array, 1, NULL) == 0);
+static void test_array_capacity_overflow(void) {
+    /* The size in bytes of a fifth element would wrap around */
+    const size_t huge = (size_t) -1 / 4;
+    Array *array = array_create_ex(NULL, huge, 0);
+    test_assert(array != NULL);
+    test_assert(array_reserve(array, 5) == 0);
+    test_assert(array_reserve(array, INT_MAX) == 0);
+    test_assert(array_capacity(array) == 0);
+    test_assert(array_create_ex(NULL, huge, 5) == NULL);
     array_free(array);
 }
 
-static void test_array_set_in_empty(void) {
-    Array *array = array_create();
-    test_assert(array_set(array, 0, NULL) == 0);
+static void test_array_gap_buffer(void) {
+    int i, j, value, range[3] = {-1, -2, -3};
+    Array *gap = int_array_create();
+    Array *plain = int_array_create();
+    test_assert(array_set_gap_buffer(gap, 1));
+    test_assert(array_set_gap_buffer(NULL, 1) == 0);
+    /* Random edits around a wandering position give the same elements */
+    for (i = 0; i < 2000; i++) {
+        const int length = array_length(plain);
+        const int index = length > 0 ? test_random() % (length + 1) : 0;
+        switch (test_random() % 8) {
+            case 0:
+            case 1:
+            case 2:
+                test_assert(int_array_insert(gap, index, i));
+                int_array_insert(plain, index, i);
+                break;
+            case 3:
+                test_assert(array_insert_range(gap, index, range, 3));
+                array_insert_range(plain, index, range, 3);
+                break;
+            case 4:
+                if (index < length) {
+                    test_assert(int_array_remove(gap, index, &value));
+                    int_array_remove(plain, index, &j);
+                    test_assert(value == j);
+                }
+                break;
+            case 5:
+                if (index + 2 <= length) {
+                    test_assert(array_remove_range(gap, index, 2, range));
+                    array_remove_range(plain, index, 2, range);
+                    range[0] = -1;
+                    range[1] = -2;
+                }
+                break;
+            case 6:
+                if (index < length) {
+                    test_assert(int_array_swap_remove(gap, index, &value));
+                    int_array_swap_remove(plain, index, &j);
+                    test_assert(value == j);
+                }
+                break;
+            default:
+                test_assert(int_array_push_front(gap, i));
+                int_array_push_front(plain, i);
+                test_assert(int_array_set(gap, index, -i));
+                int_array_set(plain, index, -i);
+                break;
+        }
+        test_assert(array_length(gap) == array_length(plain));
+        for (j = 0; j < array_length(plain); j++) {
+            test_assert(*int_array_at(gap, j) == *int_array_at(plain, j));
+        }
+    }
+    test_assert(memcmp(array_span(gap).elements, array_span(plain).elements,
+        sizeof(int) * array_length(plain)) == 0);
+    array_free(gap);
+    array_free(plain);
+}
+
+static void test_array_gap_buffer_close(void) {
+    int i;
+    Array *array = int_array_create();
+    test_assert(array_set_gap_buffer(array, 1));
+    for (i = 0; i < 100; i++) {
+        int_array_push(array, 10 * i);
+    }
+    /* Type a descending run in the middle, leaving the gap after it */
+    for (i = 0; i < 9; i++) {
+        test_assert(int_array_insert(array, 51 + i, 509 - i));
+    }
+    test_assert(*int_array_at(array, 55) == 505);
+    test_assert(*int_array_at(array, 60) == 510);
+    int_array_sort(array);
+    for (i = 0; i < 9; i++) {
+        test_assert(*int_array_at(array, 51 + i) == 501 + i);
+    }
+    test_assert(int_array_lower_bound(array, 505) == 55);
+    test_assert(int_array_insert(array, 10, -1));
+    test_assert(array_set_gap_buffer(array, 0));
+    test_assert(*int_array_at(array, 10) == -1);
+    test_assert(int_array_span(array, &i)[11] == 100 && i == 110);
     array_free(array);
 }
 
-static void test_array_set_in_null(void) {
-    test_assert(array_set(NULL, 0, NULL) == 0);
+static void test_array_clone(void) {
+    int i, value;
+    struct TestAllocator counts = {0, 0, 0};
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    Array *array = int_array_create();
+    Array *clone;
+    for (i = 0; i < 100; i++) {
+        int_array_push(array, i);
+    }
+    /* A gap in the middle is skipped, and stays where it is */
+    test_assert(array_set_gap_buffer(array, 1));
+    test_assert(int_array_insert(array, 50, -1));
+    clone = array_clone(array);
+    test_assert(clone != NULL && array_length(clone) == 101);
+    test_assert(array_capacity(clone) == 101);
+    for (i = 0; i < 101; i++) {
+        test_assert(int_array_get(clone, i, &value));
+        test_assert(value == (i < 50 ? i : i == 50 ? -1 : i - 1));
+    }
+    test_assert(int_array_set(clone, 0, 7));
+    test_assert(int_array_get(array, 0, &value) && value == 0);
+    test_assert(int_array_insert(array, 51, -2));
+    test_assert(*int_array_at(array, 50) == -1);
+    array_free(clone);
+    array_free(array);
+
+    /* Clones of arrays with their own allocator use the default one */
+    allocator.allocate = test_allocate;
+    allocator.deallocate = test_deallocate;
+    allocator.context = &counts;
+    array = array_create_ex(&allocator, sizeof(void*), 4);
+    test_assert(array_push(array, &value));
+    clone = array_clone(array);
+    test_assert(clone != NULL && counts.blocks == 2);
+    array_free(array);
+    test_assert(array_get(clone, 0) == &value);
+    /* Unless they are given one */
+    array = array_clone_ex(clone, &allocator);
+    test_assert(array != NULL && counts.blocks == 2);
+    test_assert(array_get(array, 0) == &value);
+    array_free(array);
+    test_assert(counts.blocks == 0 && counts.bytes == 0);
+    allocator.deallocate = NULL;
+    test_assert(array_clone_ex(clone, &allocator) == NULL);
+    array_free(clone);
+
+    array = int_array_create();
+    clone = array_clone(array);
+    test_assert(clone != NULL && array_length(clone) == 0);
+    test_assert(int_array_push(clone, 1));
+    array_free(clone);
+    array_free(array);
+    test_assert(array_clone(NULL) == NULL);
 }
 
-static void test_array_last(void) {
+static void test_array_snapshot(void) {
+    int i, value, a[30];
+    const void *elements;
+    Array *array = int_array_create();
+    Array *snapshot, *second;
+    for (i = 0; i < 100; i++) {
+        int_array_push(array, i);
+    }
+    /* The elements are shared until the array is next written to */
+    snapshot = array_snapshot(array);
+    test_assert(snapshot != NULL && array_length(snapshot) == 100);
+    test_assert(array_span(snapshot).elements == array_span(array).elements);
+    test_assert(int_array_set(array, 0, -1));
+    test_assert(array_span(snapshot).elements != array_span(array).elements);
+    test_assert(int_array_get(snapshot, 0, &value) && value == 0);
+    test_assert(int_array_get(array, 0, &value) && value == -1);
+
+    /* Snapshots of snapshots share as well, and the last one keeps them */
+    second = array_snapshot(snapshot);
+    elements = array_span(second).elements;
+    test_assert(elements == array_span(snapshot).elements);
+    array_free(snapshot);
+    test_assert(int_array_push(second, 100));
+    test_assert(array_span(second).elements == elements);
+    for (i = 0; i <= 100; i++) {
+        test_assert(int_array_get(second, i, &value) && value == i);
+    }
+    array_free(second);
+
+    /* Every kind of change copies, whichever array makes it */
+    snapshot = array_snapshot(array);
+    test_assert(int_array_pop_front(snapshot, &value) && value == -1);
+    test_assert(int_array_get(array, 0, &value) && value == -1);
+    array_free(snapshot);
+    snapshot = array_snapshot(array);
+    test_assert(int_array_insert(array, 50, -2));
+    test_assert(array_length(snapshot) == 100);
+    test_assert(int_array_get(snapshot, 50, &value) && value == 50);
+    array_free(snapshot);
+    snapshot = array_snapshot(array);
+    *int_array_at(array, 1) = -3;
+    test_assert(int_array_get(snapshot, 1, &value) && value == 1);
+    array_free(snapshot);
+    snapshot = array_snapshot(array);
+    int_array_sort(array);
+    test_assert(int_array_get(snapshot, 0, &value) && value == -1);
+    test_assert(int_array_get(array, 0, &value) && value == -3);
+    array_free(array);
+    test_assert(int_array_get(snapshot, 100, &value) && value == 99);
+    array_free(snapshot);
+
+    /* The inline fast paths copy too */
+    array = array_create();
+    for (i = 0; i < 20; i++) {
+        test_assert(array_push(array, &a[i]));
+    }
+    snapshot = array_snapshot(array);
+    test_assert(array_push(array, &a[20]));
+    test_assert(array_span(snapshot).elements != array_span(array).elements);
+    test_assert(array_length(snapshot) == 20);
+    array_free(snapshot);
+    snapshot = array_snapshot(array);
+    test_assert(array_set(array, 3, NULL));
+    test_assert(array_get(snapshot, 3) == &a[3]);
+    test_assert(array_last(snapshot) == &a[20]);
+    array_free(snapshot);
+    array_free(array);
+
+    /* Small arrays get a copy */
+    array = int_array_create();
+    int_array_push(array, 1);
+    snapshot = array_snapshot(array);
+    test_assert(array_span(snapshot).elements != array_span(array).elements);
+    test_assert(int_array_get(snapshot, 0, &value) && value == 1);
+    array_free(array);
+    array_free(snapshot);
+    test_assert(array_snapshot(NULL) == NULL);
+    test_assert(array_unshare(NULL) == 0);
+}
+
+static void test_array_snapshot_no_memory(void) {
+    int i, value;
+    Array *array = int_array_create();
+    Array *snapshot;
+    for (i = 0; i < 100; i++) {
+        int_array_push(array, i);
+    }
+    snapshot = array_snapshot(array);
+    /* Writing fails when there is no memory to copy into */
+    test_malloc_disable();
+    test_assert(int_array_set(array, 0, -1) == 0);
+    test_assert(int_array_at(array, 0) == NULL);
+    test_assert(array_snapshot(array) == NULL);
+    test_malloc_enable();
+    test_assert(int_array_get(array, 0, &value) && value == 0);
+    array_free(snapshot);
+    array_free(array);
+}
+
+#define TEST_SNAPSHOT_READERS 4
+#define TEST_SNAPSHOT_LENGTH 1000
+
+/* Check that the snapshot holds 0 to TEST_SNAPSHOT_LENGTH, then free it */
+static void *test_read_snapshot(void *argument) {
+    Array *snapshot = argument;
+    int i, value, valid = array_length(snapshot) == TEST_SNAPSHOT_LENGTH;
+    for (i = 0; i < array_length(snapshot); i++) {
+        valid = valid && int_array_get(snapshot, i, &value) && value == i;
+    }
+    array_free(snapshot);
+    return valid ? NULL : argument;
+}
+
+static void test_array_snapshot_threads(void) {
+    pthread_t readers[TEST_SNAPSHOT_READERS];
+    void *result;
+    int i, j;
+    Array *array = int_array_create();
+    for (i = 0; i < TEST_SNAPSHOT_LENGTH; i++) {
+        int_array_push(array, i);
+    }
+    /* Readers free their snapshot while the array is being written to */
+    for (i = 0; i < TEST_SNAPSHOT_READERS; i++) {
+        Array *snapshot = array_snapshot(array);
+        test_assert(snapshot != NULL);
+        test_assert(pthread_create(&readers[i], NULL, test_read_snapshot,
+            snapshot) == 0);
+        for (j = 0; j < TEST_SNAPSHOT_LENGTH; j++) {
+            test_assert(int_array_set(array, j, -j));
+        }
+        for (j = 0; j < TEST_SNAPSHOT_LENGTH; j++) {
+            test_assert(int_array_set(array, j, j));
+        }
+    }
+    for (i = 0; i < TEST_SNAPSHOT_READERS; i++) {
+        pthread_join(readers[i], &result);
+        test_assert(result == NULL);
+    }
+    array_free(array);
+}
+
+static void test_array_pop_returns_element(void) {
     int a[] = {1, 2};
     Array *array = array_create();
     array_push(array, &a[0]);
-    test_assert((int*) array_last(array) == &a[0]);
     array_push(array, &a[1]);
-    test_assert((int*) array_last(array) == &a[1]);
+    test_assert(array_length(array) == 2);
+    test_assert((int*) array_pop(array) == &a[1]);
+    test_assert((int*) array_pop(array) == &a[0]);
+    test_assert(array_length(array) == 0);
     array_free(array);
 }
 
-static void test_array_last_of_empty(void) {
+static void test_array_pop_from_empty(void) {
     Array *array = array_create();
-    test_assert((int*) array_last(array) == NULL);
+    test_assert(array_length(array) == 0);
+    test_assert((int*) array_pop(array) == NULL);
+    test_assert(array_length(array) == 0);
     array_free(array);
 }
 
-static void test_array_last_of_null(void) {
-    test_assert(array_last(NULL) == NULL);
+static void test_array_pop_from_null(void) {
+    test_assert(array_pop(NULL) == NULL);
 }
 
-/* For sorting test */
-static int compare(const void *a, const void *b) {
-    return **(int**) a - **(int**) b;
-}
+static void test_array_push_front(void) {
+    int a[] = {1, 2, 3};
+    Array *array = array_create();
+    test_assert(array_push_front(array, &a[0]) == 1);
+    test_assert(array_push_front(array, &a[1]) == 1);
+    test_assert(array_push(array, &a[2]) == 1);
+    test_assert(array_length(array) == 3);
+    test_assert((int*) array_get(array, 0) == &a[1]);
+    test_assert((int*) array_get(array, 1) == &a[0]);
+    test_assert((int*) array_get(array, 2) == &a[2]);
+    test_assert(array_push_front(NULL, &a[0]) == 0);
+    array_free(array);
+}
+
+static void test_array_pop_front(void) {
+    int a[] = {1, 2};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    test_assert((int*) array_pop_front(array) == &a[0]);
+    test_assert((int*) array_pop_front(array) == &a[1]);
+    test_assert(array_pop_front(array) == NULL);
+    test_assert(array_length(array) == 0);
+    test_assert(array_pop_front(NULL) == NULL);
+    array_free(array);
+}
+
+static void test_array_push_front_many(void) {
+    int i, value;
+    Array *array = int_array_create();
+    for (i = 0; i < 1000; i++) {
+        test_assert(int_array_push_front(array, i) == 1);
+    }
+    for (i = 0; i < 1000; i++) {
+        test_assert(int_array_get(array, i, &value) == 1);
+        test_assert(value == 999 - i);
+    }
+    test_assert(array_capacity(array) <= 4000);
+    array_free(array);
+}
+
+static void test_array_queue_capacity_stays_bounded(void) {
+    int i, value;
+    Array *array = int_array_create();
+    for (i = 0; i < 10; i++) {
+        int_array_push(array, i);
+    }
+    for (i = 10; i < 100000; i++) {
+        test_assert(int_array_pop_front(array, &value) == 1);
+        test_assert(value == i - 10);
+        test_assert(int_array_push(array, i) == 1);
+    }
+    test_assert(array_length(array) == 10);
+    test_assert(array_capacity(array) <= 32);
+    array_free(array);
+}
+
+static void test_array_queue_when_full(void) {
+    int i, value;
+    Array *array = array_create_ex(NULL, sizeof(int), 1000);
+    for (i = 0; i < 1000; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_capacity(array) == 1000);
+    for (i = 1000; i < 100000; i++) {
+        int_array_pop_front(array, &value);
+        test_assert(value == i - 1000);
+        int_array_push(array, i);
+    }
+    /* Grew once instead of moving all elements on every push */
+    test_assert(array_capacity(array) == 2000);
+    array_free(array);
+}
+
+static void test_array_deque_matches_model(void) {
+    int model[512];
+    int i, j, length = 0, value;
+    Array *array = int_array_create();
+    for (i = 0; i < 20000; i++) {
+        const int operation = test_random() % 6;
+        const int index = length > 0 ? test_random() % length : 0;
+        if (operation == 0 && length < 512) {
+            memmove(&model[1], &model[0], sizeof(int) * length);
+            model[0] = i;
+            length++;
+            test_assert(int_array_push_front(array, i) == 1);
+        } else if (operation == 1 && length < 512) {
+            model[length++] = i;
+            test_assert(int_array_push(array, i) == 1);
+        } else if (operation == 2 && length < 512) {
+            memmove(&model[index + 1], &model[index],
+                sizeof(int) * (length - index));
+            model[index] = i;
+            length++;
+            test_assert(int_array_insert(array, index, i) == 1);
+        } else if (operation == 3 && length > 0) {
+            test_assert(int_array_pop_front(array, &value) == 1);
+            test_assert(value == model[0]);
+            memmove(&model[0], &model[1], sizeof(int) * --length);
+        } else if (operation == 4 && length > 0) {
+            test_assert(int_array_remove(array, index, &value) == 1);
+            test_assert(value == model[index]);
+            memmove(&model[index], &model[index + 1],
+                sizeof(int) * (--length - index));
+        } else if (length > 0) {
+            test_assert(int_array_pop(array, &value) == 1);
+            test_assert(value == model[--length]);
+        }
+        test_assert(array_length(array) == length);
+    }
+    for (j = 0; j < length; j++) {
+        test_assert(*int_array_at(array, j) == model[j]);
+    }
+    array_free(array);
+}
+
+static void test_array_pop_front_shrinks(void) {
+    int i, value;
+    Array *array = int_array_create();
+    array_set_shrink_threshold(array, 0.25);
+    for (i = 0; i < 1024; i++) {
+        int_array_push(array, i);
+    }
+    for (i = 0; i < 1000; i++) {
+        int_array_pop_front(array, &value);
+    }
+    test_assert(array_capacity(array) < 1024);
+    for (i = 0; i < 24; i++) {
+        test_assert(int_array_get(array, i, &value) == 1);
+        test_assert(value == 1000 + i);
+    }
+    test_assert(array_reserve(array, 2000) == 1);
+    test_assert(array_shrink_to_fit(array) == 1);
+    test_assert(array_capacity(array) == 24);
+    test_assert(int_array_get(array, 23, &value) == 1 && value == 1023);
+    array_free(array);
+}
+
+static void test_array_swap_remove(void) {
+    int a[] = {1, 2, 3};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    array_push(array, &a[2]);
+    test_assert((int*) array_swap_remove(array, 0) == &a[0]);
+    test_assert(array_length(array) == 2);
+    test_assert((int*) array_get(array, 0) == &a[2]);
+    test_assert((int*) array_get(array, 1) == &a[1]);
+    test_assert((int*) array_swap_remove(array, 1) == &a[1]);
+    test_assert(array_swap_remove(array, 1) == NULL);
+    test_assert((int*) array_swap_remove(array, 0) == &a[2]);
+    test_assert(array_length(array) == 0);
+    test_assert(array_swap_remove(NULL, 0) == NULL);
+    array_free(array);
+}
+
+static int is_multiple(const void *element, void *context) {
+    return *(const int*) element % *(int*) context == 0;
+}
+
+static void test_array_retain(void) {
+    int i, value, divisor = 3;
+    Array *array = int_array_create();
+    for (i = 0; i < 3000; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_retain(array, is_multiple, &divisor) == 2000);
+    test_assert(array_length(array) == 1000);
+    for (i = 0; i < 1000; i++) {
+        test_assert(int_array_get(array, i, &value) == 1);
+        test_assert(value == 3 * i);
+    }
+    divisor = 2;
+    test_assert(array_remove_if(array, is_multiple, &divisor) == 500);
+    for (i = 0; i < 500; i++) {
+        test_assert(int_array_get(array, i, &value) == 1);
+        test_assert(value == 6 * i + 3);
+    }
+    divisor = 1;
+    test_assert(array_retain(array, is_multiple, &divisor) == 0);
+    test_assert(array_remove_if(array, is_multiple, &divisor) == 500);
+    test_assert(array_length(array) == 0);
+    test_assert(array_retain(NULL, is_multiple, &divisor) == 0);
+    test_assert(array_retain(array, NULL, &divisor) == 0);
+    array_free(array);
+}
+
+static void test_array_span(void) {
+    int i, length, sum = 0;
+    const int *values;
+    ArraySpan span;
+    Array *array = int_array_create();
+    for (i = 1; i <= 100; i++) {
+        int_array_push(array, i);
+    }
+    span = array_span(array);
+    test_assert(span.length == 100);
+    test_assert(span.element_size == sizeof(int));
+    test_assert(span.elements == array_at(array, 0));
+    values = int_array_span(array, &length);
+    test_assert(length == 100);
+    for (i = 0; i < length; i++) {
+        sum += values[i];
+    }
+    test_assert(sum == 5050);
+    array_free(array);
+}
+
+static void test_array_span_of_empty(void) {
+    int length = -1;
+    Array *array = array_create_with_capacity(0);
+    ArraySpan span = array_span(array);
+    test_assert(span.elements == NULL && span.length == 0);
+    span = array_span(NULL);
+    test_assert(span.elements == NULL && span.length == 0);
+    test_assert(span.element_size == 0);
+    test_assert(int_array_span(array, &length) == NULL && length == 0);
+    array_free(array);
+}
+
+static int add_until_negative(void *element, void *context) {
+    if (*(int*) element < 0) {
+        return 1;
+    }
+    *(int*) context += *(int*) element;
+    *(int*) element = 0;
+    return 0;
+}
+
+static void test_array_foreach(void) {
+    int i, sum = 0;
+    Array *array = int_array_create();
+    for (i = 1; i <= 10; i++) {
+        int_array_push(array, i);
+    }
+    test_assert(array_foreach(array, add_until_negative, &sum) == 10);
+    test_assert(sum == 55);
+    test_assert(*int_array_at(array, 9) == 0);
+    int_array_set(array, 4, -1);
+    test_assert(array_foreach(array, add_until_negative, &sum) == 4);
+    test_assert(array_foreach(NULL, add_until_negative, &sum) == 0);
+    test_assert(array_foreach(array, NULL, &sum) == 0);
+    array_free(array);
+}
+
+static void test_array_get(void) {
+    int a[] = {1, 2};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    test_assert((int*) array_get(array, 0) == &a[0]);
+    test_assert((int*) array_get(array, 1) == &a[1]);
+    array_free(array);
+}
+
+static void test_array_get_out_of_bounds(void) {
+    int a[] = {1, 2};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    test_assert((int*) array_get(array, -1) == NULL);
+    test_assert((int*) array_get(array, 2) == NULL);
+    array_free(array);
+}
+
+static void test_array_get_from_empty(void) {
+    Array *array = array_create();
+    test_assert(array_get(array, -1) == NULL);
+    test_assert(array_get(array, 0) == NULL);
+    test_assert(array_get(array, 1) == NULL);
+    array_free(array);
+}
+
+static void test_array_get_from_null(void) {
+    test_assert(array_get(NULL, -1) == NULL);
+    test_assert(array_get(NULL, 0) == NULL);
+    test_assert(array_get(NULL, 1) == NULL);
+}
+
+static void test_array_set(void) {
+    int a[] = {1, 2};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    test_assert(array_get(array, 0) == &a[0]);
+    test_assert(array_set(array, 0, &a[1]) == 1);
+    test_assert(array_get(array, 0) == &a[1]);
+}
+
+static void test_array_set_out_of_bounds(void) {
+    Array *array = array_create();
+    test_assert(array_set(array, -1, NULL) == 0);
+    test_assert(array_set(array, 1, NULL) == 0);
+    array_free(array);
+}
+
+static void test_array_set_in_empty(void) {
+    Array *array = array_create();
+    test_assert(array_set(array, 0, NULL) == 0);
+    array_free(array);
+}
+
+static void test_array_set_in_null(void) {
+    test_assert(array_set(NULL, 0, NULL) == 0);
+}
+
+static void test_array_last(void) {
+    int a[] = {1, 2};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    test_assert((int*) array_last(array) == &a[0]);
+    array_push(array, &a[1]);
+    test_assert((int*) array_last(array) == &a[1]);
+    /* The last element of a gap buffer is after the gap */
+    array_set_gap_buffer(array, 1);
+    array_insert(array, 1, &a[0]);
+    test_assert((int*) array_last(array) == &a[1]);
+    array_free(array);
+}
+
+static void test_array_last_of_empty(void) {
+    Array *array = array_create();
+    test_assert((int*) array_last(array) == NULL);
+    array_free(array);
+}
+
+static void test_array_last_of_null(void) {
+    test_assert(array_last(NULL) == NULL);
+}
+
+static void test_array_create_typed(void) {
+    Array *array = array_create_typed(sizeof(struct Point));
+    test_assert(array != NULL);
+    test_assert(array_length(array) == 0);
+    test_assert(array_element_size(array) == sizeof(struct Point));
+    array_free(array);
+    test_assert(array_create_typed(0) == NULL);
+    test_assert(array_element_size(NULL) == 0);
+}
+
+static void test_array_value_functions(void) {
+    int i;
+    struct Point p, q;
+    Array *array = array_create_typed(sizeof(struct Point));
+    for (i = 0; i < 100; i++) {
+        p.x = i;
+        p.y = -i;
+        p.tag = (char) i;
+        test_assert(array_push_value(array, &p) == 1);
+    }
+    p.x = 1000;
+    test_assert(array_insert_value(array, 50, &p) == 1);
+    test_assert(array_length(array) == 101);
+    test_assert(array_get_value(array, 50, &q) == 1);
+    test_assert(q.x == 1000);
+    test_assert(array_get_value(array, 51, &q) == 1);
+    test_assert(q.x == 50 && q.y == -50 && q.tag == 50);
+    test_assert(array_remove_value(array, 50, &q) == 1);
+    test_assert(q.x == 1000);
+    test_assert(array_pop_value(array, &q) == 1);
+    test_assert(q.x == 99);
+    test_assert(array_length(array) == 99);
+    p.x = 7;
+    test_assert(array_set_value(array, 0, &p) == 1);
+    test_assert(((struct Point*) array_at(array, 0))->x == 7);
+    /* Elements are contiguous */
+    test_assert(((struct Point*) array_at(array, 0))[98].x == 98);
+    array_free(array);
+}
+
+static void test_array_value_functions_out_of_bounds(void) {
+    int value = 1;
+    Array *array = array_create_typed(sizeof(int));
+    test_assert(array_get_value(array, 0, &value) == 0);
+    test_assert(array_set_value(array, 0, &value) == 0);
+    test_assert(array_remove_value(array, 0, &value) == 0);
+    test_assert(array_pop_value(array, &value) == 0);
+    test_assert(array_insert_value(array, 1, &value) == 0);
+    test_assert(array_push_value(array, NULL) == 0);
+    test_assert(array_at(array, 0) == NULL);
+    test_assert(array_push_value(NULL, &value) == 0);
+    test_assert(array_at(NULL, 0) == NULL);
+    test_assert(value == 1);
+    array_free(array);
+}
+
+static void test_array_value_from_same_array(void) {
+    int i;
+    struct Point *p;
+    char large[64];
+    Array *array = array_create_typed(sizeof(struct Point));
+    for (i = 0; i < 20 || array_length(array) < array_capacity(array); i++) {
+        struct Point q;
+        q.x = i;
+        q.y = -i;
+        q.tag = (char) i;
+        test_assert(array_push_value(array, &q) == 1);
+    }
+    /* Growing moves the elements, but the value is read first */
+    test_assert(array_push_value(array, array_at(array, 0)) == 1);
+    p = array_at(array, array_length(array) - 1);
+    test_assert(p->x == 0 && p->y == 0 && p->tag == 0);
+    /* So is making room in front, and shifting the following elements */
+    test_assert(array_push_front_value(array, array_at(array, 1)) == 1);
+    test_assert(((struct Point*) array_at(array, 0))->x == 1);
+    test_assert(array_insert_value(array, 2, array_at(array, 3)) == 1);
+    test_assert(((struct Point*) array_at(array, 2))->x == 2);
+    test_assert(((struct Point*) array_at(array, 3))->x == 1);
+    test_assert(array_set_gap_buffer(array, 1) == 1);
+    test_assert(array_insert_value(array, 5, array_at(array, 10)) == 1);
+    test_assert(((struct Point*) array_at(array, 5))->x == 8);
+    test_assert(((struct Point*) array_at(array, 6))->x == 3);
+    array_free(array);
+    /* Values larger than the small buffer are copied on the heap */
+    array = array_create_typed(sizeof(large));
+    for (i = 0; array_length(array) == 0 ||
+        array_length(array) < array_capacity(array); i++) {
+        memset(large, 'a' + i % 26, sizeof(large));
+        test_assert(array_push_value(array, large) == 1);
+    }
+    test_assert(array_push_value(array, array_at(array, 1)) == 1);
+    test_assert(array_push_front_value(array, array_at(array, 2)) == 1);
+    test_assert(memcmp(array_at(array, array_length(array) - 1),
+        array_at(array, 2), sizeof(large)) == 0);
+    test_assert(*(char*) array_at(array, 0) == 'c');
+    array_free(array);
+}
+
+static void test_array_pointer_functions_on_typed_array(void) {
+    char large[32];
+    short value = 1;
+    Array *array = array_create_typed(sizeof(large));
+    memset(large, 'x', sizeof(large));
+    /* Larger elements than a pointer are not read or written as one */
+    test_assert(array_push(array, large) == 0);
+    test_assert(array_push_front(array, large) == 0);
+    test_assert(array_insert(array, 0, large) == 0);
+    test_assert(array_length(array) == 0);
+    test_assert(array_push_value(array, large) == 1);
+    test_assert(array_get(array, 0) == NULL);
+    test_assert(array_last(array) == NULL);
+    test_assert(array_set(array, 0, large) == 0);
+    test_assert(array_pop(array) == NULL);
+    test_assert(array_pop_front(array) == NULL);
+    test_assert(array_remove(array, 0) == NULL);
+    test_assert(array_swap_remove(array, 0) == NULL);
+    test_assert(array_length(array) == 1);
+    array_free(array);
+    /* Neither are smaller ones */
+    array = array_create_typed(sizeof(value));
+    test_assert(array_push_value(array, &value) == 1);
+    test_assert(array_push(array, &value) == 0);
+    test_assert(array_last(array) == NULL);
+    test_assert(array_get(array, 0) == NULL);
+    test_assert(array_set(array, 0, NULL) == 0);
+    test_assert(array_pop(array) == NULL);
+    test_assert(array_length(array) == 1);
+    test_assert(array_get_value(array, 0, &value) == 1 && value == 1);
+    array_free(array);
+}
+
+static void test_array_define(void) {
+    int i, value;
+    Array *array = int_array_create();
+    for (i = 0; i < 10; i++) {
+        test_assert(int_array_push(array, i * i) == 1);
+    }
+    test_assert(int_array_insert(array, 0, -1) == 1);
+    test_assert(int_array_get(array, 0, &value) == 1 && value == -1);
+    test_assert(int_array_remove(array, 0, NULL) == 1);
+    test_assert(int_array_set(array, 3, 42) == 1);
+    test_assert(*int_array_at(array, 3) == 42);
+    test_assert(int_array_pop(array, &value) == 1 && value == 81);
+    test_assert(int_array_at(array, 9) == NULL);
+    array_free(array);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int*) a - *(const int*) b;
+}
+
+static void test_array_sort_values(void) {
+    int i;
+    int a[] = {8, 3, 25, 87, 2, 17, 5, 9, 16};
+    Array *array = int_array_create();
+    array_insert_range(array, 0, a, 9);
+    array_sort(array, compare_ints);
+    for (i = 1; i < 9; i++) {
+        test_assert(*int_array_at(array, i - 1) <= *int_array_at(array, i));
+    }
+    array_free(array);
+}
+
+static int int_array_is_sorted(Array *array) {
+    int i;
+    for (i = 1; i < array_length(array); i++) {
+        if (*int_array_at(array, i) < *int_array_at(array, i - 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_array_define_sort(void) {
+    int i, n;
+    int sizes[] = {0, 1, 2, 3, 16, 17, 100, 5000};
+    for (n = 0; n < (int) (sizeof(sizes) / sizeof(sizes[0])); n++) {
+        Array *array = int_array_create();
+        for (i = 0; i < sizes[n]; i++) {
+            int_array_push(array, test_random() % 100);
+        }
+        int_array_sort(array);
+        test_assert(array_length(array) == sizes[n]);
+        test_assert(int_array_is_sorted(array));
+        array_free(array);
+    }
+}
+
+static void test_array_define_sort_patterns(void) {
+    int i;
+    Array *ascending = int_array_create();
+    Array *descending = int_array_create();
+    Array *equal = int_array_create();
+    for (i = 0; i < 1000; i++) {
+        int_array_push(ascending, i);
+        int_array_push(descending, -i);
+        int_array_push(equal, 7);
+    }
+    int_array_sort(ascending);
+    int_array_sort(descending);
+    int_array_sort(equal);
+    test_assert(int_array_is_sorted(ascending));
+    test_assert(int_array_is_sorted(descending));
+    test_assert(*int_array_at(descending, 0) == -999);
+    test_assert(int_array_is_sorted(equal));
+    array_free(ascending);
+    array_free(descending);
+    array_free(equal);
+}
+
+static void test_array_define_sort_heapsort(void) {
+    int i;
+    Array *array = int_array_create();
+    for (i = 0; i < 1000; i++) {
+        int_array_push(array, test_random());
+    }
+    /* The fallback used when quicksort recurses too deep */
+    int_array_sort_heapsort(int_array_at(array, 0), 1000, NULL);
+    test_assert(int_array_is_sorted(array));
+    array_free(array);
+}
+
+static void test_array_define_sort_wrong_type(void) {
+    double d = 2;
+    Array *array = array_create_typed(sizeof(double));
+    array_push_value(array, &d);
+    d = 1;
+    array_push_value(array, &d);
+    int_array_sort(array);
+    array_get_value(array, 0, &d);
+    test_assert(d == 2);
+    int_array_sort(NULL);
+    array_free(array);
+}
+
+static uint64_t int_key(const void *element) {
+    return array_key_from_int(*(const int*) element);
+}
+
+static uint64_t double_key(const void *element) {
+    return array_key_from_double(*(const double*) element);
+}
+
+static uint64_t pointed_int_key(const void *element) {
+    return array_key_from_int(**(int* const*) element);
+}
+
+static void test_array_sort_by_key(void) {
+    int i;
+    Array *array = int_array_create();
+    for (i = 0; i < 5000; i++) {
+        int_array_push(array, test_random() - 16384);
+    }
+    test_assert(array_sort_by_key(array, int_key) == 1);
+    test_assert(array_length(array) == 5000);
+    test_assert(int_array_is_sorted(array));
+    test_assert(*int_array_at(array, 0) < 0);
+    array_free(array);
+}
+
+static void test_array_sort_by_key_doubles(void) {
+    double values[] = {3.5, -1.25, 0.0, -100.0, 1e10, -1e-10, 2.0};
+    double d, previous;
+    int i;
+    Array *array = array_create_typed(sizeof(double));
+    array_insert_range(array, 0, values, 7);
+    test_assert(array_sort_by_key(array, double_key) == 1);
+    array_get_value(array, 0, &previous);
+    test_assert(previous == -100.0);
+    for (i = 1; i < 7; i++) {
+        array_get_value(array, i, &d);
+        test_assert(previous < d);
+        previous = d;
+    }
+    array_free(array);
+}
+
+static void test_array_sort_by_key_is_stable(void) {
+    int a[] = {2, 1, 2, 1, 0};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    array_push(array, &a[2]);
+    array_push(array, &a[3]);
+    array_push(array, &a[4]);
+    test_assert(array_sort_by_key(array, pointed_int_key) == 1);
+    test_assert(array_get(array, 0) == &a[4]);
+    test_assert(array_get(array, 1) == &a[1]);
+    test_assert(array_get(array, 2) == &a[3]);
+    test_assert(array_get(array, 3) == &a[0]);
+    test_assert(array_get(array, 4) == &a[2]);
+    array_free(array);
+}
+
+static void test_array_sort_by_key_no_memory(void) {
+    int a[] = {2, 1};
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    test_malloc_disable();
+    test_assert(array_sort_by_key(array, pointed_int_key) == 0);
+    test_malloc_enable();
+    test_assert(array_get(array, 0) == &a[0]);
+    test_assert(array_sort_by_key(NULL, pointed_int_key) == 0);
+    test_assert(array_sort_by_key(array, NULL) == 0);
+    array_free(array);
+}
+
+/* For sorting test */
+static int compare(const void *a, const void *b) {
+    return **(int**) a - **(int**) b;
+}
 
 static void test_array_sort(void) {
     int a[] = {8, 3, 25, 87, 2, 17, 5, 9, 16};
@@ -390,6 +1685,1263 @@ static void test_array_sort(void) {
     test_assert(array_get(array, 8) == &a[3]);
 }
 
+static void test_array_sort_large(void) {
+    int i;
+    int a[3000];
+    Array *array = array_create();
+    for (i = 0; i < 3000; i++) {
+        a[i] = test_random() % 500;
+        array_push(array, &a[i]);
+    }
+    array_sort(array, compare);
+    for (i = 1; i < 3000; i++) {
+        test_assert(*(int*) array_get(array, i - 1) <=
+            *(int*) array_get(array, i));
+    }
+    array_free(array);
+}
+
+/* For stable sorting tests: sorted by key, seq records insertion order */
+struct Record {
+    int key;
+    int seq;
+};
+
+static int compare_records(const void *a, const void *b) {
+    return ((const struct Record*) a)->key - ((const struct Record*) b)->key;
+}
+
+static int records_are_stably_sorted(Array *array) {
+    int i;
+    struct Record *records = array_at(array, 0);
+    for (i = 1; i < array_length(array); i++) {
+        if (records[i - 1].key > records[i].key ||
+            (records[i - 1].key == records[i].key &&
+            records[i - 1].seq > records[i].seq)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static Array *create_records(int count, int keys) {
+    int i;
+    struct Record record;
+    Array *array = array_create_typed(sizeof(struct Record));
+    for (i = 0; i < count; i++) {
+        record.key = test_random() % keys;
+        record.seq = i;
+        array_push_value(array, &record);
+    }
+    return array;
+}
+
+static void test_array_sort_stable(void) {
+    int n;
+    int sizes[] = {0, 1, 2, 31, 64, 65, 1000, 10000};
+    for (n = 0; n < (int) (sizeof(sizes) / sizeof(sizes[0])); n++) {
+        Array *array = create_records(sizes[n], 1 + sizes[n] / 8);
+        test_assert(array_sort_stable(array, compare_records) == 1);
+        test_assert(array_length(array) == sizes[n]);
+        test_assert(records_are_stably_sorted(array));
+        array_free(array);
+    }
+}
+
+static void test_array_sort_stable_runs(void) {
+    int i;
+    struct Record record;
+    Array *array = array_create_typed(sizeof(struct Record));
+    /* Ascending, descending and constant runs of various lengths */
+    for (i = 0; i < 5000; i++) {
+        record.key = i < 2000 ? i : i < 3000 ? 5000 - i : i < 4000 ? 7 : i % 13;
+        record.seq = i;
+        array_push_value(array, &record);
+    }
+    test_assert(array_sort_stable(array, compare_records) == 1);
+    test_assert(array_length(array) == 5000);
+    test_assert(records_are_stably_sorted(array));
+    array_free(array);
+}
+
+static void test_array_sort_stable_nearly_sorted(void) {
+    int i;
+    Array *array = int_array_create();
+    for (i = 0; i < 10000; i++) {
+        int_array_push(array, i);
+    }
+    int_array_set(array, 5000, -1);
+    int_array_set(array, 20, 20000);
+    test_assert(array_sort_stable(array, compare_ints) == 1);
+    test_assert(int_array_is_sorted(array));
+    test_assert(*int_array_at(array, 0) == -1);
+    test_assert(*int_array_at(array, 9999) == 20000);
+    array_free(array);
+}
+
+static void test_array_sort_stable_invalid(void) {
+    Array *array = create_records(100, 10);
+    test_assert(array_sort_stable(NULL, compare_records) == 0);
+    test_assert(array_sort_stable(array, NULL) == 0);
+    if (test_can_fail_allocations()) {
+        test_malloc_disable();
+        test_assert(array_sort_stable(array, compare_records) == 0);
+        test_malloc_enable();
+    }
+    array_free(array);
+}
+
+static void test_array_merge_sorted(void) {
+    int i;
+    Array *a = create_records(500, 50);
+    Array *b = create_records(300, 50);
+    Array *dst = array_create_typed(sizeof(struct Record));
+    /* Mark where the records came from in seq, so ties can be checked */
+    for (i = 0; i < 500; i++) {
+        ((struct Record*) array_at(a, i))->seq = i;
+    }
+    for (i = 0; i < 300; i++) {
+        ((struct Record*) array_at(b, i))->seq = 1000 + i;
+    }
+    array_sort_stable(a, compare_records);
+    array_sort_stable(b, compare_records);
+    test_assert(array_merge_sorted(dst, a, b, compare_records) == 1);
+    test_assert(array_length(dst) == 800);
+    test_assert(records_are_stably_sorted(dst));
+    /* Merging into one of the inputs */
+    test_assert(array_merge_sorted(a, a, b, compare_records) == 1);
+    test_assert(array_length(a) == 800);
+    test_assert(records_are_stably_sorted(a));
+    test_assert(array_merge_sorted(b, dst, b, compare_records) == 1);
+    test_assert(array_length(b) == 1100);
+    array_free(a);
+    array_free(b);
+    array_free(dst);
+}
+
+static void test_array_merge_sorted_batch(void) {
+    int i;
+    Array *sorted = int_array_create();
+    Array *batch = int_array_create();
+    for (i = 0; i < 1000; i++) {
+        int_array_push(sorted, 2 * i);
+    }
+    int_array_push(batch, 1500);
+    int_array_push(batch, 1501);
+    int_array_push(batch, 5000);
+    test_assert(array_merge_sorted(sorted, sorted, batch, compare_ints) == 1);
+    test_assert(array_length(sorted) == 1003);
+    test_assert(int_array_is_sorted(sorted));
+    test_assert(*int_array_at(sorted, 752) == 1501);
+    test_assert(*int_array_at(sorted, 1002) == 5000);
+    /* Merging an array with itself */
+    test_assert(array_merge_sorted(batch, batch, batch, compare_ints) == 1);
+    test_assert(array_length(batch) == 6);
+    test_assert(int_array_is_sorted(batch));
+    array_free(sorted);
+    array_free(batch);
+}
+
+static void test_array_merge_sorted_invalid(void) {
+    Array *a = int_array_create();
+    Array *b = array_create_typed(sizeof(double));
+    test_assert(array_merge_sorted(a, a, b, compare_ints) == 0);
+    test_assert(array_merge_sorted(NULL, a, a, compare_ints) == 0);
+    test_assert(array_merge_sorted(a, a, a, NULL) == 0);
+    test_assert(array_merge_sorted(a, a, a, compare_ints) == 1);
+    test_assert(array_length(a) == 0);
+    array_free(a);
+    array_free(b);
+}
+
+static Array *create_even_numbers(int count) {
+    int i;
+    Array *array = int_array_create();
+    for (i = 0; i < count; i++) {
+        int_array_push(array, 2 * (i / 2)); /* Every number twice */
+    }
+    return array;
+}
+
+static void test_array_lower_and_upper_bound(void) {
+    int key;
+    Array *array = create_even_numbers(1000);
+    for (key = -1; key <= 1000; key++) {
+        const int lower = array_lower_bound(array, &key, compare_ints);
+        const int upper = array_upper_bound(array, &key, compare_ints);
+        const int expected = key < 0 ? 0 : key % 2 == 0 ? key : key + 1;
+        test_assert(lower == (expected < 1000 ? expected : 1000));
+        if (key >= 0 && key < 1000 && key % 2 == 0) {
+            test_assert(upper == key + 2);
+        } else {
+            test_assert(upper == lower);
+        }
+    }
+    array_free(array);
+}
+
+static void test_array_bounds_of_empty(void) {
+    int key = 1;
+    Array *array = int_array_create();
+    test_assert(array_lower_bound(array, &key, compare_ints) == 0);
+    test_assert(array_upper_bound(array, &key, compare_ints) == 0);
+    test_assert(array_bsearch(array, &key, compare_ints) == -1);
+    test_assert(array_lower_bound(NULL, &key, compare_ints) == 0);
+    test_assert(array_bsearch(NULL, &key, compare_ints) == -1);
+    test_assert(array_bsearch(array, &key, NULL) == -1);
+    array_free(array);
+}
+
+static void test_array_bsearch(void) {
+    int key;
+    Array *array = create_even_numbers(999);
+    for (key = -1; key < 1000; key++) {
+        const int index = array_bsearch(array, &key, compare_ints);
+        if (key >= 0 && key % 2 == 0 && key < 999) {
+            test_assert(index == key);
+        } else {
+            test_assert(index == -1);
+        }
+    }
+    array_free(array);
+}
+
+static void test_array_bsearch_pointers(void) {
+    int a[] = {1, 3, 5};
+    int b = 3, c = 4;
+    int *key = &b;
+    Array *array = array_create();
+    array_push(array, &a[0]);
+    array_push(array, &a[1]);
+    array_push(array, &a[2]);
+    test_assert(array_bsearch(array, &key, compare) == 1);
+    key = &c;
+    test_assert(array_bsearch(array, &key, compare) == -1);
+    test_assert(array_lower_bound(array, &key, compare) == 2);
+    array_free(array);
+}
+
+static void test_array_insert_sorted(void) {
+    int i;
+    struct Record record;
+    Array *array = array_create_typed(sizeof(struct Record));
+    for (i = 0; i < 2000; i++) {
+        record.key = test_random() % 100;
+        record.seq = i;
+        test_assert(array_insert_sorted(array, &record, compare_records) == 1);
+    }
+    test_assert(array_length(array) == 2000);
+    test_assert(records_are_stably_sorted(array));
+    test_assert(array_insert_sorted(NULL, &record, compare_records) == 0);
+    test_assert(array_insert_sorted(array, NULL, compare_records) == 0);
+    array_free(array);
+}
+
+static void test_array_define_search(void) {
+    int key;
+    Array *array = create_even_numbers(1000);
+    for (key = -1; key <= 1000; key++) {
+        test_assert(int_array_lower_bound(array, key) ==
+            array_lower_bound(array, &key, compare_ints));
+        test_assert(int_array_upper_bound(array, key) ==
+            array_upper_bound(array, &key, compare_ints));
+        test_assert(int_array_lower_bound64(array, key) ==
+            array64_lower_bound(array, &key, compare_ints));
+        test_assert(int_array_upper_bound64(array, key) ==
+            array64_upper_bound(array, &key, compare_ints));
+    }
+    array_free(array);
+    test_assert(int_array_lower_bound(NULL, 1) == 0);
+    test_assert(int_array_upper_bound64(NULL, 1) == 0);
+}
+
+static void test_array_sort_parallel(void) {
+    int i, threads;
+    for (threads = 1; threads <= 5; threads++) {
+        Array *array = int_array_create();
+        for (i = 0; i < ARRAY_PARALLEL_THRESHOLD * 2 + threads; i++) {
+            int_array_push(array, test_random());
+        }
+        test_assert(array_sort_parallel(array, compare_ints, threads, 0) == 1);
+        test_assert(array_length(array) == ARRAY_PARALLEL_THRESHOLD * 2 +
+            threads);
+        test_assert(int_array_is_sorted(array));
+        array_free(array);
+    }
+}
+
+static void test_array_sort_parallel_stable(void) {
+    int threads;
+    for (threads = 1; threads <= 5; threads++) {
+        Array *array = create_records(ARRAY_PARALLEL_THRESHOLD * 2 + 3, 100);
+        test_assert(array_sort_parallel(array, compare_records, threads,
+            1) == 1);
+        test_assert(records_are_stably_sorted(array));
+        array_free(array);
+    }
+}
+
+static void test_array_sort_parallel_pointers(void) {
+    int i;
+    int *a = malloc(sizeof(int) * ARRAY_PARALLEL_THRESHOLD * 2);
+    Array *array = array_create();
+    for (i = 0; i < ARRAY_PARALLEL_THRESHOLD * 2; i++) {
+        a[i] = test_random() % 1000;
+        array_push(array, &a[i]);
+    }
+    test_assert(array_sort_parallel(array, compare, 0, 0) == 1);
+    for (i = 1; i < ARRAY_PARALLEL_THRESHOLD * 2; i++) {
+        test_assert(*(int*) array_get(array, i - 1) <=
+            *(int*) array_get(array, i));
+    }
+    array_free(array);
+    free(a);
+}
+
+static void test_array_sort_parallel_small(void) {
+    Array *array = create_records(1000, 10);
+    test_assert(array_sort_parallel(array, compare_records, 4, 1) == 1);
+    test_assert(records_are_stably_sorted(array));
+    array_free(array);
+    array = create_records(1000, 10);
+    test_assert(array_sort_parallel(array, compare_records, 4, 0) == 1);
+    test_assert(array_length(array) == 1000);
+    array_free(array);
+}
+
+static void test_array_sort_parallel_invalid(void) {
+    Array *array = create_records(1000, 10);
+    test_assert(array_sort_parallel(NULL, compare_records, 4, 0) == 0);
+    test_assert(array_sort_parallel(array, NULL, 4, 0) == 0);
+    if (test_can_fail_allocations()) {
+        test_malloc_disable();
+        test_assert(array_sort_parallel(array, compare_records, 4, 1) == 0);
+        test_malloc_enable();
+    }
+    array_free(array);
+}
+
+/* Allocates with malloc unless the int it is given is nonzero */
+static void *failing_allocate(void *context, size_t size) {
+    return *(int*) context ? NULL : malloc(size);
+}
+
+static void failing_deallocate(void *context, void *pointer, size_t size) {
+    (void) context;
+    (void) size;
+    free(pointer);
+}
+
+static void test_array_sort_pool(void) {
+    int i, fail = 0;
+    ArrayAllocator allocator = {NULL, NULL, NULL, NULL, NULL};
+    ArrayPool *pool = array_pool_create(4);
+    Array *array;
+    /* One pool sorts array after array */
+    for (i = 0; i < 3; i++) {
+        array = create_records(ARRAY_PARALLEL_THRESHOLD * 2 + i, 100);
+        test_assert(array_sort_pool(pool, array, compare_records, 1) == 1);
+        test_assert(records_are_stably_sorted(array));
+        array_free(array);
+    }
+    allocator.allocate = failing_allocate;
+    allocator.deallocate = failing_deallocate;
+    allocator.context = &fail;
+    array = array_create_ex(&allocator, sizeof(int), 0);
+    for (i = 0; i < ARRAY_PARALLEL_THRESHOLD * 2; i++) {
+        int_array_push(array, test_random());
+    }
+    test_assert(array_sort_pool(pool, array, compare_ints, 0) == 1);
+    test_assert(int_array_is_sorted(array));
+    /* The temporary buffer comes from the allocator of the array */
+    fail = 1;
+    test_assert(array_sort_pool(pool, array, compare_ints, 1) == 0);
+    fail = 0;
+    test_assert(array_sort_pool(NULL, array, compare_ints, 1) == 1);
+    test_assert(int_array_is_sorted(array));
+    test_assert(array_sort_pool(pool, NULL, compare_ints, 0) == 0);
+    test_assert(array_sort_pool(pool, array, NULL, 0) == 0);
+    array_free(array);
+    array_pool_free(pool);
+}
+
+static void add_to_int(void *element, void *context) {
+    *(int*) element += *(int*) context;
+}
+
+static void int_to_half(const void *element, void *out, void *context) {
+    (void) context;
+    *(double*) out = *(const int*) element / 2.0;
+}
+
+static void add_int_to_sum(void *result, const void *element, void *context) {
+    (void) context;
+    *(int64_t*) result += *(const int*) element;
+}
+
+static void add_sums(void *result, const void *partial, void *context) {
+    (void) context;
+    *(int64_t*) result += *(const int64_t*) partial;
+}
+
+static void test_array_parallel_for_and_map(void) {
+    int i, threads, one = 1;
+    const int length = ARRAY_PARALLEL_THRESHOLD * 2 + 5;
+    Array *halves = array_create_typed(sizeof(double));
+    for (threads = 0; threads <= 4; threads++) {
+        /* Zero threads stands for running without a pool */
+        ArrayPool *pool = threads > 0 ? array_pool_create(threads) : NULL;
+        Array *array = int_array_create();
+        for (i = 0; i < length; i++) {
+            int_array_push(array, i);
+        }
+        test_assert(array_parallel_for(pool, array, add_to_int, &one));
+        test_assert(array_map(pool, halves, array, int_to_half, NULL));
+        test_assert(array_length(halves) == length);
+        for (i = 0; i < length; i++) {
+            test_assert(*int_array_at(array, i) == i + 1);
+            test_assert(*(double*) array_at(halves, i) == (i + 1) / 2.0);
+        }
+        test_assert(array_map(pool, array, array, int_to_half, NULL) == 0);
+        test_assert(array_parallel_for(pool, NULL, add_to_int, &one) == 0);
+        array_free(array);
+        array_pool_free(pool);
+    }
+    array_free(halves);
+}
+
+static void test_array_filter_into(void) {
+    int i, divisor = 3;
+    ArrayPool *pool = array_pool_create(3);
+    Array *array = int_array_create();
+    Array *kept = int_array_create();
+    Array *pointers = array_create();
+    for (i = 0; i < ARRAY_PARALLEL_THRESHOLD * 3; i++) {
+        int_array_push(array, test_random());
+    }
+    test_assert(array_filter_into(pool, kept, array, is_multiple, &divisor));
+    test_assert(array_retain(array, is_multiple, &divisor) > 0);
+    test_assert(array_length(kept) == array_length(array));
+    test_assert(memcmp(array_span(kept).elements, array_span(array).elements,
+        sizeof(int) * array_length(array)) == 0);
+    test_assert(array_filter_into(pool, kept, kept, is_multiple,
+        &divisor) == 0);
+    test_assert(array_filter_into(pool, pointers, kept, is_multiple,
+        &divisor) == 0);
+    array_free(array);
+    array_free(kept);
+    array_free(pointers);
+    array_pool_free(pool);
+}
+
+static void test_array_reduce(void) {
+    int i, threads;
+    int64_t sum;
+    const int length = ARRAY_PARALLEL_THRESHOLD * 2 + 7;
+    Array *array = int_array_create();
+    for (i = 0; i < length; i++) {
+        int_array_push(array, i);
+    }
+    for (threads = 1; threads <= 4; threads++) {
+        ArrayPool *pool = array_pool_create(threads);
+        sum = 0;
+        test_assert(array_reduce(pool, array, &sum, sizeof(sum),
+            add_int_to_sum, add_sums, NULL));
+        test_assert(sum == (int64_t) length * (length - 1) / 2);
+        array_pool_free(pool);
+    }
+    array_free(array);
+    sum = 5;
+    array = int_array_create();
+    test_assert(array_reduce(NULL, array, &sum, sizeof(sum), add_int_to_sum,
+        add_sums, NULL) && sum == 5);
+    test_assert(array_reduce(NULL, array, &sum, 0, add_int_to_sum, add_sums,
+        NULL) == 0);
+    array_free(array);
+}
+
+/* Passes started from the callback of a pass on the same pool */
+struct NestedPass {
+    ArrayPool *pool;
+    Array *inner;
+};
+
+static void sum_inner_array(void *element, void *context) {
+    struct NestedPass *nested = context;
+    int64_t sum = 0;
+    if (*(int*) element % ARRAY_PARALLEL_THRESHOLD == 0) {
+        array_reduce(nested->pool, nested->inner, &sum, sizeof(sum),
+            add_int_to_sum, add_sums, NULL);
+        *(int*) element = (int) -sum;
+    }
+}
+
+static void test_array_pool_nested_pass(void) {
+    int i;
+    struct NestedPass nested;
+    Array *array = int_array_create();
+    nested.pool = array_pool_create(4);
+    nested.inner = int_array_create();
+    for (i = 0; i < ARRAY_PARALLEL_THRESHOLD * 2; i++) {
+        int_array_push(array, i);
+        int_array_push(nested.inner, i % 2);
+    }
+    test_assert(array_parallel_for(nested.pool, array, sum_inner_array,
+        &nested));
+    test_assert(*int_array_at(array, 0) == -ARRAY_PARALLEL_THRESHOLD);
+    test_assert(*int_array_at(array, ARRAY_PARALLEL_THRESHOLD) ==
+        -ARRAY_PARALLEL_THRESHOLD);
+    test_assert(*int_array_at(array, 1) == 1);
+    array_free(array);
+    array_free(nested.inner);
+    array_pool_free(nested.pool);
+}
+
+static void test_array_simd_integers(void) {
+    int level, length, i, key, first, count;
+    int32_t values[70], value32, prefix;
+    int64_t value64, sum, expected;
+    const int best = array_simd_level();
+    Array *prefixes;
+    /* Every length up to a few of the widest vectors, for the remainders */
+    for (length = 0; length <= 70; length++) {
+        Array *array32 = array_create_typed(sizeof(int32_t));
+        Array *array64 = array_create_typed(sizeof(int64_t));
+        for (i = 0; i < length; i++) {
+            values[i] = test_random() % 9 - 4;
+            value64 = (int64_t) values[i] << 40;
+            array_push_value(array32, &values[i]);
+            array_push_value(array64, &value64);
+        }
+        for (level = ARRAY_SIMD_NONE; level <= best; level++) {
+            test_assert(array_simd_set_level(level) == level);
+            for (key = -5; key <= 5; key++) {
+                for (i = length - 1, first = -1, count = 0; i >= 0; i--) {
+                    if (values[i] == key) {
+                        first = i;
+                        count++;
+                    }
+                }
+                value32 = key;
+                value64 = (int64_t) key << 40;
+                test_assert(array_find(array32, ARRAY_TYPE_INT32,
+                    &value32) == first);
+                test_assert(array_find(array64, ARRAY_TYPE_INT64,
+                    &value64) == first);
+                test_assert(array_count(array32, ARRAY_TYPE_INT32,
+                    &value32) == count);
+                test_assert(array_count(array64, ARRAY_TYPE_INT64,
+                    &value64) == count);
+            }
+            for (i = 0, expected = 0; i < length; i++) {
+                expected += values[i];
+            }
+            test_assert(array_sum(array32, ARRAY_TYPE_INT32, &sum) &&
+                sum == expected);
+            test_assert(array_sum(array64, ARRAY_TYPE_INT64, &sum) &&
+                sum == expected * ((int64_t) 1 << 40));
+            if (length > 0) {
+                for (i = 1, key = 0; i < length; i++) {
+                    key = values[i] < values[key] ? i : key;
+                }
+                test_assert(array_min(array32, ARRAY_TYPE_INT32, &value32) &&
+                    value32 == values[key]);
+                test_assert(array_min(array64, ARRAY_TYPE_INT64, &value64) &&
+                    value64 == (int64_t) values[key] << 40);
+                for (i = 1, key = 0; i < length; i++) {
+                    key = values[i] > values[key] ? i : key;
+                }
+                test_assert(array_max(array32, ARRAY_TYPE_INT32, &value32) &&
+                    value32 == values[key]);
+                test_assert(array_max(array64, ARRAY_TYPE_INT64, &value64) &&
+                    value64 == (int64_t) values[key] << 40);
+            } else {
+                test_assert(array_min(array32, ARRAY_TYPE_INT32,
+                    &value32) == 0);
+                test_assert(array_max(array64, ARRAY_TYPE_INT64,
+                    &value64) == 0);
+            }
+            prefixes = array_create_typed(sizeof(int32_t));
+            for (i = 0; i < length; i++) {
+                array_push_value(prefixes, &values[i]);
+            }
+            test_assert(array_equal(prefixes, array32, ARRAY_TYPE_INT32));
+            test_assert(array_prefix_sum(prefixes, ARRAY_TYPE_INT32));
+            for (i = 0, prefix = 0; i < length; i++) {
+                prefix += values[i];
+                test_assert(*(int32_t*) array_at(prefixes, i) == prefix);
+            }
+            array_free(prefixes);
+            test_assert(array_prefix_sum(array64, ARRAY_TYPE_INT64));
+            test_assert(array_length(array64) == 0 ||
+                *(int64_t*) array_at(array64, length - 1) == expected << 40);
+            for (i = 0; i < length; i++) {
+                value64 = (int64_t) values[i] << 40;
+                array_set_value(array64, i, &value64);
+            }
+        }
+        array_free(array32);
+        array_free(array64);
+    }
+    array_simd_set_level(-1);
+}
+
+static void test_array_simd_floating_point(void) {
+    int level, length, i;
+    float value, sum, first_sum = 0;
+    double value64, sum64, first_sum64 = 0, zero = 0.0;
+    const int best = array_simd_level();
+    for (length = 0; length <= 70; length += 7) {
+        Array *floats = array_create_typed(sizeof(float));
+        Array *doubles = array_create_typed(sizeof(double));
+        Array *other = array_create_typed(sizeof(double));
+        for (i = 0; i < length; i++) {
+            value64 = (test_random() % 2001 - 1000) / 7.0;
+            value = (float) value64;
+            array_push_value(floats, &value);
+            array_push_value(doubles, &value64);
+            array_push_value(other, &value64);
+        }
+        for (level = ARRAY_SIMD_NONE; level <= best; level++) {
+            array_simd_set_level(level);
+            /* The same partial sums with every kernel, to the last bit */
+            test_assert(array_sum(floats, ARRAY_TYPE_FLOAT, &sum));
+            test_assert(array_sum(doubles, ARRAY_TYPE_DOUBLE, &sum64));
+            if (level == ARRAY_SIMD_NONE) {
+                first_sum = sum;
+                first_sum64 = sum64;
+            }
+            test_assert(memcmp(&sum, &first_sum, sizeof(sum)) == 0);
+            test_assert(memcmp(&sum64, &first_sum64, sizeof(sum64)) == 0);
+            test_assert(array_equal(doubles, other, ARRAY_TYPE_DOUBLE));
+            value = 1000.0f;
+            test_assert(array_find(floats, ARRAY_TYPE_FLOAT, &value) == -1);
+            if (length > 0) {
+                value = *(float*) array_at(floats, length - 1);
+                test_assert(array_find(floats, ARRAY_TYPE_FLOAT, &value) >= 0);
+                test_assert(array_min(doubles, ARRAY_TYPE_DOUBLE, &value64) &&
+                    value64 >= -1000 / 7.0);
+                test_assert(array_count(doubles, ARRAY_TYPE_DOUBLE,
+                    &value64) >= 1);
+            }
+        }
+        array_free(floats);
+        array_free(doubles);
+        array_free(other);
+    }
+
+    /* Comparisons follow those of C, whichever kernel runs */
+    for (level = ARRAY_SIMD_NONE; level <= best; level++) {
+        Array *a = array_create_typed(sizeof(double));
+        Array *b = array_create_typed(sizeof(double));
+        array_simd_set_level(level);
+        for (i = 0; i < 20; i++) {
+            value64 = i == 17 ? -0.0 : i + 1;
+            array_push_value(a, &value64);
+            value64 = i == 17 ? 0.0 : i + 1;
+            array_push_value(b, &value64);
+        }
+        value64 = 0.0;
+        test_assert(array_find(a, ARRAY_TYPE_DOUBLE, &value64) == 17);
+        test_assert(array_equal(a, b, ARRAY_TYPE_DOUBLE));
+        value64 = zero / zero;
+        array_set_value(a, 3, &value64);
+        array_set_value(b, 3, &value64);
+        test_assert(array_find(a, ARRAY_TYPE_DOUBLE, &value64) == -1);
+        test_assert(array_equal(a, b, ARRAY_TYPE_DOUBLE) == 0);
+        array_free(a);
+        array_free(b);
+    }
+    array_simd_set_level(-1);
+}
+
+static void test_array_simd_fill_and_invalid(void) {
+    int i, value = 7, length;
+    char bytes[3] = {1, 2, 3};
+    int64_t sum;
+    Array *array = int_array_create();
+    Array *triples = array_create_typed(sizeof(bytes));
+    test_assert(array_fill(array, &value));
+    for (length = 0; length < 3000; length += 997) {
+        while (array_length(array) < length) {
+            int_array_push(array, length);
+            array_push_value(triples, bytes);
+        }
+        test_assert(array_fill(array, &value));
+        test_assert(array_count(array, ARRAY_TYPE_INT32, &value) == length);
+        bytes[0]++;
+        test_assert(array_fill(triples, bytes));
+        for (i = 0; i < length; i++) {
+            test_assert(memcmp(array_at(triples, i), bytes, 3) == 0);
+        }
+        value++;
+    }
+    /* With the gap in the middle, then with a value from the array itself */
+    test_assert(array_set_gap_buffer(array, 1));
+    value = -2;
+    test_assert(array_insert_value(array, 1000, &value));
+    test_assert(array_fill(array, &value));
+    value = -1;
+    test_assert(array_set_value(array, 1000, &value));
+    test_assert(array_fill(array, array_at(array, 1000)));
+    test_assert(array_count(array, ARRAY_TYPE_INT32, &value) ==
+        array_length(array));
+    test_assert(array_sum(array, ARRAY_TYPE_INT32, &sum) &&
+        sum == -array_length(array));
+    test_assert(array_find(NULL, ARRAY_TYPE_INT32, &value) == -1);
+    test_assert(array_find(array, ARRAY_TYPE_INT64, &value) == -1);
+    test_assert(array_find(array, 4, &value) == -1);
+    test_assert(array_find(array, ARRAY_TYPE_INT32, NULL) == -1);
+    test_assert(array_count(array, ARRAY_TYPE_DOUBLE, &value) == 0);
+    test_assert(array_min(triples, ARRAY_TYPE_INT32, &value) == 0);
+    test_assert(array_sum(array, -1, &sum) == 0);
+    test_assert(array_sum(array, ARRAY_TYPE_INT32, NULL) == 0);
+    test_assert(array_equal(array, triples, ARRAY_TYPE_INT32) == 0);
+    test_assert(array_prefix_sum(array, ARRAY_TYPE_DOUBLE) == 0);
+    test_assert(array_prefix_sum(triples, ARRAY_TYPE_INT32) == 0);
+    test_assert(array_fill(NULL, &value) == 0);
+    test_assert(array_fill(array, NULL) == 0);
+    test_assert(array_simd_set_level(ARRAY_SIMD_AVX512 + 1) ==
+        array_simd_level());
+    array_free(array);
+    array_free(triples);
+}
+
+static void test_concurrent_array_push_and_get(void) {
+    int i, value;
+    ConcurrentArray *array = concurrent_array_create(sizeof(int));
+    test_assert(array != NULL);
+    for (i = 0; i < 10000; i++) {
+        test_assert(concurrent_array_push(array, &i) == i);
+    }
+    test_assert(concurrent_array_length(array) == 10000);
+    for (i = 0; i < 10000; i++) {
+        test_assert(concurrent_array_get(array, i, &value) == 1);
+        test_assert(value == i);
+        test_assert(*(const int*) concurrent_array_at(array, i) == i);
+    }
+    test_assert(concurrent_array_get(array, 10000, &value) == 0);
+    test_assert(concurrent_array_get(array, -1, &value) == 0);
+    test_assert(concurrent_array_at(array, 1 << 30) == NULL);
+    concurrent_array_free(array);
+}
+
+static void test_concurrent_array_invalid(void) {
+    int value = 1;
+    test_assert(concurrent_array_create(0) == NULL);
+    test_assert(concurrent_array_push(NULL, &value) == -1);
+    test_assert(concurrent_array_get(NULL, 0, &value) == 0);
+    test_assert(concurrent_array_length(NULL) == 0);
+    concurrent_array_free(NULL);
+}
+
+#define TEST_PUSHERS 4
+#define TEST_PUSHES 20000
+
+struct TestPusher {
+    ConcurrentArray *array;
+    int id;
+};
+
+static void *test_push_concurrently(void *argument) {
+    struct TestPusher *pusher = argument;
+    int i, value;
+    for (i = 0; i < TEST_PUSHES; i++) {
+        value = pusher->id * TEST_PUSHES + i;
+        if (concurrent_array_push(pusher->array, &value) < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *test_read_concurrently(void *argument) {
+    ConcurrentArray *array = argument;
+    int i, value, seen = 0;
+    while (seen < TEST_PUSHERS * TEST_PUSHES) {
+        seen = 0;
+        for (i = 0; i < concurrent_array_length(array); i++) {
+            if (concurrent_array_get(array, i, &value)) {
+                if (value < 0 || value >= TEST_PUSHERS * TEST_PUSHES) {
+                    return argument; /* Torn or garbage value */
+                }
+                seen++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_array_stress(void) {
+    static char found[TEST_PUSHERS * TEST_PUSHES];
+    struct TestPusher pushers[TEST_PUSHERS];
+    pthread_t threads[TEST_PUSHERS], reader;
+    void *result;
+    int i, value;
+    ConcurrentArray *array = concurrent_array_create(sizeof(int));
+    test_assert(pthread_create(&reader, NULL, test_read_concurrently,
+        array) == 0);
+    for (i = 0; i < TEST_PUSHERS; i++) {
+        pushers[i].array = array;
+        pushers[i].id = i;
+        test_assert(pthread_create(&threads[i], NULL, test_push_concurrently,
+            &pushers[i]) == 0);
+    }
+    for (i = 0; i < TEST_PUSHERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_join(reader, &result);
+    test_assert(result == NULL);
+    test_assert(concurrent_array_length(array) == TEST_PUSHERS * TEST_PUSHES);
+    memset(found, 0, sizeof(found));
+    for (i = 0; i < TEST_PUSHERS * TEST_PUSHES; i++) {
+        test_assert(concurrent_array_get(array, i, &value) == 1);
+        test_assert(found[value] == 0);
+        found[value] = 1;
+    }
+    concurrent_array_free(array);
+}
+
+static void test_segmented_array_push_and_get(void) {
+    int i, value;
+    const int *first;
+    SegmentedArray *array = segmented_array_create(sizeof(int));
+    test_assert(array != NULL);
+    value = -1;
+    test_assert(segmented_array_push(array, &value) == 1);
+    first = segmented_array_at(array, 0);
+    for (i = 1; i < 100000; i++) {
+        test_assert(segmented_array_push(array, &i) == 1);
+    }
+    test_assert(segmented_array_length(array) == 100000);
+    test_assert(segmented_array_at(array, 0) == first && *first == -1);
+    for (i = 1; i < 100000; i++) {
+        test_assert(segmented_array_get(array, i, &value) == 1);
+        test_assert(value == i);
+    }
+    value = 7;
+    test_assert(segmented_array_set(array, 99999, &value) == 1);
+    test_assert(*(int*) segmented_array_at(array, 99999) == 7);
+    test_assert(segmented_array_get(array, 100000, &value) == 0);
+    test_assert(segmented_array_set(array, -1, &value) == 0);
+    test_assert(segmented_array_at(array, 100000) == NULL);
+    segmented_array_free(array);
+    /* Buckets of elements this large don't fit in memory */
+    array = segmented_array_create((size_t) -1 / 2);
+    test_assert(segmented_array_push(array, &value) == 0);
+    test_assert(segmented_array_length(array) == 0);
+    segmented_array_free(array);
+}
+
+static void test_segmented_array_pop_and_shrink(void) {
+    int i, value;
+    SegmentedArray *array = segmented_array_create(sizeof(int));
+    for (i = 0; i < 1000; i++) {
+        segmented_array_push(array, &i);
+    }
+    for (i = 999; i >= 10; i--) {
+        test_assert(segmented_array_pop(array, &value) == 1);
+        test_assert(value == i);
+    }
+    test_assert(segmented_array_shrink_to_fit(array) == 1);
+    test_assert(segmented_array_length(array) == 10);
+    for (i = 10; i < 1000; i++) {
+        test_assert(segmented_array_push(array, &i) == 1);
+    }
+    for (i = 0; i < 1000; i++) {
+        test_assert(*(int*) segmented_array_at(array, i) == i);
+    }
+    while (segmented_array_pop(array, NULL)) {
+    }
+    test_assert(segmented_array_length(array) == 0);
+    test_assert(segmented_array_shrink_to_fit(array) == 1);
+    segmented_array_free(array);
+}
+
+static int sum_until_negative(void *element, void *context) {
+    if (*(int*) element < 0) {
+        return 1;
+    }
+    *(int*) context += *(int*) element;
+    return 0;
+}
+
+static void test_segmented_array_foreach(void) {
+    int i, sum = 0;
+    SegmentedArray *array = segmented_array_create(sizeof(int));
+    for (i = 1; i <= 1000; i++) {
+        segmented_array_push(array, &i);
+    }
+    test_assert(segmented_array_foreach(array, sum_until_negative, &sum) ==
+        1000);
+    test_assert(sum == 500500);
+    i = -1;
+    segmented_array_set(array, 500, &i);
+    test_assert(segmented_array_foreach(array, sum_until_negative, &sum) ==
+        500);
+    test_assert(segmented_array_foreach(NULL, sum_until_negative, &sum) == 0);
+    segmented_array_free(array);
+}
+
+static void test_segmented_array_no_memory(void) {
+    int i;
+    SegmentedArray *array = segmented_array_create(sizeof(int));
+    for (i = 0; i < 16; i++) {
+        segmented_array_push(array, &i);
+    }
+    test_malloc_disable();
+    test_assert(segmented_array_push(array, &i) == 0);
+    test_assert(segmented_array_create(sizeof(int)) == NULL);
+    test_malloc_enable();
+    test_assert(segmented_array_length(array) == 16);
+    test_assert(segmented_array_push(array, &i) == 1);
+    test_assert(segmented_array_create(0) == NULL);
+    test_assert(segmented_array_push(NULL, &i) == 0);
+    test_assert(segmented_array_pop(NULL, &i) == 0);
+    segmented_array_free(array);
+}
+
+#define TEST_FILE "test_array.dat"
+
+static void test_array_file_reopen(void) {
+    int i, value;
+    Array *array;
+    remove(TEST_FILE);
+    array = array_open_file(TEST_FILE, sizeof(int));
+    test_assert(array != NULL);
+    test_assert(array_length(array) == 0);
+    for (i = 0; i < 10000; i++) {
+        test_assert(int_array_push(array, i) == 1);
+    }
+    test_assert(array_sync(array) == 1);
+    array_free(array);
+
+    array = array_open_file(TEST_FILE, sizeof(int));
+    test_assert(array != NULL);
+    test_assert(array_length(array) == 10000);
+    for (i = 0; i < 10000; i++) {
+        test_assert(int_array_get(array, i, &value) == 1 && value == i);
+    }
+    for (i = 0; i < 100; i++) {
+        int_array_pop_front(array, &value);
+    }
+    int_array_push(array, -1);
+    array_free(array);
+
+    array = array_open_file(TEST_FILE, sizeof(int));
+    test_assert(array != NULL);
+    test_assert(array_length(array) == 9901);
+    test_assert(*int_array_at(array, 0) == 100);
+    test_assert(*int_array_at(array, 9900) == -1);
+    test_assert(array_sort_stable(array, compare_ints) == 1);
+    test_assert(*int_array_at(array, 0) == -1);
+    test_assert(array_shrink_to_fit(array) == 1);
+    array_free(array);
+
+    array = array_open_file(TEST_FILE, sizeof(int));
+    test_assert(array != NULL);
+    test_assert(array_capacity(array) == 9901);
+    test_assert(int_array_is_sorted(array));
+    array_free(array);
+    remove(TEST_FILE);
+}
+
+static void test_array_file_invalid(void) {
+    FILE *stream;
+    Array *array;
+    remove(TEST_FILE);
+    array = array_open_file(TEST_FILE, sizeof(int));
+    int_array_push(array, 1);
+    int_array_push(array, 2);
+    array_free(array);
+    test_assert(array_open_file(TEST_FILE, sizeof(double)) == NULL);
+    stream = fopen(TEST_FILE, "r+b");
+    test_assert(stream != NULL);
+    fseek(stream, 64, SEEK_SET);
+    fputc(0x7f, stream);
+    fclose(stream);
+    test_assert(array_open_file(TEST_FILE, sizeof(int)) == NULL);
+    remove(TEST_FILE);
+    test_assert(array_open_file(NULL, sizeof(int)) == NULL);
+    test_assert(array_open_file(TEST_FILE, 0) == NULL);
+    array = array_create();
+    test_assert(array_sync(array) == 0);
+    test_assert(array_sync(NULL) == 0);
+    array_free(array);
+}
+
+/* An in-memory stream for serialization tests */
+struct TestBuffer {
+    char data[65536];
+    size_t length;
+    size_t position;
+    int calls;
+};
+
+static size_t test_buffer_write(const void *data, size_t size,
+    void *context) {
+    struct TestBuffer *buffer = context;
+    if (size > sizeof(buffer->data) - buffer->length) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->length, data, size);
+    buffer->length += size;
+    buffer->calls++;
+    return size;
+}
+
+static size_t test_buffer_read(void *data, size_t size, void *context) {
+    struct TestBuffer *buffer = context;
+    if (size > buffer->length - buffer->position) {
+        return 0;
+    }
+    memcpy(data, buffer->data + buffer->position, size);
+    buffer->position += size;
+    return size;
+}
+
+static void test_array_serialize_raw(void) {
+    static struct TestBuffer buffer;
+    struct Point point;
+    Array *copy;
+    int i;
+    Array *array = array_create_typed(sizeof(struct Point));
+    for (i = 0; i < 1000; i++) {
+        point.x = i;
+        point.y = -i;
+        point.tag = (char) i;
+        array_push_value(array, &point);
+    }
+    buffer.length = 0;
+    buffer.position = 0;
+    buffer.calls = 0;
+    test_assert(array_serialize(array, test_buffer_write, &buffer,
+        ARRAY_ENCODING_RAW) == 1);
+    test_assert(buffer.calls == 2);
+    copy = array_deserialize(test_buffer_read, &buffer, NULL);
+    test_assert(copy != NULL);
+    test_assert(array_length(copy) == 1000);
+    test_assert(array_capacity(copy) == 1000);
+    test_assert(array_element_size(copy) == sizeof(struct Point));
+    test_assert(memcmp(array_at(copy, 0), array_at(array, 0),
+        1000 * sizeof(struct Point)) == 0);
+    array_free(copy);
+    array_free(array);
+}
+
+static void test_array_serialize_delta(void) {
+    static struct TestBuffer buffer;
+    int i;
+    Array *copy, *array = int_array_create();
+    for (i = 0; i < 10000; i++) {
+        int_array_push(array, 3 * i - 5000);
+    }
+    int_array_push(array, INT_MIN);
+    int_array_push(array, INT_MAX);
+    buffer.length = 0;
+    buffer.position = 0;
+    test_assert(array_serialize(array, test_buffer_write, &buffer,
+        ARRAY_ENCODING_DELTA) == 1);
+    test_assert(buffer.length < 10100 + 32);
+    copy = array_deserialize(test_buffer_read, &buffer, NULL);
+    test_assert(copy != NULL);
+    test_assert(array_length(copy) == 10002);
+    test_assert(memcmp(array_at(copy, 0), array_at(array, 0),
+        10002 * sizeof(int)) == 0);
+    array_free(copy);
+    array_free(array);
+}
+
+static void test_array_serialize_delta_sizes(void) {
+    static struct TestBuffer buffer;
+    signed char small[] = {-128, 127, 0, -1, 5};
+    int64_t large[] = {0, INT64_MAX, INT64_MIN, -1, 42};
+    Array *copy, *array;
+
+    array = array_create_typed(sizeof(small[0]));
+    array_insert_range(array, 0, small, 5);
+    buffer.length = 0;
+    buffer.position = 0;
+    test_assert(array_serialize(array, test_buffer_write, &buffer,
+        ARRAY_ENCODING_DELTA) == 1);
+    copy = array_deserialize(test_buffer_read, &buffer, NULL);
+    test_assert(copy != NULL && array_length(copy) == 5);
+    test_assert(memcmp(array_at(copy, 0), small, sizeof(small)) == 0);
+    array_free(copy);
+    array_free(array);
+
+    array = array_create_typed(sizeof(large[0]));
+    array_insert_range(array, 0, large, 5);
+    buffer.length = 0;
+    buffer.position = 0;
+    test_assert(array_serialize(array, test_buffer_write, &buffer,
+        ARRAY_ENCODING_DELTA) == 1);
+    copy = array_deserialize(test_buffer_read, &buffer, NULL);
+    test_assert(copy != NULL && array_length(copy) == 5);
+    test_assert(memcmp(array_at(copy, 0), large, sizeof(large)) == 0);
+    array_free(copy);
+    array_free(array);
+}
+
+static void test_array_serialize_file(void) {
+    Array *copy;
+    int i;
+    Array *array = int_array_create();
+    FILE *stream = tmpfile();
+    test_assert(stream != NULL);
+    for (i = 0; i < 100; i++) {
+        int_array_push(array, i * i);
+    }
+    test_assert(array_serialize_file(array, stream, ARRAY_ENCODING_DELTA));
+    test_assert(array_serialize_file(array, stream, ARRAY_ENCODING_RAW));
+    rewind(stream);
+    copy = array_deserialize_file(stream);
+    test_assert(copy != NULL && array_length(copy) == 100);
+    test_assert(*int_array_at(copy, 99) == 99 * 99);
+    array_free(copy);
+    copy = array_deserialize_file(stream);
+    test_assert(copy != NULL && array_length(copy) == 100);
+    test_assert(*int_array_at(copy, 99) == 99 * 99);
+    array_free(copy);
+    test_assert(array_deserialize_file(stream) == NULL);
+    fclose(stream);
+    array_free(array);
+}
+
+static void test_array_serialize_invalid(void) {
+    static struct TestBuffer buffer;
+    Array *copy, *array = array_create_typed(3);
+    test_assert(array_serialize(array, test_buffer_write, &buffer,
+        ARRAY_ENCODING_DELTA) == 0);
+    test_assert(array_serialize(array, test_buffer_write, &buffer, 2) == 0);
+    test_assert(array_serialize(NULL, test_buffer_write, &buffer,
+        ARRAY_ENCODING_RAW) == 0);
+    test_assert(array_serialize(array, NULL, &buffer,
+        ARRAY_ENCODING_RAW) == 0);
+    array_free(array);
+
+    array = int_array_create();
+    int_array_push(array, 1000);
+    int_array_push(array, 2000);
+    buffer.length = 0;
+    buffer.position = 0;
+    test_assert(array_serialize(array, test_buffer_write, &buffer,
+        ARRAY_ENCODING_DELTA) == 1);
+    /* Truncated */
+    buffer.length--;
+    test_assert(array_deserialize(test_buffer_read, &buffer, NULL) == NULL);
+    /* Corrupt magic */
+    buffer.length++;
+    buffer.position = 0;
+    buffer.data[0] = 'X';
+    test_assert(array_deserialize(test_buffer_read, &buffer, NULL) == NULL);
+    /* Out of memory */
+    buffer.data[0] = 'A';
+    buffer.position = 0;
+    if (test_can_fail_allocations()) {
+        test_malloc_disable();
+        test_assert(array_deserialize(test_buffer_read, &buffer, NULL) == NULL);
+        test_malloc_enable();
+    }
+    buffer.position = 0;
+    copy = array_deserialize(test_buffer_read, &buffer, NULL);
+    test_assert(copy != NULL && *int_array_at(copy, 1) == 2000);
+    test_assert(array_deserialize(NULL, &buffer, NULL) == NULL);
+    array_free(copy);
+    array_free(array);
+}
+
+static void test_array64_access(void) {
+    int i, value, range[] = {7, 8, 9};
+    Array *array = int_array_create();
+    test_assert(array64_reserve(array, 100) == 1);
+    test_assert(array64_capacity(array) == 100);
+    for (i = 0; i < 10; i++) {
+        test_assert(array64_insert_value(array, array64_length(array), &i));
+    }
+    test_assert(array64_length(array) == 10);
+    test_assert(*(int*) array64_at(array, 9) == 9);
+    test_assert(array64_at(array, 10) == NULL);
+    value = 42;
+    test_assert(array64_set_value(array, 5, &value) == 1);
+    test_assert(array64_get_value(array, 5, &value) == 1 && value == 42);
+    test_assert(array64_remove_value(array, 5, &value) == 1 && value == 42);
+    test_assert(array64_swap_remove_value(array, 0, &value) == 1);
+    test_assert(value == 0 && *int_array_at(array, 0) == 9);
+    test_assert(array64_insert_range(array, 1, range, 3) == 1);
+    test_assert(array64_length(array) == 11);
+    test_assert(*int_array_at(array, 3) == 9);
+    test_assert(array64_remove_range(array, 0, 4, NULL) == 1);
+    test_assert(array64_length(array) == 7 && *int_array_at(array, 0) == 1);
+    /* 1 2 3 4 6 7 8 */
+    value = 5;
+    test_assert(array64_lower_bound(array, &value, compare_ints) == 4);
+    value = 6;
+    test_assert(array64_upper_bound(array, &value, compare_ints) == 5);
+    array_free(array);
+}
+
+static void test_array64_invalid(void) {
+    int value = 0;
+    Array *array = int_array_create();
+    test_assert(array64_length(NULL) == 0 && array64_capacity(NULL) == 0);
+    test_assert(array64_reserve(NULL, 1) == 0);
+    test_assert(array64_reserve(array, (size_t) -1) == 0);
+    test_assert(array64_at(array, 0) == NULL);
+    test_assert(array64_get_value(array, 0, &value) == 0);
+    test_assert(array64_set_value(array, 0, &value) == 0);
+    test_assert(array64_insert_value(array, 1, &value) == 0);
+    test_assert(array64_remove_value(array, 0, &value) == 0);
+    test_assert(array64_swap_remove_value(array, 0, &value) == 0);
+    test_assert(array64_insert_range(array, 0, &value, (size_t) -1) == 0);
+    test_assert(array64_remove_range(array, 0, 1, NULL) == 0);
+    test_assert(array64_lower_bound(NULL, &value, compare_ints) == 0);
+    test_assert(array64_upper_bound(array, NULL, compare_ints) == 0);
+    /* The int functions still reject negative indices */
+    test_assert(int_array_push(array, 1) == 1);
+    test_assert(array_at(array, -1) == NULL);
+    test_assert(int_array_insert(array, -1, 1) == 0);
+    test_assert(array_remove_range(array, 0, -1, NULL) == 0);
+    test_assert(array_length(array) == 1);
+    array_free(array);
+}
+
+static void test_array_stats(void) {
+    ArrayStats before, stats, total;
+    int value = 0;
+    Array *array = array_create_ex(NULL, sizeof(int), 4);
+    test_assert(array_stats_total(&before) == array_stats(array, &stats));
+    for (value = 4; value >= 0; value--) {
+        int_array_push(array, value);
+    }
+    int_array_insert(array, 3, 10);
+    int_array_remove(array, 4, &value);
+    array_sort(array, compare_ints);
+    array_sort_stable(array, compare_ints);
+#ifdef ARRAY_STATS
+    test_assert(array_stats(array, &stats) == 1);
+    test_assert(stats.grows == 1);
+    test_assert(stats.bytes_reallocated == 8 * sizeof(int));
+    test_assert(stats.peak_capacity == 8);
+    test_assert(stats.elements_shifted == 3);
+    test_assert(stats.sorts == 2);
+    test_assert(stats.comparisons > 0);
+    test_assert(array_stats_total(&total) == 1);
+    test_assert(total.grows - before.grows == stats.grows);
+    test_assert(total.elements_shifted - before.elements_shifted ==
+        stats.elements_shifted);
+    test_assert(total.comparisons - before.comparisons == stats.comparisons);
+    test_assert(total.peak_capacity >= 8);
+#else
+    test_assert(array_stats(array, &stats) == 0 && stats.grows == 0);
+    test_assert(array_stats_total(&total) == 0 && total.sorts == 0);
+#endif
+    test_assert(array_stats(NULL, &stats) == 0 && stats.sorts == 0);
+    test_assert(array_stats(array, NULL) == 0);
+    test_assert(array_stats_total(NULL) == 0);
+    array_free(array);
+}
+
 static void test_array_sort_empty(void) {
     Array *array = array_create();
     array_sort(array, compare);
@@ -409,8 +2961,18 @@ static void test_array_sort_null(void) {
 
 int main(void) {
     test_run(test_array_create);
-    test_run(test_array_create_no_memory);
-    test_run(test_array_create_no_memory_for_elements);
+    test_run_no_memory(test_array_create_no_memory);
+    test_run_no_memory(test_array_create_no_memory_for_elements);
+    test_run(test_array_small);
+    test_run(test_array_create_with_capacity);
+    test_run(test_array_create_with_zero_capacity);
+    test_run(test_array_create_ex);
+    test_run(test_array_create_ex_without_reallocate);
+    test_run(test_array_create_ex_extends_in_place);
+    test_run(test_array_create_ex_invalid_allocator);
+#ifdef ARRAY_INLINE_API
+    test_run(test_array_init);
+#endif
     test_run(test_array_length_of_empty);
     test_run(test_array_length_of_null);
     test_run(test_array_insert_at_beginning);
@@ -426,17 +2988,52 @@ int main(void) {
     test_run(test_array_remove_out_of_bounds);
     test_run(test_array_remove_decreases_length);
     test_run(test_array_remove_from_null);
+    test_run(test_array_insert_range_at_middle);
+    test_run(test_array_insert_range_grows_once);
+    test_run(test_array_insert_range_out_of_bounds);
+    test_run_no_memory(test_array_insert_range_no_memory);
+    test_run(test_array_remove_range);
+    test_run(test_array_remove_range_out_of_bounds);
     test_run(test_array_push_adds_to_end);
     test_run(test_array_push_adds_null);
     test_run(test_array_push_increases_length);
     test_run(test_array_push_to_null);
     test_run(test_array_capacity_increases);
-    test_run(test_array_capacity_no_memory);
+    test_run_no_memory(test_array_capacity_no_memory);
     test_run(test_array_capacity_of_empty);
     test_run(test_array_capacity_of_null);
+    test_run(test_array_reserve);
+    test_run_no_memory(test_array_reserve_no_memory);
+    test_run(test_array_shrink_to_fit);
+    test_run(test_array_shrink_to_fit_empty);
+    test_run(test_array_shrink_threshold);
+    test_run(test_array_shrink_threshold_invalid);
+    test_run(test_array_growth_policies);
+    test_run(test_array_growth_policy_invalid);
+    test_run(test_array_capacity_overflow);
+    test_run(test_array64_access);
+    test_run(test_array64_invalid);
+    test_run(test_array_gap_buffer);
+    test_run(test_array_gap_buffer_close);
+    test_run(test_array_clone);
+    test_run(test_array_snapshot);
+    test_run_no_memory(test_array_snapshot_no_memory);
+    test_run(test_array_snapshot_threads);
     test_run(test_array_pop_returns_element);
     test_run(test_array_pop_from_empty);
     test_run(test_array_pop_from_null);
+    test_run(test_array_push_front);
+    test_run(test_array_pop_front);
+    test_run(test_array_push_front_many);
+    test_run(test_array_queue_capacity_stays_bounded);
+    test_run(test_array_queue_when_full);
+    test_run(test_array_deque_matches_model);
+    test_run(test_array_pop_front_shrinks);
+    test_run(test_array_swap_remove);
+    test_run(test_array_retain);
+    test_run(test_array_span);
+    test_run(test_array_span_of_empty);
+    test_run(test_array_foreach);
     test_run(test_array_get);
     test_run(test_array_get_out_of_bounds);
     test_run(test_array_get_from_empty);
@@ -448,7 +3045,64 @@ int main(void) {
     test_run(test_array_last);
     test_run(test_array_last_of_empty);
     test_run(test_array_last_of_null);
+    test_run(test_array_create_typed);
+    test_run(test_array_value_functions);
+    test_run(test_array_value_functions_out_of_bounds);
+    test_run(test_array_value_from_same_array);
+    test_run(test_array_pointer_functions_on_typed_array);
+    test_run(test_array_define);
+    test_run(test_array_sort_values);
+    test_run(test_array_define_sort);
+    test_run(test_array_define_sort_patterns);
+    test_run(test_array_define_sort_heapsort);
+    test_run(test_array_define_sort_wrong_type);
+    test_run(test_array_sort_by_key);
+    test_run(test_array_sort_by_key_doubles);
+    test_run(test_array_sort_by_key_is_stable);
+    test_run_no_memory(test_array_sort_by_key_no_memory);
     test_run(test_array_sort);
+    test_run(test_array_sort_large);
+    test_run(test_array_sort_stable);
+    test_run(test_array_sort_stable_runs);
+    test_run(test_array_sort_stable_nearly_sorted);
+    test_run(test_array_sort_stable_invalid);
+    test_run(test_array_merge_sorted);
+    test_run(test_array_merge_sorted_batch);
+    test_run(test_array_merge_sorted_invalid);
+    test_run(test_array_lower_and_upper_bound);
+    test_run(test_array_bounds_of_empty);
+    test_run(test_array_bsearch);
+    test_run(test_array_bsearch_pointers);
+    test_run(test_array_insert_sorted);
+    test_run(test_array_define_search);
+    test_run(test_array_sort_parallel);
+    test_run(test_array_sort_parallel_stable);
+    test_run(test_array_sort_parallel_pointers);
+    test_run(test_array_sort_parallel_small);
+    test_run(test_array_sort_parallel_invalid);
+    test_run(test_array_sort_pool);
+    test_run(test_array_parallel_for_and_map);
+    test_run(test_array_filter_into);
+    test_run(test_array_reduce);
+    test_run(test_array_pool_nested_pass);
+    test_run(test_array_simd_integers);
+    test_run(test_array_simd_floating_point);
+    test_run(test_array_simd_fill_and_invalid);
+    test_run(test_concurrent_array_push_and_get);
+    test_run(test_concurrent_array_invalid);
+    test_run(test_concurrent_array_stress);
+    test_run(test_segmented_array_push_and_get);
+    test_run(test_segmented_array_pop_and_shrink);
+    test_run(test_segmented_array_foreach);
+    test_run_no_memory(test_segmented_array_no_memory);
+    test_run(test_array_file_reopen);
+    test_run(test_array_file_invalid);
+    test_run(test_array_serialize_raw);
+    test_run(test_array_serialize_delta);
+    test_run(test_array_serialize_delta_sizes);
+    test_run(test_array_serialize_file);
+    test_run(test_array_serialize_invalid);
+    test_run(test_array_stats);
     test_run(test_array_sort_empty);
     test_run(test_array_sort_null);
     test_print_stats();
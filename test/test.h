@@ -176,4 +176,18 @@ void *__wrap_realloc(void *ptr, size_t s)
 
 #endif /* WRAP_REALLOC */
 
+/*
+ * Whether allocations can be made to fail, which needs both malloc and
+ * realloc to be wrapped. Otherwise the macros above do nothing, and
+ * tests of running out of memory are skipped: test_run_no_memory runs
+ * the given test only if allocations can fail.
+ */
+#if defined(WRAP_MALLOC) && defined(WRAP_REALLOC)
+#define test_can_fail_allocations() 1
+#define test_run_no_memory(test_name) test_run(test_name)
+#else
+#define test_can_fail_allocations() 0
+#define test_run_no_memory(test_name) ((void) (test_name))
+#endif
+
 #endif /* TEST_H */